@@ -0,0 +1,162 @@
+/**
+ * Binary (1-bit) vectors and a flat index over them.
+ *
+ * Each dimension is reduced to one bit and packed 64 per uint64_t
+ * word, so a 1024-d float vector (4 KB) becomes 16 words (128 B) and
+ * a distance is a handful of XOR + popcount instructions. Useful both
+ * for natively binary data (fingerprints, hashes) and as a cheap
+ * first stage in front of an exact float32 rerank.
+ *
+ * Compile: g++ -std=c++17 -O3 -c binary.hpp   (link with distances.cpp)
+ */
+
+#pragma once
+
+#include "distances.hpp"
+#include "topk.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// --8<-- [start:binary_packing]
+/** Number of 64-bit words needed for d bits. */
+inline size_t binary_words(size_t d) { return (d + 63) / 64; }
+
+/**
+ * Sign binarization: bit i is set when x[i] > threshold[i] (or > 0
+ * without thresholds). Bit i lives in word i/64 at position i%64;
+ * padding bits in the last word stay zero so they never count.
+ */
+inline void binarize(const float *x, size_t d, uint64_t *out,
+                     const float *thresholds = nullptr) {
+  std::fill(out, out + binary_words(d), uint64_t{0});
+  for (size_t i = 0; i < d; ++i) {
+    float t = thresholds ? thresholds[i] : 0.0f;
+    if (x[i] > t)
+      out[i / 64] |= uint64_t{1} << (i % 64);
+  }
+}
+// --8<-- [end:binary_packing]
+
+// --8<-- [start:binary_flat_index]
+/**
+ * Exhaustive search over packed binary codes.
+ *
+ * Parameters:
+ *   dim           — number of bits per code (= float dimension)
+ *   metric        — Hamming (bit differences) or Jaccard (1 − IoU)
+ *   rerank_factor — when > 0 and vectors are added as floats, the
+ *                   best k × rerank_factor codes are re-scored with
+ *                   exact L2 on the float32 vectors (0 disables)
+ *
+ * Without rerank the distance is the binary metric; with rerank it is
+ * the Euclidean distance, as for the other indexes.
+ */
+class BinaryFlatIndex {
+public:
+  enum class Metric { Hamming, Jaccard };
+
+  struct SearchResult {
+    float distance;
+    size_t id;
+    bool operator<(const SearchResult &o) const {
+      return distance < o.distance;
+    }
+  };
+
+  BinaryFlatIndex(size_t dim, Metric metric = Metric::Hamming,
+                  size_t rerank_factor = 0)
+      : dim_(dim), words_(binary_words(dim)), metric_(metric),
+        rerank_factor_(rerank_factor),
+        kernels_(distance_kernels_for_dim(dim)) {}
+
+  /** Binarize float vectors by sign and add them. */
+  void add(const std::vector<std::vector<float>> &data) {
+    for (const auto &v : data) {
+      assert(v.size() == dim_);
+      codes_.resize(codes_.size() + words_);
+      binarize(v.data(), dim_, &codes_[codes_.size() - words_]);
+      if (rerank_factor_ > 0)
+        raw_.insert(raw_.end(), v.begin(), v.end());
+    }
+    ntotal_ += data.size();
+  }
+
+  /** Add n pre-packed codes (n × binary_words(dim) words). */
+  void add_codes(const uint64_t *codes, size_t n) {
+    assert(raw_.empty()); // rerank needs floats for every id
+    codes_.insert(codes_.end(), codes, codes + n * words_);
+    ntotal_ += n;
+  }
+
+  /** k nearest codes to a packed query code, by the binary metric. */
+  std::vector<SearchResult> search_code(const uint64_t *query,
+                                        size_t k) const {
+    TopKSelector topk(std::min(k, ntotal_));
+    scan(query, topk);
+    return to_results(topk.take_sorted(), false);
+  }
+
+  /** Binarize the query, scan the codes, optionally rerank exactly. */
+  std::vector<SearchResult> search(const std::vector<float> &query,
+                                   size_t k) const {
+    k = std::min(k, ntotal_);
+    std::vector<uint64_t> code(words_);
+    binarize(query.data(), dim_, code.data());
+
+    bool rerank = rerank_factor_ > 0 && !raw_.empty();
+    TopKSelector topk(rerank ? std::min(ntotal_, k * rerank_factor_) : k);
+    scan(code.data(), topk);
+    auto candidates = topk.take_sorted();
+
+    if (rerank) {
+      topk.reset(k);
+      for (const auto &c : candidates) {
+        topk.push(kernels_.l2_sq(query.data(), &raw_[c.id * dim_], dim_),
+                  c.id);
+      }
+      candidates = topk.take_sorted();
+    }
+    return to_results(std::move(candidates), rerank);
+  }
+
+  size_t size() const { return ntotal_; }
+  size_t code_words() const { return words_; }
+  const uint64_t *code(size_t id) const { return &codes_[id * words_]; }
+
+private:
+  void scan(const uint64_t *query, TopKSelector &topk) const {
+    if (metric_ == Metric::Hamming) {
+      for (size_t i = 0; i < ntotal_; ++i) {
+        uint32_t h = kernels_.hamming(query, &codes_[i * words_], words_);
+        topk.push(static_cast<float>(h), i);
+      }
+    } else {
+      for (size_t i = 0; i < ntotal_; ++i)
+        topk.push(kernels_.jaccard(query, &codes_[i * words_], words_), i);
+    }
+  }
+
+  static std::vector<SearchResult>
+  to_results(std::vector<TopKSelector::Entry> entries, bool squared_l2) {
+    std::vector<SearchResult> results;
+    results.reserve(entries.size());
+    for (const auto &e : entries) {
+      results.push_back(
+          {squared_l2 ? std::sqrt(e.distance) : e.distance, e.id});
+    }
+    return results;
+  }
+
+  size_t dim_, words_;
+  Metric metric_;
+  size_t rerank_factor_;
+  DistanceKernels kernels_; // runtime-dispatched SIMD kernels
+  size_t ntotal_ = 0;
+  std::vector<uint64_t> codes_; // ntotal × words, packed bits
+  std::vector<float> raw_;      // ntotal × dim, only when reranking
+};
+// --8<-- [end:binary_flat_index]
@@ -0,0 +1,529 @@
+/**
+ * bench_distances.cpp — Microbenchmarks for the distance kernels and
+ * top-k selection.
+ *
+ * Every kernel slot of every SIMD level the host supports is timed
+ * (l2_sq at the scalar level is l2_distance_naive, at AVX2 it is
+ * l2_distance_avx2, ...), so new kernels show up here as soon as they
+ * are added to the tables below. For each dimension the kernels are
+ * run over:
+ *   - aligned rows (64-byte boundary) vs unaligned rows (offset by the
+ *     element's natural alignment, so vector loads split cache lines)
+ *   - a hot working set (fits in L1/L2) vs a cold one (a sequential
+ *     sweep over a buffer much larger than the last-level cache)
+ *
+ * and reported as ns/distance and GB/s of stored-vector bytes read.
+ * Top-k selection strategies are timed separately over n random
+ * distances for several k.
+ *
+ * Results go to stdout (or --json FILE) as JSON, so hosts and
+ * compiler flags can be compared by diffing runs; a readable summary
+ * is printed to stderr.
+ *
+ * Usage:
+ *   ./bench_distances [--quick] [--json FILE] [--min-ms N] [--cold-mib N]
+ */
+
+#include "distances.hpp"
+#include "topk.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef VDB_BUILD_INFO
+#define VDB_BUILD_INFO __VERSION__
+#endif
+
+// ─────────────────────────────────────────────────────
+// Helpers
+// ─────────────────────────────────────────────────────
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+  bool quick = false;
+  std::string json_path; // empty → stdout
+  double min_ms = 50.0;  // minimum measured time per data point
+  size_t cold_mib = 256; // cold buffer size, well above a typical LLC
+};
+
+/** 64-byte aligned buffer that outlives every case. */
+struct AlignedBuffer {
+  explicit AlignedBuffer(size_t bytes)
+      : size(bytes), data(static_cast<uint8_t *>(
+                         ::operator new(bytes + 64, std::align_val_t(64)))) {}
+  ~AlignedBuffer() { ::operator delete(data, std::align_val_t(64)); }
+  AlignedBuffer(const AlignedBuffer &) = delete;
+  AlignedBuffer &operator=(const AlignedBuffer &) = delete;
+
+  size_t size;
+  uint8_t *data;
+};
+
+/** Prevents the compiler from discarding kernel results. */
+static volatile float g_sink;
+
+/**
+ * Runs fn(iteration) until at least min_ms have elapsed (after one
+ * warm-up call) and returns the mean nanoseconds per call.
+ */
+static double time_per_call(const std::function<void(size_t)> &fn,
+                            double min_ms) {
+  fn(0);
+  size_t calls = 0;
+  auto start = Clock::now();
+  double elapsed_ns = 0;
+  do {
+    fn(++calls);
+    elapsed_ns =
+        std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  } while (elapsed_ns < min_ms * 1e6);
+  return elapsed_ns / static_cast<double>(calls);
+}
+
+// ─────────────────────────────────────────────────────
+// Kernel cases
+// ─────────────────────────────────────────────────────
+
+/** Query buffers shared by all cases (one per input type). */
+struct Queries {
+  std::vector<float> f32;
+  std::vector<int8_t> s8;   // |w| ≤ 63, as the SQ kernels require
+  std::vector<uint64_t> b1; // packed bits
+};
+
+/**
+ * One timed kernel. run() scores `count` consecutive rows starting at
+ * `rows` (row_bytes(d) apart) and writes the distances to out.
+ */
+struct KernelCase {
+  std::string name;
+  SimdLevel level;
+  size_t align; // natural alignment of an element
+  std::function<size_t(size_t d)> row_bytes; // stored bytes per row
+  std::function<void(const Queries &q, const uint8_t *rows, size_t count,
+                     size_t d, float *out)>
+      run;
+};
+
+/** Scores rows one call at a time through a pairwise kernel. */
+template <typename Fn>
+static auto per_row(Fn fn, size_t elem_bytes) {
+  return [fn, elem_bytes](const Queries &q, const uint8_t *rows, size_t count,
+                          size_t d, float *out) {
+    for (size_t i = 0; i < count; ++i)
+      out[i] = fn(q, rows + i * d * elem_bytes, d);
+  };
+}
+
+/**
+ * Every kernel slot at every level the host can execute. Add a line
+ * here when a new slot appears in DistanceKernels or StorageKernels.
+ */
+static std::vector<KernelCase> kernel_cases() {
+  std::vector<KernelCase> cases;
+  auto f32_bytes = [](size_t d) { return d * sizeof(float); };
+  auto half_bytes = [](size_t d) { return d * sizeof(uint16_t); };
+  auto u8_bytes = [](size_t d) { return d; };
+  auto bit_bytes = [](size_t d) { return (d + 63) / 64 * sizeof(uint64_t); };
+
+  for (int l = 0; l <= static_cast<int>(detect_simd_level()); ++l) {
+    SimdLevel level = static_cast<SimdLevel>(l);
+    const DistanceKernels &k = distance_kernels(level);
+    if (k.level != level)
+      continue; // clamped to a level already covered
+    const StorageKernels &fp16 = storage_kernels(ScalarType::FP16, level);
+    const StorageKernels &bf16 = storage_kernels(ScalarType::BF16, level);
+
+    auto pair = [&](const char *name, DistanceFn fn) {
+      cases.push_back(
+          {name, level, sizeof(float), f32_bytes,
+           per_row(
+               [fn](const Queries &q, const uint8_t *row, size_t d) {
+                 return fn(q.f32.data(),
+                           reinterpret_cast<const float *>(row), d);
+               },
+               sizeof(float))});
+    };
+    auto batch = [&](const char *name, BatchDistanceFn fn) {
+      cases.push_back({name, level, sizeof(float), f32_bytes,
+                       [fn](const Queries &q, const uint8_t *rows,
+                            size_t count, size_t d, float *out) {
+                         fn(q.f32.data(),
+                            reinterpret_cast<const float *>(rows), count, d,
+                            out);
+                       }});
+    };
+    auto stored = [&](const char *name, StoredDistanceFn fn) {
+      cases.push_back(
+          {name, level, sizeof(uint16_t), half_bytes,
+           per_row(
+               [fn](const Queries &q, const uint8_t *row, size_t d) {
+                 return fn(q.f32.data(), row, d);
+               },
+               sizeof(uint16_t))});
+    };
+
+    pair("l2_sq", k.l2_sq);
+    pair("inner_product", k.inner_product);
+    pair("cosine", k.cosine);
+    batch("l2_sq_batch", k.l2_sq_batch);
+    batch("inner_product_batch", k.inner_product_batch);
+
+    // Dimension-specialized slots (the generic kernels at other dims).
+    cases.push_back({"l2_sq_fixed_dim", level, sizeof(float), f32_bytes,
+                     [level](const Queries &q, const uint8_t *rows,
+                             size_t count, size_t d, float *out) {
+                       DistanceFn fn = distance_kernels_for_dim(d, level).l2_sq;
+                       auto *base = reinterpret_cast<const float *>(rows);
+                       for (size_t i = 0; i < count; ++i)
+                         out[i] = fn(q.f32.data(), base + i * d, d);
+                     }});
+    cases.push_back({"l2_sq_batch_fixed_dim", level, sizeof(float), f32_bytes,
+                     [level](const Queries &q, const uint8_t *rows,
+                             size_t count, size_t d, float *out) {
+                       distance_kernels_for_dim(d, level).l2_sq_batch(
+                           q.f32.data(), reinterpret_cast<const float *>(rows),
+                           count, d, out);
+                     }});
+
+    // Full-length bounded and gathered scans: the cost of the block
+    // checks and of scattered (permuted) row order with prefetch.
+    const StorageKernels &fp32 = storage_kernels(ScalarType::FP32, level);
+    StoredBoundedFn bounded = fp32.l2_sq_bounded;
+    cases.push_back(
+        {"l2_sq_bounded", level, sizeof(float), f32_bytes,
+         per_row(
+             [bounded](const Queries &q, const uint8_t *row, size_t d) {
+               return bounded(q.f32.data(), row, d,
+                              std::numeric_limits<float>::infinity());
+             },
+             sizeof(float))});
+    StoredGatherBoundedFn gather = fp32.l2_sq_gather;
+    cases.push_back({"l2_sq_gather", level, sizeof(float), f32_bytes,
+                     [gather](const Queries &q, const uint8_t *rows,
+                              size_t count, size_t d, float *out) {
+                       uint32_t ids[64];
+                       size_t n = std::min<size_t>(count, 64);
+                       for (size_t i = 0; i < n; ++i)
+                         ids[i] = static_cast<uint32_t>(i * 37 % n);
+                       gather(q.f32.data(), rows, d * sizeof(float), ids, n,
+                              d, std::numeric_limits<float>::infinity(), out);
+                     }});
+
+    stored("l2_sq_fp16", fp16.l2_sq);
+    stored("l2_sq_bf16", bf16.l2_sq);
+
+    DotU8S8Fn dot = k.dot_u8s8;
+    cases.push_back(
+        {"dot_u8s8", level, 1, u8_bytes,
+         per_row(
+             [dot](const Queries &q, const uint8_t *row, size_t d) {
+               return static_cast<float>(dot(row, q.s8.data(), d));
+             },
+             1)});
+
+    HammingFn ham = k.hamming;
+    cases.push_back({"hamming", level, sizeof(uint64_t), bit_bytes,
+                     [ham](const Queries &q, const uint8_t *rows,
+                           size_t count, size_t d, float *out) {
+                       size_t words = (d + 63) / 64;
+                       auto *base = reinterpret_cast<const uint64_t *>(rows);
+                       for (size_t i = 0; i < count; ++i)
+                         out[i] = static_cast<float>(
+                             ham(q.b1.data(), base + i * words, words));
+                     }});
+  }
+  return cases;
+}
+
+/**
+ * Fill the row buffer with 16-bit patterns that are valid, normal
+ * numbers whichever way a case reads them: bf16 of ±[0.5, 1) is a
+ * normal fp16 too, and two of them side by side form a normal float32.
+ * Keeps denormal slow paths out of the measurements.
+ */
+static void fill_rows(AlignedBuffer &buf) {
+  std::mt19937 rng(7);
+  std::uniform_real_distribution<float> mag(0.5f, 1.0f);
+  auto *h = reinterpret_cast<uint16_t *>(buf.data);
+  for (size_t i = 0; i < (buf.size + 64) / sizeof(uint16_t); ++i) {
+    float x = (rng() & 1) ? mag(rng) : -mag(rng);
+    h[i] = float_to_bf16(x);
+  }
+}
+
+struct KernelResult {
+  std::string kernel;
+  SimdLevel level;
+  size_t dim;
+  bool aligned;
+  bool hot;
+  double ns_per_distance;
+  double gb_per_s;
+};
+
+static KernelResult bench_kernel(const KernelCase &c, const Queries &q,
+                                 const AlignedBuffer &buf, size_t d,
+                                 bool aligned, bool hot, double min_ms) {
+  constexpr size_t kHotBytes = 32 * 1024;
+  constexpr size_t kBlockRows = 64;
+
+  size_t row = c.row_bytes(d);
+  const uint8_t *base = buf.data + (aligned ? 0 : c.align);
+  size_t rows = std::max<size_t>(
+      (hot ? std::min(kHotBytes, buf.size) : buf.size) / row, 1);
+  size_t block = std::min(kBlockRows, rows);
+  size_t blocks = rows / block;
+
+  std::vector<float> out(block);
+  double ns_per_block = time_per_call(
+      [&](size_t it) {
+        c.run(q, base + (it % blocks) * block * row, block, d, out.data());
+        g_sink = out[0];
+      },
+      min_ms);
+
+  double ns = ns_per_block / static_cast<double>(block);
+  return {c.name, c.level, d, aligned, hot, ns, row / ns};
+}
+
+// ─────────────────────────────────────────────────────
+// Top-k selection strategies
+// ─────────────────────────────────────────────────────
+
+struct TopKStrategy {
+  const char *name;
+  std::function<size_t(const std::vector<float> &dists, size_t k)> run;
+};
+
+static std::vector<TopKStrategy> topk_strategies() {
+  using Pair = std::pair<float, size_t>;
+  auto pairs = [](const std::vector<float> &dists) {
+    std::vector<Pair> p(dists.size());
+    for (size_t i = 0; i < dists.size(); ++i)
+      p[i] = {dists[i], i};
+    return p;
+  };
+  return {
+      {"sort",
+       [pairs](const std::vector<float> &dists, size_t k) {
+         auto p = pairs(dists);
+         std::sort(p.begin(), p.end());
+         return p[k - 1].second;
+       }},
+      {"partial_sort",
+       [pairs](const std::vector<float> &dists, size_t k) {
+         auto p = pairs(dists);
+         std::partial_sort(p.begin(), p.begin() + k, p.end());
+         return p[k - 1].second;
+       }},
+      {"nth_element",
+       [pairs](const std::vector<float> &dists, size_t k) {
+         auto p = pairs(dists);
+         std::nth_element(p.begin(), p.begin() + (k - 1), p.end());
+         std::sort(p.begin(), p.begin() + k);
+         return p[k - 1].second;
+       }},
+      {"priority_queue",
+       [](const std::vector<float> &dists, size_t k) {
+         std::priority_queue<Pair> heap;
+         for (size_t i = 0; i < dists.size(); ++i) {
+           if (heap.size() < k) {
+             heap.push({dists[i], i});
+           } else if (dists[i] < heap.top().first) {
+             heap.pop();
+             heap.push({dists[i], i});
+           }
+         }
+         return heap.top().second;
+       }},
+      {"topk_heap",
+       [](const std::vector<float> &dists, size_t k) {
+         TopKHeap heap(k);
+         for (size_t i = 0; i < dists.size(); ++i)
+           heap.push(dists[i], i);
+         return heap.take_sorted().back().id;
+       }},
+      {"topk_selector",
+       [](const std::vector<float> &dists, size_t k) {
+         // Blocks of 256, as a scan delivers them from the batch kernel.
+         TopKSelector topk(k);
+         for (size_t i = 0; i < dists.size(); i += 256) {
+           size_t len = std::min<size_t>(256, dists.size() - i);
+           topk.push_block(dists.data() + i, len, i);
+         }
+         return topk.take_sorted().back().id;
+       }},
+  };
+}
+
+struct TopKResult {
+  std::string strategy;
+  size_t n;
+  size_t k;
+  double ms;
+  double ns_per_candidate;
+};
+
+// ─────────────────────────────────────────────────────
+// Output
+// ─────────────────────────────────────────────────────
+
+static void write_json(std::ostream &os,
+                       const std::vector<KernelResult> &kernels,
+                       const std::vector<TopKResult> &topk,
+                       const Options &opt) {
+  os << "{\n";
+  os << "  \"host\": {\"simd_level\": \""
+     << simd_level_name(detect_simd_level()) << "\", \"hardware_threads\": "
+     << std::thread::hardware_concurrency() << "},\n";
+  os << "  \"build\": \"" << VDB_BUILD_INFO << "\",\n";
+  os << "  \"config\": {\"min_ms\": " << opt.min_ms
+     << ", \"cold_mib\": " << opt.cold_mib << "},\n";
+
+  os << "  \"kernels\": [\n";
+  for (size_t i = 0; i < kernels.size(); ++i) {
+    const auto &r = kernels[i];
+    os << "    {\"kernel\": \"" << r.kernel << "\", \"level\": \""
+       << simd_level_name(r.level) << "\", \"dim\": " << r.dim
+       << ", \"aligned\": " << (r.aligned ? "true" : "false")
+       << ", \"cache\": \"" << (r.hot ? "hot" : "cold")
+       << "\", \"ns_per_distance\": " << r.ns_per_distance
+       << ", \"gb_per_s\": " << r.gb_per_s << "}"
+       << (i + 1 < kernels.size() ? ",\n" : "\n");
+  }
+  os << "  ],\n";
+
+  os << "  \"topk\": [\n";
+  for (size_t i = 0; i < topk.size(); ++i) {
+    const auto &r = topk[i];
+    os << "    {\"strategy\": \"" << r.strategy << "\", \"n\": " << r.n
+       << ", \"k\": " << r.k << ", \"ms\": " << r.ms
+       << ", \"ns_per_candidate\": " << r.ns_per_candidate << "}"
+       << (i + 1 < topk.size() ? ",\n" : "\n");
+  }
+  os << "  ]\n";
+  os << "}\n";
+}
+
+static Options parse_args(int argc, char **argv) {
+  Options opt;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--quick") {
+      opt.quick = true;
+      opt.min_ms = 10.0;
+      opt.cold_mib = 64;
+    } else if (arg == "--json" && i + 1 < argc) {
+      opt.json_path = argv[++i];
+    } else if (arg == "--min-ms" && i + 1 < argc) {
+      opt.min_ms = std::atof(argv[++i]);
+    } else if (arg == "--cold-mib" && i + 1 < argc) {
+      opt.cold_mib = static_cast<size_t>(std::atol(argv[++i]));
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--quick] [--json FILE] [--min-ms N] [--cold-mib N]\n";
+      std::exit(arg == "--help" ? 0 : 1);
+    }
+  }
+  return opt;
+}
+
+// ─────────────────────────────────────────────────────
+// Main
+// ─────────────────────────────────────────────────────
+
+int main(int argc, char **argv) {
+  Options opt = parse_args(argc, argv);
+
+  const std::vector<size_t> dims =
+      opt.quick ? std::vector<size_t>{32, 128, 1024, 4096}
+                : std::vector<size_t>{32,  64,   128,  256,  384, 512,
+                                      768, 1024, 1536, 2048, 4096};
+  const size_t max_dim = dims.back();
+
+  std::cerr << "bench_distances — host level "
+            << simd_level_name(detect_simd_level()) << ", cold buffer "
+            << opt.cold_mib << " MiB\n";
+
+  AlignedBuffer rows(opt.cold_mib << 20);
+  fill_rows(rows);
+
+  Queries q;
+  std::mt19937 rng(11);
+  std::normal_distribution<float> normal(0.0f, 1.0f);
+  std::uniform_int_distribution<int> weight(-63, 63);
+  q.f32.resize(max_dim);
+  q.s8.resize(max_dim);
+  q.b1.resize((max_dim + 63) / 64);
+  for (auto &v : q.f32)
+    v = normal(rng);
+  for (auto &v : q.s8)
+    v = static_cast<int8_t>(weight(rng));
+  for (auto &v : q.b1)
+    v = (static_cast<uint64_t>(rng()) << 32) | rng();
+
+  // Kernels
+  std::vector<KernelResult> kernel_results;
+  for (const auto &c : kernel_cases()) {
+    for (size_t d : dims) {
+      for (bool hot : {true, false}) {
+        for (bool aligned : {true, false}) {
+          auto r = bench_kernel(c, q, rows, d, aligned, hot, opt.min_ms);
+          kernel_results.push_back(r);
+          std::cerr << "  " << simd_level_name(r.level) << "/" << r.kernel
+                    << " d=" << d << (aligned ? " aligned " : " unaligned ")
+                    << (hot ? "hot " : "cold ") << r.ns_per_distance
+                    << " ns, " << r.gb_per_s << " GB/s\n";
+        }
+      }
+    }
+  }
+
+  // Top-k selection
+  std::vector<TopKResult> topk_results;
+  const std::vector<size_t> ns =
+      opt.quick ? std::vector<size_t>{10000, 100000}
+                : std::vector<size_t>{10000, 100000, 1000000};
+  for (size_t n : ns) {
+    std::vector<float> dists(n);
+    std::uniform_real_distribution<float> uni(0.0f, 100.0f);
+    for (auto &v : dists)
+      v = uni(rng);
+    for (size_t k : {1, 10, 100, 1000}) {
+      if (k > n)
+        continue;
+      for (const auto &s : topk_strategies()) {
+        double ns_call = time_per_call(
+            [&](size_t) { g_sink = static_cast<float>(s.run(dists, k)); },
+            opt.min_ms);
+        topk_results.push_back(
+            {s.name, n, k, ns_call / 1e6, ns_call / static_cast<double>(n)});
+        std::cerr << "  topk/" << s.name << " n=" << n << " k=" << k << " "
+                  << ns_call / 1e6 << " ms\n";
+      }
+    }
+  }
+
+  if (opt.json_path.empty()) {
+    write_json(std::cout, kernel_results, topk_results, opt);
+  } else {
+    std::ofstream out(opt.json_path);
+    write_json(out, kernel_results, topk_results, opt);
+    std::cerr << "wrote " << opt.json_path << "\n";
+  }
+  return 0;
+}
@@ -17,10 +17,13 @@
 #include "iceberg_store.hpp"
 #include "vector_db.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <map>
 #include <random>
 #include <vector>
 
@@ -317,6 +320,156 @@ void test_vdb_delete_and_search() {
   PASS();
 }
 
+void test_vdb_delete_repairs_graph() {
+  TEST("VectorDB delete hides nodes and reuses their slots");
+
+  const size_t dim = 8, n = 100;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/1000);
+  std::mt19937 rng(7);
+  std::vector<std::vector<float>> vecs;
+  for (size_t i = 0; i < n; ++i) {
+    vecs.push_back(random_vector(dim, rng));
+    db.insert(i, vecs.back());
+  }
+
+  // Deleting 20% crosses the repair threshold at least once.
+  for (uint64_t id = 0; id < 20; ++id)
+    db.delete_vector(id);
+  for (uint64_t id = 0; id < 20; ++id) {
+    auto results = db.search(vecs[id], 5);
+    ASSERT_EQ(results.size(), 5u, "Should still return 5 results");
+    for (const auto &r : results)
+      ASSERT_TRUE(r.id >= 20, "Deleted ID returned by search");
+  }
+
+  // New records take over freed slots instead of growing the graph.
+  for (uint64_t id = n; id < n + 10; ++id)
+    db.insert(id, random_vector(dim, rng));
+  ASSERT_EQ(db.index_size(), n, "Inserts reused freed HNSW slots");
+  auto results = db.search(vecs[50], 1);
+  ASSERT_TRUE(!results.empty() && results[0].id == 50u,
+              "Live record still found exactly");
+
+  PASS();
+}
+
+void test_vdb_filtered_search() {
+  TEST("VectorDB filtered search returns k matching records");
+
+  const size_t dim = 8, n = 500;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/1000);
+  std::mt19937 rng(11);
+  for (size_t i = 0; i < n; ++i) {
+    // 10 of 500 records belong to tenant "b"
+    db.insert(i, random_vector(dim, rng), i % 50 == 3 ? "b" : "a");
+  }
+
+  auto q = random_vector(dim, rng);
+  auto results = db.search(q, 5, [](const VectorRecord &r) {
+    return r.metadata == "b";
+  });
+  ASSERT_EQ(results.size(), 5u, "Should return 5 tenant-b results");
+  for (const auto &r : results)
+    ASSERT_TRUE(r.id % 50 == 3 && r.metadata == "b", "Non-matching result");
+
+  auto none = db.search(q, 5, [](const VectorRecord &) { return false; });
+  ASSERT_TRUE(none.empty(), "Empty filter returns nothing");
+
+  PASS();
+}
+
+void test_vdb_compressed_index() {
+  TEST("VectorDB compressed index reranks with stored embeddings");
+
+  const size_t dim = 16, n = 400;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/100);
+  std::mt19937 rng(5);
+  std::vector<std::vector<float>> data;
+  for (size_t i = 0; i < n; ++i) {
+    data.push_back(random_vector(dim, rng));
+    db.insert(i, data.back(), "m" + std::to_string(i));
+  }
+
+  ProductQuantizer pq(dim, /*M=*/4, /*K=*/32);
+  pq.train(data, 10);
+  db.compress_index(pq, /*rerank=*/50);
+  ASSERT_EQ(db.index_size(), n, "Index rebuilt over all live records");
+
+  // Exact distances after rerank: a stored vector finds itself at 0.
+  for (size_t i : {0u, 123u, 399u}) {
+    auto results = db.search(data[i], 3);
+    ASSERT_EQ(results.size(), 3u, "Should return 3 results");
+    ASSERT_EQ(results[0].id, static_cast<uint64_t>(i), "Self is nearest");
+    ASSERT_TRUE(results[0].distance < 1e-4f, "Reranked distance is exact");
+    ASSERT_TRUE(results[0].metadata == "m" + std::to_string(i),
+                "Metadata attached");
+    ASSERT_TRUE(results[1].distance <= results[2].distance,
+                "Sorted by exact distance");
+  }
+
+  // Deletes and filters work on the compressed graph too.
+  db.delete_vector(123);
+  auto after = db.search(data[123], 3);
+  for (const auto &r : after)
+    ASSERT_TRUE(r.id != 123u, "Deleted record not returned");
+  auto odd = db.search(data[0], 3, [](const VectorRecord &r) {
+    return r.id % 2 == 1;
+  });
+  ASSERT_EQ(odd.size(), 3u, "Filtered search returns 3 results");
+  for (const auto &r : odd)
+    ASSERT_TRUE(r.id % 2 == 1, "Non-matching result");
+
+  PASS();
+}
+
+void test_vdb_range_search() {
+  TEST("VectorDB range search returns live records within the radius");
+
+  const size_t dim = 8, n = 500;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/100);
+  std::mt19937 rng(13);
+  std::vector<std::vector<float>> data;
+  for (size_t i = 0; i < n; ++i) {
+    data.push_back(random_vector(dim, rng));
+    db.insert(i, data.back(), "m" + std::to_string(i));
+  }
+  auto dist = [&](const std::vector<float> &a, const std::vector<float> &b) {
+    float s = 0;
+    for (size_t j = 0; j < dim; ++j)
+      s += (a[j] - b[j]) * (a[j] - b[j]);
+    return std::sqrt(s);
+  };
+
+  // Radius of the 20th nearest record, so 20 are inside it.
+  const auto &q = data[42];
+  std::vector<float> all;
+  for (const auto &v : data)
+    all.push_back(dist(q, v));
+  std::nth_element(all.begin(), all.begin() + 19, all.end());
+  const float radius = all[19];
+  const size_t inside = 20;
+  auto results = db.range_search(q, radius);
+  ASSERT_TRUE(results.size() + 1 >= inside && results.size() <= inside,
+              "Finds (nearly) every record within the radius");
+  ASSERT_EQ(results[0].id, 42u, "Query record is first");
+  for (const auto &r : results) {
+    ASSERT_TRUE(r.distance <= radius, "Result outside the radius");
+    ASSERT_TRUE(r.metadata == "m" + std::to_string(r.id), "Metadata attached");
+  }
+
+  db.delete_vector(42);
+  auto after = db.range_search(q, radius);
+  for (const auto &r : after)
+    ASSERT_TRUE(r.id != 42u, "Deleted record not returned");
+  ASSERT_EQ(db.range_search(q, radius, 2).size(), 2u, "max_results caps");
+
+  PASS();
+}
+
 void test_vdb_compact_and_rebuild() {
   TEST("VectorDB compact and rebuild HNSW index");
 
@@ -402,6 +555,103 @@ void test_vdb_large_batch() {
   PASS();
 }
 
+void test_vdb_index_save_load() {
+  TEST("VectorDB reopens a saved HNSW index");
+
+  const size_t dim = 4;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/100);
+  db.insert(1, {1.0f, 0.0f, 0.0f, 0.0f});
+  db.insert(2, {0.0f, 1.0f, 0.0f, 0.0f});
+  db.insert(3, {1.0f, 1.0f, 0.0f, 0.0f});
+
+  std::string path = "/tmp/test_vdb_index.hnsw";
+  db.save_index(path);
+
+  // A restart sees the same records, and reopens the graph.
+  VectorDB restarted(dim, 8, 100, 50, 100);
+  restarted.insert(1, {1.0f, 0.0f, 0.0f, 0.0f});
+  restarted.insert(2, {0.0f, 1.0f, 0.0f, 0.0f});
+  restarted.insert(3, {1.0f, 1.0f, 0.0f, 0.0f});
+  restarted.load_index(path);
+  ASSERT_EQ(restarted.index_size(), 3u, "Loaded index has 3 nodes");
+  auto results = restarted.search({0.9f, 0.9f, 0.0f, 0.0f}, 1);
+  ASSERT_TRUE(!results.empty() && results[0].id == 3u,
+              "Loaded index finds ID 3");
+
+  VectorDB other(8);
+  bool caught = false;
+  try {
+    other.load_index(path);
+  } catch (const std::invalid_argument &) {
+    caught = true;
+  }
+  std::remove(path.c_str());
+  std::remove((path + ".labels").c_str());
+  ASSERT_TRUE(caught, "Should reject an index of another dimension");
+
+  PASS();
+}
+
+void test_vdb_index_save_load_after_reuse() {
+  TEST("VectorDB reopens an index whose slots were reused");
+
+  const size_t dim = 8, n = 50;
+  VectorDB db(dim, /*M=*/8, /*ef_c=*/100, /*ef_s=*/50,
+              /*seg_cap=*/1000);
+  std::mt19937 rng(11);
+  std::map<uint64_t, std::vector<float>> live;
+  for (uint64_t id = 0; id < n; ++id) {
+    live[id] = random_vector(dim, rng);
+    db.insert(id, live[id]);
+  }
+  // A repair frees slots, new records reuse them, and one delete is
+  // left unrepaired: node order no longer follows the records.
+  for (uint64_t id = 0; id < 8; ++id) {
+    db.delete_vector(id);
+    live.erase(id);
+  }
+  for (uint64_t id = 100; id < 108; ++id) {
+    live[id] = random_vector(dim, rng);
+    db.insert(id, live[id]);
+  }
+  db.delete_vector(20);
+  live.erase(20);
+  ASSERT_TRUE(db.index_size() < n + 8, "Inserts reused freed HNSW slots");
+
+  std::string path = "/tmp/test_vdb_index_reuse.hnsw";
+  db.save_index(path);
+
+  VectorDB restarted(dim, 8, 100, 50, 1000);
+  for (const auto &[id, vec] : live)
+    restarted.insert(id, vec);
+  restarted.load_index(path);
+  bool own = true;
+  for (const auto &[id, vec] : live) {
+    auto results = restarted.search(vec, 1);
+    own &= !results.empty() && results[0].id == id;
+  }
+  ASSERT_TRUE(own, "Every live record finds itself after reload");
+
+  // A store that no longer matches the saved graph is rejected.
+  restarted.delete_vector(30);
+  restarted.save_index(path);
+  VectorDB stale(dim, 8, 100, 50, 1000);
+  for (const auto &[id, vec] : live)
+    stale.insert(id, vec);
+  bool caught = false;
+  try {
+    stale.load_index(path);
+  } catch (const std::invalid_argument &) {
+    caught = true;
+  }
+  std::remove(path.c_str());
+  std::remove((path + ".labels").c_str());
+  ASSERT_TRUE(caught, "Should reject an index of other records");
+
+  PASS();
+}
+
 // ─────────────────────────────────────────────────────
 // Main
 // ─────────────────────────────────────────────────────
@@ -426,9 +676,15 @@ int main() {
   test_vdb_batch_ingest();
   test_vdb_search();
   test_vdb_delete_and_search();
+  test_vdb_delete_repairs_graph();
+  test_vdb_filtered_search();
+  test_vdb_compressed_index();
+  test_vdb_range_search();
   test_vdb_compact_and_rebuild();
   test_vdb_dimension_validation();
   test_vdb_large_batch();
+  test_vdb_index_save_load();
+  test_vdb_index_save_load_after_reuse();
 
   std::cout << "\n═══════════════════════════════════════════════" << std::endl;
   std::cout << "  Results: " << tests_passed << " passed, " << tests_failed
@@ -14,8 +14,13 @@
  * Architecture Overview:
  *   - INSERT: RecordBatch → IcebergStore (append to active segment)
  *             → Async index refresh into HNSW
- *   - SEARCH: Query vector → HNSW graph search → filter tombstones
- *   - DELETE: Tombstone in IcebergStore → background compaction
+ *   - SEARCH: Query vector → HNSW graph search for the k nearest or
+ *             all within a radius (deleted nodes skipped, optional
+ *             record filter applied inside the k-NN traversal);
+ *             a compressed graph (PQ/SQ codes) is reranked exactly
+ *             with the embeddings from the segments
+ *   - DELETE: Tombstone in IcebergStore + mark the HNSW node deleted;
+ *             the graph is repaired in place as deletes accumulate
  *   - COMPACT: Merge tombstoned segments → rebuild HNSW
  */
 
@@ -25,9 +30,15 @@
 #include "hnsw.hpp"
 #include "iceberg_store.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <stdexcept>
 #include <string>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 
 namespace vectordb {
@@ -54,11 +65,15 @@ public:
    * @param ef_construct HNSW beam width during graph construction
    * @param ef_search    HNSW beam width during queries
    * @param seg_capacity Max records per Iceberg segment before flush
+   * @param max_elements HNSW capacity (see HNSWIndex); rebuilds and
+   *                     loads grow it to twice the live records
    */
   VectorDB(size_t dim, size_t M = 16, size_t ef_construct = 200,
-           size_t ef_search = 50, size_t seg_capacity = 1000)
-      : dim_(dim), store_(dim, seg_capacity),
-        hnsw_(dim, M, ef_construct, ef_search) {}
+           size_t ef_search = 50, size_t seg_capacity = 1000,
+           size_t max_elements = HNSWIndex::kDefaultMaxElements)
+      : dim_(dim), max_elements_(max_elements), store_(dim, seg_capacity),
+        hnsw_(dim, M, ef_construct, ef_search, ScalarType::FP32, Metric::L2,
+              max_elements) {}
 
   // ─── ADBC-style Batch Ingestion ──────────────────
 
@@ -106,10 +121,11 @@ public:
 
     // 3. Insert each vector into the HNSW index
     const float *raw_floats = floats->raw_values();
+    const uint64_t *ids = id_col->raw_values();
     for (size_t i = 0; i < n; ++i) {
       std::vector<float> vec(raw_floats + i * dim_,
                              raw_floats + (i + 1) * dim_);
-      hnsw_.insert(vec);
+      bind(hnsw_.insert(vec), ids[i]);
     }
 
     return n;
@@ -123,7 +139,7 @@ public:
   void insert(uint64_t id, const std::vector<float> &embedding,
               const std::string &metadata = "") {
     store_.insert(id, embedding, metadata);
-    hnsw_.insert(embedding);
+    bind(hnsw_.insert(embedding), id);
   }
 
   // ─── Search ──────────────────────────────────────
@@ -132,10 +148,10 @@ public:
    * Search for the k nearest neighbors of a query vector.
    *
    * Process:
-   *   1. HNSW graph search returns candidate node indices.
+   *   1. HNSW graph search returns candidate node indices (nodes of
+   *      deleted records are never returned).
    *   2. Map HNSW indices back to record IDs.
-   *   3. Filter out tombstoned (deleted) IDs.
-   *   4. Enrich results with metadata from IcebergStore.
+   *   3. Enrich results with metadata from IcebergStore.
    */
   std::vector<VDBSearchResult> search(const std::vector<float> &query,
                                       size_t k) {
@@ -147,26 +163,69 @@ public:
     size_t ef = std::max(k * 2, static_cast<size_t>(50));
     hnsw_.set_ef_search(ef);
 
-    auto hnsw_results = hnsw_.search(query, ef);
+    auto hnsw_results = hnsw_.search(query, shortlist(ef));
+    return enrich(hnsw_results, store_.scan_all(), k, query);
+  }
 
-    // Get the full record set to map HNSW indices → IDs
-    auto all_records = store_.scan_all();
+  /**
+   * Search among the live records that pass `filter` (e.g. a tenant or
+   * metadata match).
+   *
+   * The filter becomes an allowed-node bitmap that the HNSW traversal
+   * honours: rejected nodes still route the search but never take a
+   * result slot, and very selective filters use two-hop expansion.
+   * Unlike post-filtering an over-fetched list, this returns k results
+   * whenever k records pass.
+   */
+  std::vector<VDBSearchResult>
+  search(const std::vector<float> &query, size_t k,
+         const std::function<bool(const VectorRecord &)> &filter) {
+    if (query.size() != dim_) {
+      throw std::invalid_argument("Query dimension mismatch");
+    }
 
-    // Build a set of deleted IDs for fast lookup
-    std::unordered_set<uint64_t> deleted_ids;
-    // (Tombstones are already filtered by scan_all, so
-    //  all_records only contains live records)
+    auto all_records = store_.scan_all();
+    std::vector<uint64_t> allowed((labels_.size() + 63) / 64, 0);
+    size_t passing = 0;
+    for (const auto &rec : all_records) {
+      auto it = nodes_.find(rec.id);
+      if (it == nodes_.end() || !filter(rec))
+        continue;
+      allowed[it->second / 64] |= uint64_t{1} << (it->second % 64);
+      ++passing;
+    }
+    if (passing == 0)
+      return {};
+
+    SearchFilter allow(allowed.data(), labels_.size());
+    allow.set_selectivity(static_cast<float>(passing) / labels_.size());
+    hnsw_.set_ef_search(std::max(k, static_cast<size_t>(50)));
+    return enrich(hnsw_.search(query, shortlist(k), allow), all_records, k,
+                  query);
+  }
 
-    std::vector<VDBSearchResult> results;
-    for (const auto &hr : hnsw_results) {
-      if (hr.id < all_records.size()) {
-        const auto &rec = all_records[hr.id];
-        results.push_back({rec.id, hr.distance, rec.metadata});
-      }
-      if (results.size() >= k)
-        break;
+  /**
+   * Every live record within Euclidean distance `radius` of the query,
+   * closest first and with metadata: at most max_results (0 = no cap),
+   * the closest ones if there are more. For dedup and clustering jobs.
+   *
+   * One HNSW range search (see HNSWIndex::range_search) replaces
+   * repeated k-NN searches with growing k. Deleted records are skipped
+   * by the graph and again against the tombstones; with a compressed
+   * graph the hits are rescored exactly and cut to the radius again.
+   */
+  std::vector<VDBSearchResult> range_search(const std::vector<float> &query,
+                                            float radius,
+                                            size_t max_results = 0) {
+    if (query.size() != dim_) {
+      throw std::invalid_argument("Query dimension mismatch");
     }
 
+    hnsw_.set_ef_search(50);
+    auto hits = hnsw_.range_search(query, radius, max_results);
+    auto results = enrich(hits, store_.scan_all(), hits.size(), query);
+    while (!results.empty() && results.back().distance > radius)
+      results.pop_back();
     return results;
   }
 
@@ -174,10 +233,22 @@ public:
 
   /**
    * Soft-delete a vector by ID (tombstone in Iceberg).
-   * The HNSW graph is NOT modified; tombstoned results
-   * are filtered during search.
+   *
+   * Its HNSW node is marked deleted: search skips it but still routes
+   * through it. Once more than kRepairRatio of the graph is deleted,
+   * the graph is repaired in place and the freed node slots are reused
+   * by later inserts, so no full rebuild is needed to stay fast.
    */
-  void delete_vector(uint64_t id) { store_.delete_vector(id); }
+  void delete_vector(uint64_t id) {
+    store_.delete_vector(id);
+    auto it = nodes_.find(id);
+    if (it == nodes_.end())
+      return;
+    hnsw_.mark_deleted(it->second);
+    nodes_.erase(it);
+    if (hnsw_.deleted_count() > kRepairRatio * hnsw_.size())
+      hnsw_.repair_deleted();
+  }
 
   // ─── Maintenance ─────────────────────────────────
 
@@ -185,23 +256,110 @@ public:
    * Compact tombstoned segments and rebuild the HNSW index
    * from the remaining live records.
    *
-   * This is the Iceberg "rewrite_data_files" equivalent.
+   * This is the Iceberg "rewrite_data_files" equivalent. The graph is
+   * rebuilt on num_threads threads (0 = all hardware threads), then
+   * its nodes are laid out in `order` (see HNSWIndex::reorder) so
+   * searches touch less memory; node ids, and so the records they
+   * map to, do not change.
    */
-  size_t compact_and_rebuild(float tombstone_threshold = 0.3f) {
+  size_t compact_and_rebuild(
+      float tombstone_threshold = 0.3f, size_t num_threads = 0,
+      HNSWIndex::Reorder order = HNSWIndex::Reorder::BFS) {
     size_t reclaimed = store_.compact(tombstone_threshold);
 
     // Full index rebuild from live data
-    auto live = store_.scan_all();
-    hnsw_ = HNSWIndex(dim_, 16, 200, 50); // Reset graph
+    rebuild_index(num_threads, order);
+    return reclaimed;
+  }
 
-    std::vector<std::vector<float>> vectors;
-    vectors.reserve(live.size());
-    for (const auto &r : live) {
-      vectors.push_back(r.embedding);
+  /**
+   * Keep the HNSW graph compressed (see HNSWIndex::set_quantizer):
+   * nodes hold `pq` codes instead of float32 embeddings, and every
+   * search reranks its best `rerank` graph hits exactly, with the
+   * embeddings of the Iceberg records it reads anyway. Train `pq` on
+   * a sample of the embeddings. Rebuilds the graph from live records;
+   * later rebuilds stay compressed.
+   */
+  void compress_index(const ProductQuantizer &pq, size_t rerank = 100) {
+    quantize_ = [pq](HNSWIndex &idx) { idx.set_quantizer(pq); };
+    rerank_ = rerank;
+    rebuild_index(0, HNSWIndex::Reorder::BFS);
+  }
+
+  /** compress_index with scalar-quantized (SQ8/SQ4) codes. */
+  void compress_index(const ScalarQuantizer &sq, size_t rerank = 100) {
+    quantize_ = [sq](HNSWIndex &idx) { idx.set_quantizer(sq); };
+    rerank_ = rerank;
+    rebuild_index(0, HNSWIndex::Reorder::BFS);
+  }
+
+  /**
+   * Persist the HNSW graph (see HNSWIndex::save), so a restart can
+   * reopen it with load_index instead of rebuilding it. The record ID
+   * of every node goes to `path` + ".labels": after deletes, repairs
+   * and slot reuse, node order no longer follows the records.
+   */
+  void save_index(const std::string &path) const {
+    hnsw_.save(path);
+    std::vector<uint64_t> labels(labels_);
+    labels.resize(hnsw_.size(), 0);
+    std::ofstream out(path + ".labels", std::ios::binary | std::ios::trunc);
+    uint64_t count = labels.size();
+    out.write(kLabelsMagic, sizeof(kLabelsMagic));
+    out.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    out.write(reinterpret_cast<const char *>(labels.data()),
+              count * sizeof(uint64_t));
+    if (!out.flush())
+      throw std::runtime_error("save_index: write failed for " + path +
+                               ".labels");
+  }
+
+  /**
+   * Replace the HNSW graph with one written by save_index. By default
+   * the file is memory-mapped: opening takes about as long as reading
+   * the per-node levels, and queries fault vector pages in on demand.
+   *
+   * Nodes are bound to records through the saved labels. The live
+   * nodes must hold exactly the live records (save the index after
+   * the last write), or std::invalid_argument is thrown.
+   */
+  void load_index(const std::string &path,
+                  HNSWIndex::LoadMode mode = HNSWIndex::LoadMode::Map) {
+    auto live = store_.scan_all();
+    HNSWIndex loaded =
+        HNSWIndex::load(path, mode, capacity_for(live.size()));
+    if (loaded.dimension() != dim_) {
+      throw std::invalid_argument("Index dimension mismatch: expected " +
+                                  std::to_string(dim_) + ", got " +
+                                  std::to_string(loaded.dimension()));
+    }
+    std::vector<uint64_t> labels = read_labels(path + ".labels");
+    if (labels.size() != loaded.size()) {
+      throw std::runtime_error("load_index: " + path + ".labels has " +
+                               std::to_string(labels.size()) +
+                               " entries for " +
+                               std::to_string(loaded.size()) + " nodes");
     }
-    hnsw_.build(vectors);
 
-    return reclaimed;
+    std::unordered_map<uint64_t, size_t> nodes;
+    for (size_t i = 0; i < labels.size(); ++i) {
+      if (!loaded.is_deleted(i) && !nodes.emplace(labels[i], i).second)
+        throw std::runtime_error("load_index: record " +
+                                 std::to_string(labels[i]) +
+                                 " is on two nodes in " + path);
+    }
+    bool matches = nodes.size() == live.size();
+    for (size_t i = 0; matches && i < live.size(); ++i)
+      matches = nodes.count(live[i].id) > 0;
+    if (!matches) {
+      throw std::invalid_argument(
+          "Index has " + std::to_string(nodes.size()) +
+          " live nodes that do not match the " + std::to_string(live.size()) +
+          " live records");
+    }
+    hnsw_ = std::move(loaded);
+    labels_ = std::move(labels);
+    nodes_ = std::move(nodes);
   }
 
   /**
@@ -219,9 +377,130 @@ public:
   size_t snapshot_count() const { return store_.snapshot_count(); }
 
 private:
+  /** Deleted fraction of the HNSW graph that triggers a repair. */
+  static constexpr float kRepairRatio = 0.1f;
+
+  /** Header of the labels file written by save_index. */
+  static constexpr char kLabelsMagic[8] = {'V', 'D', 'B', 'L',
+                                           'A', 'B', 'L', '1'};
+
+  /** The node → record IDs written by save_index. */
+  static std::vector<uint64_t> read_labels(const std::string &path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+      throw std::runtime_error("load_index: cannot open " + path);
+    char magic[sizeof(kLabelsMagic)];
+    uint64_t count = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char *>(&count), sizeof(count));
+    if (!in || std::memcmp(magic, kLabelsMagic, sizeof(magic)) != 0 ||
+        count > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error("load_index: not a labels file: " + path);
+    std::vector<uint64_t> labels(count);
+    in.read(reinterpret_cast<char *>(labels.data()),
+            count * sizeof(uint64_t));
+    if (!in)
+      throw std::runtime_error("load_index: truncated file " + path);
+    return labels;
+  }
+
+  /** HNSW capacity for a graph of n nodes, with room to double. */
+  size_t capacity_for(size_t n) const {
+    return std::max(max_elements_, 2 * n);
+  }
+
+  /** Graph hits to request for k results: the rerank list if longer. */
+  size_t shortlist(size_t k) const {
+    return hnsw_.compressed() ? std::max(k, rerank_) : k;
+  }
+
+  /**
+   * Map HNSW hits to their live records (tombstones are already
+   * filtered by scan_all) with metadata, keeping at most k. Hits of a
+   * compressed graph carry code distances: they are all rescored
+   * against the records' embeddings and re-sorted first.
+   */
+  std::vector<VDBSearchResult>
+  enrich(const std::vector<HNSWIndex::SearchResult> &hits,
+         const std::vector<VectorRecord> &all_records, size_t k,
+         const std::vector<float> &query) const {
+    std::unordered_map<uint64_t, size_t> by_id;
+    for (size_t i = 0; i < all_records.size(); ++i)
+      by_id[all_records[i].id] = i;
+
+    bool rerank = hnsw_.compressed();
+    const DistanceKernels &kernels = distance_kernels_for_dim(dim_);
+    std::vector<VDBSearchResult> results;
+    for (const auto &hr : hits) {
+      auto it = hr.id < labels_.size() ? by_id.find(labels_[hr.id])
+                                       : by_id.end();
+      if (it != by_id.end()) {
+        const auto &rec = all_records[it->second];
+        float distance = rerank ? std::sqrt(kernels.l2_sq(
+                                      query.data(), rec.embedding.data(), dim_))
+                                : hr.distance;
+        results.push_back({rec.id, distance, rec.metadata});
+      }
+      if (!rerank && results.size() >= k)
+        break;
+    }
+    if (rerank) {
+      std::sort(results.begin(), results.end(),
+                [](const VDBSearchResult &a, const VDBSearchResult &b) {
+                  return a.distance < b.distance;
+                });
+      if (results.size() > k)
+        results.resize(k);
+    }
+    return results;
+  }
+
+  /**
+   * Replace the graph with one built from the live records (node i
+   * holds the i-th in scan order), compressed if compress_index was
+   * called, and laid out in `order`.
+   */
+  void rebuild_index(size_t num_threads, HNSWIndex::Reorder order) {
+    auto live = store_.scan_all();
+    hnsw_ = HNSWIndex(dim_, 16, 200, 50, ScalarType::FP32, Metric::L2,
+                      capacity_for(live.size())); // Reset graph
+    if (quantize_)
+      quantize_(hnsw_);
+
+    std::vector<std::vector<float>> vectors;
+    vectors.reserve(live.size());
+    for (const auto &r : live) {
+      vectors.push_back(r.embedding);
+    }
+    hnsw_.build_parallel(vectors, num_threads);
+    hnsw_.reorder(order);
+    bind_in_scan_order(live);
+  }
+
+  /** Record that HNSW node `node` holds record `id`. */
+  void bind(size_t node, uint64_t id) {
+    if (node >= labels_.size())
+      labels_.resize(node + 1);
+    labels_[node] = id;
+    nodes_[id] = node;
+  }
+
+  /** Node i holds live[i], as after a rebuild from scan_all(). */
+  void bind_in_scan_order(const std::vector<VectorRecord> &live) {
+    labels_.clear();
+    nodes_.clear();
+    for (size_t i = 0; i < live.size(); ++i)
+      bind(i, live[i].id);
+  }
+
   size_t dim_;
+  size_t max_elements_; // HNSW capacity floor
   IcebergStore store_;
   HNSWIndex hnsw_;
+  std::vector<uint64_t> labels_;               // HNSW node → record ID
+  std::unordered_map<uint64_t, size_t> nodes_; // record ID → HNSW node
+  std::function<void(HNSWIndex &)> quantize_;  // compress_index, or empty
+  size_t rerank_ = 0;                          // graph hits to rerank
 };
 
 } // namespace vectordb
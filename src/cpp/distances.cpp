@@ -4,14 +4,33 @@
  * Demonstrates how production vector databases accelerate
  * distance calculations using AVX2/AVX-512 intrinsics.
  *
- * Compile: g++ -O3 -mavx2 -mfma -o distances distances.cpp
+ * SIMD kernels are compiled with per-function target attributes and
+ * picked at runtime (see distance_kernels()), so no -mavx2 / -march
+ * flag is needed:
+ *
+ * Compile: g++ -std=c++17 -O3 -c distances.cpp
  */
 
+#include "distances.hpp"
+#include "topk.hpp"
+
+#include <atomic>
 #include <cmath>
 #include <cstddef>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <algorithm>
 #include <numeric>
+#include <thread>
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define VDB_X86 1
+#include <immintrin.h>
+// Compile one function for an ISA the rest of the file does not assume.
+#define VDB_TARGET(isa) __attribute__((target(isa)))
+#endif
 
 // --8<-- [start:l2_naive]
 /**
@@ -28,17 +47,39 @@ float l2_distance_naive(const float* x, const float* y, size_t d) {
 }
 // --8<-- [end:l2_naive]
 
+float inner_product_naive(const float* x, const float* y, size_t d) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < d; ++i) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+/**
+ * Cosine similarity in a single pass: the dot product and both
+ * squared norms are accumulated together.
+ */
+float cosine_similarity_naive(const float* x, const float* y, size_t d) {
+    float dot = 0.0f, nx = 0.0f, ny = 0.0f;
+    for (size_t i = 0; i < d; ++i) {
+        dot += x[i] * y[i];
+        nx += x[i] * x[i];
+        ny += y[i] * y[i];
+    }
+    float denom = std::sqrt(nx) * std::sqrt(ny);
+    return (denom > 1e-10f) ? dot / denom : 0.0f;
+}
 
-// --8<-- [start:l2_simd]
-#ifdef __AVX2__
-#include <immintrin.h>
 
+// --8<-- [start:l2_simd]
+#ifdef VDB_X86
 /**
  * AVX2-optimized L2 squared distance.
  *
  * Processes 8 floats per iteration using 256-bit SIMD registers.
  * ~4-8x faster than scalar on modern CPUs.
  */
+VDB_TARGET("avx2,fma")
 float l2_distance_avx2(const float* x, const float* y, size_t d) {
     __m256 sum = _mm256_setzero_ps();
     size_t i = 0;
@@ -72,10 +113,11 @@ float l2_distance_avx2(const float* x, const float* y, size_t d) {
 
 
 // --8<-- [start:inner_product_simd]
-#ifdef __AVX2__
+#ifdef VDB_X86
 /**
  * AVX2-optimized inner product.
  */
+VDB_TARGET("avx2,fma")
 float inner_product_avx2(const float* x, const float* y, size_t d) {
     __m256 sum = _mm256_setzero_ps();
     size_t i = 0;
@@ -103,41 +145,2075 @@ float inner_product_avx2(const float* x, const float* y, size_t d) {
 // --8<-- [end:inner_product_simd]
 
 
+#ifdef VDB_X86
+VDB_TARGET("avx2,fma")
+static inline float hsum256(__m256 v) {
+    __m128 sum128 = _mm_add_ps(_mm256_castps256_ps128(v),
+                               _mm256_extractf128_ps(v, 1));
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    sum128 = _mm_hadd_ps(sum128, sum128);
+    return _mm_cvtss_f32(sum128);
+}
+
+VDB_TARGET("sse4.1")
+static inline float hsum128(__m128 v) {
+    v = _mm_hadd_ps(v, v);
+    v = _mm_hadd_ps(v, v);
+    return _mm_cvtss_f32(v);
+}
+
+/**
+ * AVX2-optimized cosine similarity: dot product and both norms
+ * share one pass over the data.
+ */
+VDB_TARGET("avx2,fma")
+float cosine_similarity_avx2(const float* x, const float* y, size_t d) {
+    __m256 dot = _mm256_setzero_ps();
+    __m256 nx = _mm256_setzero_ps();
+    __m256 ny = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 8 <= d; i += 8) {
+        __m256 vx = _mm256_loadu_ps(x + i);
+        __m256 vy = _mm256_loadu_ps(y + i);
+        dot = _mm256_fmadd_ps(vx, vy, dot);
+        nx = _mm256_fmadd_ps(vx, vx, nx);
+        ny = _mm256_fmadd_ps(vy, vy, ny);
+    }
+
+    float sdot = hsum256(dot), snx = hsum256(nx), sny = hsum256(ny);
+    for (; i < d; ++i) {
+        sdot += x[i] * y[i];
+        snx += x[i] * x[i];
+        sny += y[i] * y[i];
+    }
+    float denom = std::sqrt(snx) * std::sqrt(sny);
+    return (denom > 1e-10f) ? sdot / denom : 0.0f;
+}
+
+// ─── SSE4: 4 floats per iteration, no FMA ───────────
+
+VDB_TARGET("sse4.1")
+float l2_distance_sse4(const float* x, const float* y, size_t d) {
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
+        __m128 diff = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(diff, diff));
+    }
+    float result = hsum128(sum);
+    for (; i < d; ++i) {
+        float diff = x[i] - y[i];
+        result += diff * diff;
+    }
+    return result;
+}
+
+VDB_TARGET("sse4.1")
+float inner_product_sse4(const float* x, const float* y, size_t d) {
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(x + i),
+                                         _mm_loadu_ps(y + i)));
+    }
+    float result = hsum128(sum);
+    for (; i < d; ++i) {
+        result += x[i] * y[i];
+    }
+    return result;
+}
+
+VDB_TARGET("sse4.1")
+float cosine_similarity_sse4(const float* x, const float* y, size_t d) {
+    __m128 dot = _mm_setzero_ps();
+    __m128 nx = _mm_setzero_ps();
+    __m128 ny = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= d; i += 4) {
+        __m128 vx = _mm_loadu_ps(x + i);
+        __m128 vy = _mm_loadu_ps(y + i);
+        dot = _mm_add_ps(dot, _mm_mul_ps(vx, vy));
+        nx = _mm_add_ps(nx, _mm_mul_ps(vx, vx));
+        ny = _mm_add_ps(ny, _mm_mul_ps(vy, vy));
+    }
+    float sdot = hsum128(dot), snx = hsum128(nx), sny = hsum128(ny);
+    for (; i < d; ++i) {
+        sdot += x[i] * y[i];
+        snx += x[i] * x[i];
+        sny += y[i] * y[i];
+    }
+    float denom = std::sqrt(snx) * std::sqrt(sny);
+    return (denom > 1e-10f) ? sdot / denom : 0.0f;
+}
+
+// ─── AVX-512: 16 floats per iteration, masked tail ──
+
+/**
+ * AVX-512 L2 squared distance. The remainder is handled with a
+ * masked load instead of a scalar loop.
+ */
+VDB_TARGET("avx512f")
+float l2_distance_avx512(const float* x, const float* y, size_t d) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= d; i += 16) {
+        __m512 diff = _mm512_sub_ps(_mm512_loadu_ps(x + i),
+                                    _mm512_loadu_ps(y + i));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+    if (i < d) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (d - i)) - 1);
+        __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                                    _mm512_maskz_loadu_ps(mask, y + i));
+        sum = _mm512_fmadd_ps(diff, diff, sum);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+VDB_TARGET("avx512f")
+float inner_product_avx512(const float* x, const float* y, size_t d) {
+    __m512 sum = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= d; i += 16) {
+        sum = _mm512_fmadd_ps(_mm512_loadu_ps(x + i),
+                              _mm512_loadu_ps(y + i), sum);
+    }
+    if (i < d) {
+        __mmask16 mask = static_cast<__mmask16>((1u << (d - i)) - 1);
+        sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                              _mm512_maskz_loadu_ps(mask, y + i), sum);
+    }
+    return _mm512_reduce_add_ps(sum);
+}
+
+VDB_TARGET("avx512f")
+float cosine_similarity_avx512(const float* x, const float* y, size_t d) {
+    __m512 dot = _mm512_setzero_ps();
+    __m512 nx = _mm512_setzero_ps();
+    __m512 ny = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i < d; i += 16) {
+        __mmask16 mask = (d - i >= 16)
+                             ? static_cast<__mmask16>(0xFFFF)
+                             : static_cast<__mmask16>((1u << (d - i)) - 1);
+        __m512 vx = _mm512_maskz_loadu_ps(mask, x + i);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        dot = _mm512_fmadd_ps(vx, vy, dot);
+        nx = _mm512_fmadd_ps(vx, vx, nx);
+        ny = _mm512_fmadd_ps(vy, vy, ny);
+    }
+    float snx = _mm512_reduce_add_ps(nx), sny = _mm512_reduce_add_ps(ny);
+    float denom = std::sqrt(snx) * std::sqrt(sny);
+    return (denom > 1e-10f) ? _mm512_reduce_add_ps(dot) / denom : 0.0f;
+}
+#endif
+
+
+// --8<-- [start:batch_kernels]
+/**
+ * One-query-vs-many kernels.
+ *
+ * Scoring a block row by row reloads the query for every row and
+ * serializes on a single accumulator. These kernels walk four rows
+ * in lock-step instead: each query chunk is loaded once and feeds
+ * four independent accumulators, which also hides FMA latency.
+ * Rows left over after the last group of four use the 1×1 kernel.
+ */
+static void inner_product_batch_naive(const float* q, const float* base,
+                                      size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        for (size_t i = 0; i < d; ++i) {
+            float qi = q[i];
+            s0 += qi * x[i];
+            s1 += qi * x[d + i];
+            s2 += qi * x[2 * d + i];
+            s3 += qi * x[3 * d + i];
+        }
+        out[r] = s0;
+        out[r + 1] = s1;
+        out[r + 2] = s2;
+        out[r + 3] = s3;
+    }
+    for (; r < n; ++r)
+        out[r] = inner_product_naive(q, base + r * d, d);
+}
+
+static void l2_distance_batch_naive(const float* q, const float* base,
+                                    size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        float s0 = 0.0f, s1 = 0.0f, s2 = 0.0f, s3 = 0.0f;
+        for (size_t i = 0; i < d; ++i) {
+            float qi = q[i];
+            float d0 = qi - x[i], d1 = qi - x[d + i];
+            float d2 = qi - x[2 * d + i], d3 = qi - x[3 * d + i];
+            s0 += d0 * d0;
+            s1 += d1 * d1;
+            s2 += d2 * d2;
+            s3 += d3 * d3;
+        }
+        out[r] = s0;
+        out[r + 1] = s1;
+        out[r + 2] = s2;
+        out[r + 3] = s3;
+    }
+    for (; r < n; ++r)
+        out[r] = l2_distance_naive(q, base + r * d, d);
+}
+
+#ifdef VDB_X86
+// SSE4 hosts predate FMA and have few registers to tile with; they
+// simply loop over the 1×1 kernel.
+static void inner_product_batch_sse4(const float* q, const float* base,
+                                     size_t n, size_t d, float* out) {
+    for (size_t r = 0; r < n; ++r)
+        out[r] = inner_product_sse4(q, base + r * d, d);
+}
+
+static void l2_distance_batch_sse4(const float* q, const float* base,
+                                   size_t n, size_t d, float* out) {
+    for (size_t r = 0; r < n; ++r)
+        out[r] = l2_distance_sse4(q, base + r * d, d);
+}
+
+VDB_TARGET("avx2,fma")
+static void inner_product_batch_avx2(const float* q, const float* base,
+                                     size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            __m256 vq = _mm256_loadu_ps(q + i);
+            s0 = _mm256_fmadd_ps(vq, _mm256_loadu_ps(x + i), s0);
+            s1 = _mm256_fmadd_ps(vq, _mm256_loadu_ps(x + d + i), s1);
+            s2 = _mm256_fmadd_ps(vq, _mm256_loadu_ps(x + 2 * d + i), s2);
+            s3 = _mm256_fmadd_ps(vq, _mm256_loadu_ps(x + 3 * d + i), s3);
+        }
+        float t0 = hsum256(s0), t1 = hsum256(s1);
+        float t2 = hsum256(s2), t3 = hsum256(s3);
+        for (; i < d; ++i) {
+            t0 += q[i] * x[i];
+            t1 += q[i] * x[d + i];
+            t2 += q[i] * x[2 * d + i];
+            t3 += q[i] * x[3 * d + i];
+        }
+        out[r] = t0;
+        out[r + 1] = t1;
+        out[r + 2] = t2;
+        out[r + 3] = t3;
+    }
+    for (; r < n; ++r)
+        out[r] = inner_product_avx2(q, base + r * d, d);
+}
+
+VDB_TARGET("avx2,fma")
+static void l2_distance_batch_avx2(const float* q, const float* base,
+                                   size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        size_t i = 0;
+        for (; i + 8 <= d; i += 8) {
+            __m256 vq = _mm256_loadu_ps(q + i);
+            __m256 d0 = _mm256_sub_ps(vq, _mm256_loadu_ps(x + i));
+            __m256 d1 = _mm256_sub_ps(vq, _mm256_loadu_ps(x + d + i));
+            __m256 d2 = _mm256_sub_ps(vq, _mm256_loadu_ps(x + 2 * d + i));
+            __m256 d3 = _mm256_sub_ps(vq, _mm256_loadu_ps(x + 3 * d + i));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+            s2 = _mm256_fmadd_ps(d2, d2, s2);
+            s3 = _mm256_fmadd_ps(d3, d3, s3);
+        }
+        float t0 = hsum256(s0), t1 = hsum256(s1);
+        float t2 = hsum256(s2), t3 = hsum256(s3);
+        for (; i < d; ++i) {
+            float d0 = q[i] - x[i], d1 = q[i] - x[d + i];
+            float d2 = q[i] - x[2 * d + i], d3 = q[i] - x[3 * d + i];
+            t0 += d0 * d0;
+            t1 += d1 * d1;
+            t2 += d2 * d2;
+            t3 += d3 * d3;
+        }
+        out[r] = t0;
+        out[r + 1] = t1;
+        out[r + 2] = t2;
+        out[r + 3] = t3;
+    }
+    for (; r < n; ++r)
+        out[r] = l2_distance_avx2(q, base + r * d, d);
+}
+
+VDB_TARGET("avx512f")
+static void inner_product_batch_avx512(const float* q, const float* base,
+                                       size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < d; i += 16) {
+            __mmask16 m = (d - i >= 16)
+                              ? static_cast<__mmask16>(0xFFFF)
+                              : static_cast<__mmask16>((1u << (d - i)) - 1);
+            __m512 vq = _mm512_maskz_loadu_ps(m, q + i);
+            s0 = _mm512_fmadd_ps(vq, _mm512_maskz_loadu_ps(m, x + i), s0);
+            s1 = _mm512_fmadd_ps(vq, _mm512_maskz_loadu_ps(m, x + d + i), s1);
+            s2 = _mm512_fmadd_ps(
+                vq, _mm512_maskz_loadu_ps(m, x + 2 * d + i), s2);
+            s3 = _mm512_fmadd_ps(
+                vq, _mm512_maskz_loadu_ps(m, x + 3 * d + i), s3);
+        }
+        out[r] = _mm512_reduce_add_ps(s0);
+        out[r + 1] = _mm512_reduce_add_ps(s1);
+        out[r + 2] = _mm512_reduce_add_ps(s2);
+        out[r + 3] = _mm512_reduce_add_ps(s3);
+    }
+    for (; r < n; ++r)
+        out[r] = inner_product_avx512(q, base + r * d, d);
+}
+
+VDB_TARGET("avx512f")
+static void l2_distance_batch_avx512(const float* q, const float* base,
+                                     size_t n, size_t d, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * d;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+        for (size_t i = 0; i < d; i += 16) {
+            __mmask16 m = (d - i >= 16)
+                              ? static_cast<__mmask16>(0xFFFF)
+                              : static_cast<__mmask16>((1u << (d - i)) - 1);
+            __m512 vq = _mm512_maskz_loadu_ps(m, q + i);
+            __m512 d0 = _mm512_sub_ps(vq, _mm512_maskz_loadu_ps(m, x + i));
+            __m512 d1 =
+                _mm512_sub_ps(vq, _mm512_maskz_loadu_ps(m, x + d + i));
+            __m512 d2 =
+                _mm512_sub_ps(vq, _mm512_maskz_loadu_ps(m, x + 2 * d + i));
+            __m512 d3 =
+                _mm512_sub_ps(vq, _mm512_maskz_loadu_ps(m, x + 3 * d + i));
+            s0 = _mm512_fmadd_ps(d0, d0, s0);
+            s1 = _mm512_fmadd_ps(d1, d1, s1);
+            s2 = _mm512_fmadd_ps(d2, d2, s2);
+            s3 = _mm512_fmadd_ps(d3, d3, s3);
+        }
+        out[r] = _mm512_reduce_add_ps(s0);
+        out[r + 1] = _mm512_reduce_add_ps(s1);
+        out[r + 2] = _mm512_reduce_add_ps(s2);
+        out[r + 3] = _mm512_reduce_add_ps(s3);
+    }
+    for (; r < n; ++r)
+        out[r] = l2_distance_avx512(q, base + r * d, d);
+}
+#endif
+// --8<-- [end:batch_kernels]
+
+
+// --8<-- [start:early_abandon]
+/**
+ * Threshold-aware ("early abandon") L2.
+ *
+ * A search only needs to know whether a candidate beats the current
+ * worst result. The squared distance is a sum of non-negative terms,
+ * so once a prefix of it reaches the bound the candidate is rejected
+ * and the remaining dimensions need not be read. The partial sum is
+ * checked once per block (a horizontal reduce is not free), and the
+ * value returned is either the exact distance (< bound) or a partial
+ * sum that is already ≥ bound.
+ */
+static float l2_sq_bounded_naive(const float* x, const float* y, size_t d,
+                                 float bound) {
+    constexpr size_t kBlock = 32;
+    float sum = 0.0f;
+    size_t i = 0;
+    for (; i + kBlock <= d; i += kBlock) {
+        for (size_t j = i; j < i + kBlock; ++j) {
+            float diff = x[j] - y[j];
+            sum += diff * diff;
+        }
+        if (sum >= bound)
+            return sum;
+    }
+    for (; i < d; ++i) {
+        float diff = x[i] - y[i];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+#ifdef VDB_X86
+VDB_TARGET("sse4.1")
+static float l2_sq_bounded_sse4(const float* x, const float* y, size_t d,
+                                float bound) {
+    constexpr size_t kBlock = 32;
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + kBlock <= d; i += kBlock) {
+        for (size_t j = i; j < i + kBlock; j += 8) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(x + j), _mm_loadu_ps(y + j));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(x + j + 4),
+                                   _mm_loadu_ps(y + j + 4));
+            s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+        }
+        float partial = hsum128(_mm_add_ps(s0, s1));
+        if (partial >= bound)
+            return partial;
+    }
+    return hsum128(_mm_add_ps(s0, s1)) + l2_distance_sse4(x + i, y + i, d - i);
+}
+
+VDB_TARGET("avx2,fma")
+static float l2_sq_bounded_avx2(const float* x, const float* y, size_t d,
+                                float bound) {
+    constexpr size_t kBlock = 64;
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + kBlock <= d; i += kBlock) {
+        for (size_t j = i; j < i + kBlock; j += 16) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + j),
+                                      _mm256_loadu_ps(y + j));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x + j + 8),
+                                      _mm256_loadu_ps(y + j + 8));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+        }
+        float partial = hsum256(_mm256_add_ps(s0, s1));
+        if (partial >= bound)
+            return partial;
+    }
+    return hsum256(_mm256_add_ps(s0, s1)) +
+           l2_distance_avx2(x + i, y + i, d - i);
+}
+
+VDB_TARGET("avx512f")
+static float l2_sq_bounded_avx512(const float* x, const float* y, size_t d,
+                                  float bound) {
+    constexpr size_t kBlock = 128;
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + kBlock <= d; i += kBlock) {
+        for (size_t j = i; j < i + kBlock; j += 32) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(x + j),
+                                      _mm512_loadu_ps(y + j));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(x + j + 16),
+                                      _mm512_loadu_ps(y + j + 16));
+            s0 = _mm512_fmadd_ps(d0, d0, s0);
+            s1 = _mm512_fmadd_ps(d1, d1, s1);
+        }
+        float partial = _mm512_reduce_add_ps(_mm512_add_ps(s0, s1));
+        if (partial >= bound)
+            return partial;
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(s0, s1)) +
+           l2_distance_avx512(x + i, y + i, d - i);
+}
+#endif
+
+std::vector<uint32_t> variance_order(const float* data, size_t n, size_t d) {
+    std::vector<double> mean(d, 0.0), var(d, 0.0);
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < d; ++j) {
+            mean[j] += data[i * d + j];
+        }
+    }
+    for (size_t j = 0; j < d; ++j) {
+        mean[j] /= static_cast<double>(std::max<size_t>(n, 1));
+    }
+    for (size_t i = 0; i < n; ++i) {
+        for (size_t j = 0; j < d; ++j) {
+            double c = data[i * d + j] - mean[j];
+            var[j] += c * c;
+        }
+    }
+    std::vector<uint32_t> order(d);
+    std::iota(order.begin(), order.end(), 0u);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint32_t a, uint32_t b) { return var[a] > var[b]; });
+    return order;
+}
+
+void permute_dims(const float* src, const uint32_t* order, size_t d,
+                  float* dst) {
+    for (size_t j = 0; j < d; ++j) {
+        dst[j] = src[order[j]];
+    }
+}
+// --8<-- [end:early_abandon]
+
+
+
+// --8<-- [start:integer_kernels]
+/**
+ * Integer kernels for scalar-quantized codes.
+ *
+ * pmaddubsw multiplies unsigned bytes by signed bytes and adds
+ * adjacent pairs into int16; pmaddwd against a vector of ones then
+ * widens to int32. VNNI's vpdpbusd fuses both steps (and cannot
+ * saturate). A 4-bit byte is split into its two nibbles first.
+ */
+static int32_t dot_u8s8_naive(const uint8_t* c, const int8_t* w, size_t d) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < d; ++i)
+        sum += static_cast<int32_t>(c[i]) * w[i];
+    return sum;
+}
+
+static int32_t dot_u4s8_naive(const uint8_t* c, const int8_t* w_lo,
+                              const int8_t* w_hi, size_t nbytes) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < nbytes; ++i) {
+        sum += static_cast<int32_t>(c[i] & 0x0F) * w_lo[i];
+        sum += static_cast<int32_t>(c[i] >> 4) * w_hi[i];
+    }
+    return sum;
+}
+
+#ifdef VDB_X86
+VDB_TARGET("sse4.1")
+static inline int32_t hsum_epi32_128(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+VDB_TARGET("avx2,fma")
+static inline int32_t hsum_epi32_256(__m256i v) {
+    return hsum_epi32_128(_mm_add_epi32(_mm256_castsi256_si128(v),
+                                        _mm256_extracti128_si256(v, 1)));
+}
+
+VDB_TARGET("sse4.1")
+static int32_t dot_u8s8_sse4(const uint8_t* c, const int8_t* w, size_t d) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= d; i += 16) {
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        __m128i vw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w + i));
+        acc = _mm_add_epi32(acc,
+                            _mm_madd_epi16(_mm_maddubs_epi16(vc, vw), ones));
+    }
+    return hsum_epi32_128(acc) + dot_u8s8_naive(c + i, w + i, d - i);
+}
+
+VDB_TARGET("sse4.1")
+static int32_t dot_u4s8_sse4(const uint8_t* c, const int8_t* w_lo,
+                             const int8_t* w_hi, size_t nbytes) {
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= nbytes; i += 16) {
+        __m128i vc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(c + i));
+        __m128i lo = _mm_and_si128(vc, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(vc, 4), nibble);
+        __m128i wl =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(w_lo + i));
+        __m128i wh =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(w_hi + i));
+        __m128i p = _mm_add_epi16(_mm_maddubs_epi16(lo, wl),
+                                  _mm_maddubs_epi16(hi, wh));
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(p, ones));
+    }
+    return hsum_epi32_128(acc) +
+           dot_u4s8_naive(c + i, w_lo + i, w_hi + i, nbytes - i);
+}
+
+VDB_TARGET("avx2,fma")
+static int32_t dot_u8s8_avx2(const uint8_t* c, const int8_t* w, size_t d) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= d; i += 32) {
+        __m256i vc =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+        __m256i vw =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w + i));
+        acc = _mm256_add_epi32(
+            acc, _mm256_madd_epi16(_mm256_maddubs_epi16(vc, vw), ones));
+    }
+    return hsum_epi32_256(acc) + dot_u8s8_naive(c + i, w + i, d - i);
+}
+
+VDB_TARGET("avx2,fma")
+static int32_t dot_u4s8_avx2(const uint8_t* c, const int8_t* w_lo,
+                             const int8_t* w_hi, size_t nbytes) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= nbytes; i += 32) {
+        __m256i vc =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(c + i));
+        __m256i lo = _mm256_and_si256(vc, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(vc, 4), nibble);
+        __m256i wl =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w_lo + i));
+        __m256i wh =
+            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(w_hi + i));
+        __m256i p = _mm256_add_epi16(_mm256_maddubs_epi16(lo, wl),
+                                     _mm256_maddubs_epi16(hi, wh));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(p, ones));
+    }
+    return hsum_epi32_256(acc) +
+           dot_u4s8_naive(c + i, w_lo + i, w_hi + i, nbytes - i);
+}
+
+VDB_TARGET("avx512f,avx512bw,avx512vnni")
+static int32_t dot_u8s8_vnni(const uint8_t* c, const int8_t* w, size_t d) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < d; i += 64) {
+        __mmask64 m = (d - i >= 64) ? ~0ULL : ((1ULL << (d - i)) - 1);
+        acc = _mm512_dpbusd_epi32(acc, _mm512_maskz_loadu_epi8(m, c + i),
+                                  _mm512_maskz_loadu_epi8(m, w + i));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+VDB_TARGET("avx512f,avx512bw,avx512vnni")
+static int32_t dot_u4s8_vnni(const uint8_t* c, const int8_t* w_lo,
+                             const int8_t* w_hi, size_t nbytes) {
+    const __m512i nibble = _mm512_set1_epi8(0x0F);
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < nbytes; i += 64) {
+        __mmask64 m =
+            (nbytes - i >= 64) ? ~0ULL : ((1ULL << (nbytes - i)) - 1);
+        __m512i vc = _mm512_maskz_loadu_epi8(m, c + i);
+        __m512i lo = _mm512_and_si512(vc, nibble);
+        __m512i hi = _mm512_and_si512(_mm512_srli_epi16(vc, 4), nibble);
+        acc = _mm512_dpbusd_epi32(acc, lo,
+                                  _mm512_maskz_loadu_epi8(m, w_lo + i));
+        acc = _mm512_dpbusd_epi32(acc, hi,
+                                  _mm512_maskz_loadu_epi8(m, w_hi + i));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+#endif
+// --8<-- [end:integer_kernels]
+
+
+// --8<-- [start:binary_kernels]
+/**
+ * Binary (1-bit) kernels over packed uint64_t words.
+ *
+ * Hamming distance is popcount(a XOR b). The scalar tier uses a SWAR
+ * popcount so it does not depend on the popcnt instruction; the SSE4
+ * and AVX2 tiers use hardware popcnt, and AVX-512 hosts with
+ * VPOPCNTDQ count eight words per instruction.
+ */
+static inline uint32_t popcount64_swar(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return static_cast<uint32_t>((x * 0x0101010101010101ULL) >> 56);
+}
+
+static inline float jaccard_from_counts(uint32_t inter, uint32_t uni) {
+    return uni == 0 ? 0.0f
+                    : 1.0f - static_cast<float>(inter) /
+                                 static_cast<float>(uni);
+}
+
+static uint32_t hamming_naive(const uint64_t* a, const uint64_t* b,
+                              size_t nwords) {
+    uint32_t sum = 0;
+    for (size_t i = 0; i < nwords; ++i)
+        sum += popcount64_swar(a[i] ^ b[i]);
+    return sum;
+}
+
+static float jaccard_naive(const uint64_t* a, const uint64_t* b,
+                           size_t nwords) {
+    uint32_t inter = 0, uni = 0;
+    for (size_t i = 0; i < nwords; ++i) {
+        inter += popcount64_swar(a[i] & b[i]);
+        uni += popcount64_swar(a[i] | b[i]);
+    }
+    return jaccard_from_counts(inter, uni);
+}
+
+#if defined(VDB_X86) && defined(__x86_64__)
+VDB_TARGET("popcnt")
+static uint32_t hamming_popcnt(const uint64_t* a, const uint64_t* b,
+                               size_t nwords) {
+    // Four independent counters keep the popcnt port busy.
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= nwords; i += 4) {
+        s0 += _mm_popcnt_u64(a[i] ^ b[i]);
+        s1 += _mm_popcnt_u64(a[i + 1] ^ b[i + 1]);
+        s2 += _mm_popcnt_u64(a[i + 2] ^ b[i + 2]);
+        s3 += _mm_popcnt_u64(a[i + 3] ^ b[i + 3]);
+    }
+    for (; i < nwords; ++i)
+        s0 += _mm_popcnt_u64(a[i] ^ b[i]);
+    return static_cast<uint32_t>(s0 + s1 + s2 + s3);
+}
+
+VDB_TARGET("popcnt")
+static float jaccard_popcnt(const uint64_t* a, const uint64_t* b,
+                            size_t nwords) {
+    uint64_t inter = 0, uni = 0;
+    for (size_t i = 0; i < nwords; ++i) {
+        inter += _mm_popcnt_u64(a[i] & b[i]);
+        uni += _mm_popcnt_u64(a[i] | b[i]);
+    }
+    return jaccard_from_counts(static_cast<uint32_t>(inter),
+                               static_cast<uint32_t>(uni));
+}
+
+VDB_TARGET("avx512f,avx512vpopcntdq")
+static uint32_t hamming_vpopcntdq(const uint64_t* a, const uint64_t* b,
+                                  size_t nwords) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < nwords; i += 8) {
+        __mmask8 m = (nwords - i >= 8)
+                         ? static_cast<__mmask8>(0xFF)
+                         : static_cast<__mmask8>((1u << (nwords - i)) - 1);
+        __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi64(m, a + i),
+                                     _mm512_maskz_loadu_epi64(m, b + i));
+        acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(x));
+    }
+    return static_cast<uint32_t>(_mm512_reduce_add_epi64(acc));
+}
+
+VDB_TARGET("avx512f,avx512vpopcntdq")
+static float jaccard_vpopcntdq(const uint64_t* a, const uint64_t* b,
+                               size_t nwords) {
+    __m512i inter = _mm512_setzero_si512();
+    __m512i uni = _mm512_setzero_si512();
+    for (size_t i = 0; i < nwords; i += 8) {
+        __mmask8 m = (nwords - i >= 8)
+                         ? static_cast<__mmask8>(0xFF)
+                         : static_cast<__mmask8>((1u << (nwords - i)) - 1);
+        __m512i va = _mm512_maskz_loadu_epi64(m, a + i);
+        __m512i vb = _mm512_maskz_loadu_epi64(m, b + i);
+        inter = _mm512_add_epi64(
+            inter, _mm512_popcnt_epi64(_mm512_and_si512(va, vb)));
+        uni = _mm512_add_epi64(uni,
+                               _mm512_popcnt_epi64(_mm512_or_si512(va, vb)));
+    }
+    return jaccard_from_counts(
+        static_cast<uint32_t>(_mm512_reduce_add_epi64(inter)),
+        static_cast<uint32_t>(_mm512_reduce_add_epi64(uni)));
+}
+#else
+// 32-bit x86 has no 64-bit popcnt; fall back to the portable kernels.
+#define hamming_popcnt hamming_naive
+#define jaccard_popcnt jaccard_naive
+#endif
+// --8<-- [end:binary_kernels]
+
+
+// --8<-- [start:filter_kernels]
+/**
+ * Threshold filter: the first stage of large-k selection.
+ *
+ * Most distances in a block are worse than the current k-th best, so
+ * comparing a whole vector of them at once and only touching the
+ * survivors beats pushing every candidate into a heap. The scalar
+ * version is branch-free (always store, conditionally advance).
+ */
+static size_t filter_below_naive(const float* dists, size_t n,
+                                 float threshold, uint32_t* out) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        out[count] = static_cast<uint32_t>(i);
+        count += dists[i] < threshold;
+    }
+    return count;
+}
+
+#ifdef VDB_X86
+VDB_TARGET("avx2")
+static size_t filter_below_avx2(const float* dists, size_t n,
+                                float threshold, uint32_t* out) {
+    __m256 t = _mm256_set1_ps(threshold);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(
+            _mm256_cmp_ps(_mm256_loadu_ps(dists + i), t, _CMP_LT_OQ)));
+        while (mask) {
+            out[count++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    for (; i < n; ++i) {
+        out[count] = static_cast<uint32_t>(i);
+        count += dists[i] < threshold;
+    }
+    return count;
+}
+
+VDB_TARGET("avx512f")
+static size_t filter_below_avx512(const float* dists, size_t n,
+                                  float threshold, uint32_t* out) {
+    // vcompress packs the surviving lane indices contiguously.
+    __m512 t = _mm512_set1_ps(threshold);
+    __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+                                     12, 13, 14, 15);
+    size_t count = 0;
+    for (size_t i = 0; i < n; i += 16) {
+        __mmask16 valid = (n - i >= 16)
+                              ? static_cast<__mmask16>(0xFFFF)
+                              : static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 v = _mm512_maskz_loadu_ps(valid, dists + i);
+        __mmask16 m = _mm512_mask_cmp_ps_mask(valid, v, t, _CMP_LT_OQ);
+        __m512i idx = _mm512_add_epi32(
+            lane, _mm512_set1_epi32(static_cast<int>(i)));
+        _mm512_mask_compressstoreu_epi32(out + count, m, idx);
+        count += static_cast<size_t>(__builtin_popcount(m));
+    }
+    return count;
+}
+#endif
+// --8<-- [end:filter_kernels]
+
+
+// --8<-- [start:runtime_dispatch]
+/**
+ * Runtime kernel dispatch.
+ *
+ * Each tier is a table of function pointers. The CPU is probed once
+ * (cpuid + xgetbv via __builtin_cpu_supports, which also checks that
+ * the OS saves the wide registers) and every index caches the
+ * pointers it needs at construction time.
+ */
+static const DistanceKernels kScalarKernels = {
+    SimdLevel::Scalar, l2_distance_naive, inner_product_naive,
+    cosine_similarity_naive, l2_distance_batch_naive,
+    inner_product_batch_naive, dot_u8s8_naive, dot_u4s8_naive,
+    hamming_naive, jaccard_naive, filter_below_naive,
+    l2_sq_bounded_naive};
+
+#ifdef VDB_X86
+static const DistanceKernels kSSE4Kernels = {
+    SimdLevel::SSE4, l2_distance_sse4, inner_product_sse4,
+    cosine_similarity_sse4, l2_distance_batch_sse4,
+    inner_product_batch_sse4, dot_u8s8_sse4, dot_u4s8_sse4,
+    hamming_popcnt, jaccard_popcnt, filter_below_naive,
+    l2_sq_bounded_sse4};
+
+static const DistanceKernels kAVX2Kernels = {
+    SimdLevel::AVX2, l2_distance_avx2, inner_product_avx2,
+    cosine_similarity_avx2, l2_distance_batch_avx2,
+    inner_product_batch_avx2, dot_u8s8_avx2, dot_u4s8_avx2,
+    hamming_popcnt, jaccard_popcnt, filter_below_avx2,
+    l2_sq_bounded_avx2};
+
+/**
+ * AVX-512 is a family: VNNI and VPOPCNTDQ are optional extensions,
+ * so the integer and binary slots are filled per host.
+ */
+static DistanceKernels make_avx512_kernels() {
+    DistanceKernels k = {
+        SimdLevel::AVX512, l2_distance_avx512, inner_product_avx512,
+        cosine_similarity_avx512, l2_distance_batch_avx512,
+        inner_product_batch_avx512, dot_u8s8_avx2, dot_u4s8_avx2,
+        hamming_popcnt, jaccard_popcnt, filter_below_avx512,
+        l2_sq_bounded_avx512};
+    if (__builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vnni")) {
+        k.dot_u8s8 = dot_u8s8_vnni;
+        k.dot_u4s8 = dot_u4s8_vnni;
+    }
+#ifdef __x86_64__
+    if (__builtin_cpu_supports("avx512vpopcntdq")) {
+        k.hamming = hamming_vpopcntdq;
+        k.jaccard = jaccard_vpopcntdq;
+    }
+#endif
+    return k;
+}
+#endif
+
+/** What the hardware can execute, ignoring any override. */
+static SimdLevel cpu_simd_level() {
+    static const SimdLevel level = [] {
+#ifdef VDB_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+            return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return SimdLevel::AVX2;
+        // x86-64-v2: SSE4.x always shipped together with popcnt.
+        if (__builtin_cpu_supports("sse4.1") &&
+            __builtin_cpu_supports("popcnt"))
+            return SimdLevel::SSE4;
+#endif
+        return SimdLevel::Scalar;
+    }();
+    return level;
+}
+
+SimdLevel detect_simd_level() {
+    static const SimdLevel level = [] {
+        SimdLevel hw = cpu_simd_level();
+        const char* env = std::getenv("VECTORDB_SIMD");
+        if (env == nullptr)
+            return hw;
+        SimdLevel requested = hw;
+        if (std::strcmp(env, "scalar") == 0)
+            requested = SimdLevel::Scalar;
+        else if (std::strcmp(env, "sse4") == 0)
+            requested = SimdLevel::SSE4;
+        else if (std::strcmp(env, "avx2") == 0)
+            requested = SimdLevel::AVX2;
+        else if (std::strcmp(env, "avx512") == 0)
+            requested = SimdLevel::AVX512;
+        // The override may only lower the level, never exceed the CPU.
+        return std::min(requested, hw);
+    }();
+    return level;
+}
+
+const DistanceKernels& distance_kernels(SimdLevel level) {
+    level = std::min(level, cpu_simd_level());
+#ifdef VDB_X86
+    switch (level) {
+    case SimdLevel::AVX512: {
+        static const DistanceKernels kAVX512Kernels = make_avx512_kernels();
+        return kAVX512Kernels;
+    }
+    case SimdLevel::AVX2:
+        return kAVX2Kernels;
+    case SimdLevel::SSE4:
+        return kSSE4Kernels;
+    case SimdLevel::Scalar:
+        break;
+    }
+#endif
+    return kScalarKernels;
+}
+
+const DistanceKernels& distance_kernels() {
+    static const DistanceKernels& kernels =
+        distance_kernels(detect_simd_level());
+    return kernels;
+}
+
+const char* simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX512:
+        return "avx512";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::SSE4:
+        return "sse4";
+    case SimdLevel::Scalar:
+        break;
+    }
+    return "scalar";
+}
+// --8<-- [end:runtime_dispatch]
+
+
+void compute_norms_sq(const float* base, size_t n, size_t d, float* out) {
+    DistanceFn ip = distance_kernels_for_dim(d).inner_product;
+    for (size_t i = 0; i < n; ++i) {
+        const float* x = base + i * d;
+        out[i] = ip(x, x, d);
+    }
+}
+
+void l2_sq_batch(const float* query, const float* base, size_t n, size_t d,
+                 float* out, const float* base_norms) {
+    const DistanceKernels& k = distance_kernels_for_dim(d);
+    if (base_norms == nullptr) {
+        k.l2_sq_batch(query, base, n, d, out);
+        return;
+    }
+    // ‖q − x‖² = ‖q‖² − 2 q·x + ‖x‖². Rounding can push near-duplicates
+    // slightly below zero, so clamp.
+    float q_norm = k.inner_product(query, query, d);
+    k.inner_product_batch(query, base, n, d, out);
+    for (size_t i = 0; i < n; ++i)
+        out[i] = std::max(0.0f, q_norm - 2.0f * out[i] + base_norms[i]);
+}
+
+void inner_product_batch(const float* query, const float* base, size_t n,
+                         size_t d, float* out) {
+    distance_kernels_for_dim(d).inner_product_batch(query, base, n, d, out);
+}
+
+
+float normalize_l2(float* x, size_t d) {
+    float norm = std::sqrt(distance_kernels().inner_product(x, x, d));
+    if (norm > 0.0f) {
+        float inv = 1.0f / norm;
+        for (size_t i = 0; i < d; ++i) {
+            x[i] *= inv;
+        }
+    }
+    return norm;
+}
+
+
+/** Selector output (ascending) as the public result type. */
+static std::vector<SearchResult> to_search_results(
+    const std::vector<TopKSelector::Entry>& entries) {
+    std::vector<SearchResult> results;
+    results.reserve(entries.size());
+    for (const auto& e : entries) {
+        results.push_back({e.id, e.distance});
+    }
+    return results;
+}
+
+
 // --8<-- [start:brute_force_knn]
 /**
  * Brute-force k-NN search — the baseline that all ANN
  * algorithms are compared against.
  *
+ * Rows are scored in blocks with the one-query-vs-many kernel,
+ * so the query stays in registers across four rows at a time.
+ *
  * Returns indices of k nearest vectors to query.
  */
-struct SearchResult {
-    size_t index;
-    float distance;
-    bool operator<(const SearchResult& other) const {
-        return distance < other.distance;
-    }
-};
-
 std::vector<SearchResult> brute_force_knn(
     const float* query,
     const float* database,  // row-major: n × d
     size_t n,
     size_t d,
+    size_t k,
+    const float* base_norms  // optional ‖x_i‖², enables ‖q‖²−2q·x+‖x‖²
+) {
+    constexpr size_t kBlock = 256;
+    float dists[kBlock];
+
+    // O(k) state: each block is filtered against the running k-th
+    // best and only the survivors reach the selector.
+    TopKSelector topk(std::min(k, n));
+    for (size_t start = 0; start < n; start += kBlock) {
+        size_t len = std::min(kBlock, n - start);
+        l2_sq_batch(query, database + start * d, len, d, dists,
+                    base_norms ? base_norms + start : nullptr);
+        topk.push_block(dists, len, start);
+    }
+    return to_search_results(topk.take_sorted());
+}
+
+/**
+ * Cosine k-NN over unit-norm rows: normalize the query once, then
+ * rank by 1 − q·x with the batched inner-product kernel and a
+ * bounded heap.
+ */
+std::vector<SearchResult> brute_force_knn_cosine(
+    const float* query,
+    const float* database,  // row-major: n × d, unit-norm rows
+    size_t n,
+    size_t d,
     size_t k
 ) {
-    std::vector<SearchResult> results(n);
+    constexpr size_t kBlock = 256;
+    float dots[kBlock];
+
+    std::vector<float> q(query, query + d);
+    normalize_l2(q.data(), d);
+
+    TopKSelector topk(std::min(k, n));
+    for (size_t start = 0; start < n; start += kBlock) {
+        size_t len = std::min(kBlock, n - start);
+        inner_product_batch(q.data(), database + start * d, len, d, dots);
+        for (size_t j = 0; j < len; ++j) {
+            dots[j] = 1.0f - dots[j];
+        }
+        topk.push_block(dots, len, start);
+    }
+    return to_search_results(topk.take_sorted());
+}
+// --8<-- [end:brute_force_knn]
+
+
+// --8<-- [start:half_precision]
+/**
+ * Half-precision storage.
+ *
+ * The software conversions define the exact rounding (nearest-even)
+ * and are used for encoding and on hosts without F16C; SIMD kernels
+ * widen 8 or 16 stored elements per load with vcvtph2ps (FP16) or a
+ * 16-bit shift (BF16, which is just the top half of a float32).
+ */
+uint16_t float_to_fp16(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t exp = (x >> 23) & 0xFFu;
+    uint32_t mant = x & 0x7FFFFFu;
+
+    if (exp == 0xFF)  // Inf / NaN (keep NaN quiet)
+        return static_cast<uint16_t>(sign | 0x7C00u | (mant ? 0x200u : 0));
+
+    int e = static_cast<int>(exp) - 127 + 15;
+    if (e >= 31)  // overflow → Inf
+        return static_cast<uint16_t>(sign | 0x7C00u);
+
+    if (e <= 0) {  // subnormal half (or underflow to zero)
+        if (e < -10)
+            return static_cast<uint16_t>(sign);
+        mant |= 0x800000u;
+        uint32_t shift = static_cast<uint32_t>(14 - e);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half & 1)))
+            ++half;
+        return static_cast<uint16_t>(sign | half);
+    }
+
+    uint32_t half = sign | (static_cast<uint32_t>(e) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1FFFu;
+    // A carry out of the mantissa correctly bumps the exponent.
+    if (rem > 0x1000u || (rem == 0x1000u && (half & 1)))
+        ++half;
+    return static_cast<uint16_t>(half);
+}
+
+float fp16_to_float(uint16_t h) {
+    uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+    uint32_t exp = (h >> 10) & 0x1Fu;
+    uint32_t mant = h & 0x3FFu;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {  // renormalize a subnormal
+            exp = 127 - 15 + 1;
+            while (!(mant & 0x400u)) {
+                mant <<= 1;
+                --exp;
+            }
+            x = sign | (exp << 23) | ((mant & 0x3FFu) << 13);
+        }
+    } else if (exp == 31) {
+        x = sign | 0x7F800000u | (mant << 13);
+    } else {
+        x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+uint16_t float_to_bf16(float f) {
+    uint32_t x;
+    std::memcpy(&x, &f, sizeof(x));
+    if ((x & 0x7FFFFFFFu) > 0x7F800000u)  // NaN: truncate, keep it quiet
+        return static_cast<uint16_t>((x >> 16) | 0x40u);
+    x += 0x7FFFu + ((x >> 16) & 1u);
+    return static_cast<uint16_t>(x >> 16);
+}
+
+float bf16_to_float(uint16_t h) {
+    uint32_t x = static_cast<uint32_t>(h) << 16;
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+size_t scalar_type_size(ScalarType type) {
+    return type == ScalarType::FP32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+namespace {
+
+template <float (*Convert)(uint16_t)>
+float l2_half_naive(const float* q, const void* row, size_t d) {
+    const uint16_t* x = static_cast<const uint16_t*>(row);
+    float sum = 0.0f;
+    for (size_t i = 0; i < d; ++i) {
+        float diff = q[i] - Convert(x[i]);
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+template <float (*Convert)(uint16_t)>
+float ip_half_naive(const float* q, const void* row, size_t d) {
+    const uint16_t* x = static_cast<const uint16_t*>(row);
+    float sum = 0.0f;
+    for (size_t i = 0; i < d; ++i)
+        sum += q[i] * Convert(x[i]);
+    return sum;
+}
+
+template <uint16_t (*Convert)(float)>
+void encode_half(const float* src, void* dst, size_t d) {
+    uint16_t* out = static_cast<uint16_t*>(dst);
+    for (size_t i = 0; i < d; ++i)
+        out[i] = Convert(src[i]);
+}
+
+template <float (*Convert)(uint16_t)>
+void decode_half(const void* src, float* dst, size_t d) {
+    const uint16_t* in = static_cast<const uint16_t*>(src);
+    for (size_t i = 0; i < d; ++i)
+        dst[i] = Convert(in[i]);
+}
+
+void encode_fp32(const float* src, void* dst, size_t d) {
+    std::memcpy(dst, src, d * sizeof(float));
+}
+
+void decode_fp32(const void* src, float* dst, size_t d) {
+    std::memcpy(dst, src, d * sizeof(float));
+}
+
+/** Adapt a float32 kernel to the stored-row signature. */
+template <DistanceFn F>
+float fp32_stored(const float* q, const void* row, size_t d) {
+    return F(q, static_cast<const float*>(row), d);
+}
+
+template <BoundedDistanceFn F>
+float fp32_stored_bounded(const float* q, const void* row, size_t d,
+                          float bound) {
+    return F(q, static_cast<const float*>(row), d, bound);
+}
+
+/**
+ * Half-precision rows are already half the bytes; they are scored in
+ * full and the bound is ignored (still a valid bounded result).
+ */
+template <StoredDistanceFn F>
+float ignore_bound(const float* q, const void* row, size_t d, float) {
+    return F(q, row, d);
+}
+
+// --8<-- [start:gather_kernels]
+/**
+ * Rows ahead of the one being scored whose cache lines are requested.
+ * A graph neighbor is a random DRAM access (~100 ns); a few rows of
+ * arithmetic in between is enough to hide most of it.
+ */
+constexpr size_t kGatherPrefetch = 4;
+
+/** Ask for every cache line of a row (read, keep in all levels). */
+inline void prefetch_row(const uint8_t* row, size_t bytes) {
+    for (size_t off = 0; off < bytes; off += 64)
+        __builtin_prefetch(row + off, 0, 3);
+}
+
+/**
+ * Score the rows base + ids[i]·stride, prefetching row i + P while
+ * row i is computed. Bytes is the element size; only the vector part
+ * of a row is prefetched, so the stride may cover other per-node data.
+ */
+template <StoredBoundedFn F, size_t Bytes>
+void l2_gather(const float* q, const void* base, size_t stride,
+               const uint32_t* ids, size_t n, size_t d, float bound,
+               float* out) {
+    const uint8_t* b = static_cast<const uint8_t*>(base);
+    for (size_t i = 0; i < std::min(n, kGatherPrefetch); ++i)
+        prefetch_row(b + ids[i] * stride, d * Bytes);
     for (size_t i = 0; i < n; ++i) {
-        results[i] = {i, l2_distance_naive(query, database + i * d, d)};
+        if (i + kGatherPrefetch < n)
+            prefetch_row(b + ids[i + kGatherPrefetch] * stride, d * Bytes);
+        out[i] = F(q, b + ids[i] * stride, d, bound);
     }
+}
 
-    // Partial sort for top-k
-    std::partial_sort(
-        results.begin(),
-        results.begin() + std::min(k, n),
-        results.end()
-    );
+template <StoredDistanceFn F, size_t Bytes>
+void ip_gather(const float* q, const void* base, size_t stride,
+               const uint32_t* ids, size_t n, size_t d, float* out) {
+    const uint8_t* b = static_cast<const uint8_t*>(base);
+    for (size_t i = 0; i < std::min(n, kGatherPrefetch); ++i)
+        prefetch_row(b + ids[i] * stride, d * Bytes);
+    for (size_t i = 0; i < n; ++i) {
+        if (i + kGatherPrefetch < n)
+            prefetch_row(b + ids[i + kGatherPrefetch] * stride, d * Bytes);
+        out[i] = F(q, b + ids[i] * stride, d);
+    }
+}
 
-    results.resize(std::min(k, n));
-    return results;
+/** One storage table entry; the gather slots wrap the row kernels. */
+template <StoredDistanceFn L2, StoredDistanceFn IP, StoredBoundedFn L2B,
+          size_t Bytes>
+StorageKernels make_storage(ScalarType type,
+                            void (*encode)(const float*, void*, size_t),
+                            void (*decode)(const void*, float*, size_t)) {
+    return {type, L2, IP, encode, decode, L2B,
+            l2_gather<L2B, Bytes>, ip_gather<IP, Bytes>};
 }
-// --8<-- [end:brute_force_knn]
+
+template <DistanceFn L2, DistanceFn IP, BoundedDistanceFn L2B>
+StorageKernels make_fp32_storage() {
+    return make_storage<fp32_stored<L2>, fp32_stored<IP>,
+                        fp32_stored_bounded<L2B>, sizeof(float)>(
+        ScalarType::FP32, encode_fp32, decode_fp32);
+}
+
+template <StoredDistanceFn L2, StoredDistanceFn IP, uint16_t (*Enc)(float),
+          float (*Dec)(uint16_t)>
+StorageKernels make_half_storage(ScalarType type) {
+    return make_storage<L2, IP, ignore_bound<L2>, sizeof(uint16_t)>(
+        type, encode_half<Enc>, decode_half<Dec>);
+}
+// --8<-- [end:gather_kernels]
+
+#ifdef VDB_X86
+// Widen 8 stored elements to float32.
+VDB_TARGET("avx2,fma,f16c")
+inline __m256 load8_fp16(const uint16_t* p) {
+    return _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+VDB_TARGET("avx2,fma")
+inline __m256 load8_bf16(const uint16_t* p) {
+    __m256i wide = _mm256_cvtepu16_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+}
+
+// Widen 16 stored elements to float32 (masked for the tail).
+VDB_TARGET("avx512f,avx512bw,avx512vl")
+inline __m512 load16_fp16(const uint16_t* p, __mmask16 m) {
+    return _mm512_cvtph_ps(_mm256_maskz_loadu_epi16(m, p));
+}
+
+VDB_TARGET("avx512f,avx512bw,avx512vl")
+inline __m512 load16_bf16(const uint16_t* p, __mmask16 m) {
+    __m512i wide = _mm512_cvtepu16_epi32(_mm256_maskz_loadu_epi16(m, p));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(wide, 16));
+}
+
+#define VDB_HALF_AVX2_KERNELS(NAME, LOAD, CONVERT, ISA)                     \
+    VDB_TARGET(ISA)                                                        \
+    float l2_##NAME##_avx2(const float* q, const void* row, size_t d) {    \
+        const uint16_t* x = static_cast<const uint16_t*>(row);             \
+        __m256 sum = _mm256_setzero_ps();                                  \
+        size_t i = 0;                                                      \
+        for (; i + 8 <= d; i += 8) {                                       \
+            __m256 diff = _mm256_sub_ps(_mm256_loadu_ps(q + i), LOAD(x + i)); \
+            sum = _mm256_fmadd_ps(diff, diff, sum);                        \
+        }                                                                  \
+        float result = hsum256(sum);                                       \
+        for (; i < d; ++i) {                                               \
+            float diff = q[i] - CONVERT(x[i]);                             \
+            result += diff * diff;                                         \
+        }                                                                  \
+        return result;                                                     \
+    }                                                                      \
+    VDB_TARGET(ISA)                                                        \
+    float ip_##NAME##_avx2(const float* q, const void* row, size_t d) {    \
+        const uint16_t* x = static_cast<const uint16_t*>(row);             \
+        __m256 sum = _mm256_setzero_ps();                                  \
+        size_t i = 0;                                                      \
+        for (; i + 8 <= d; i += 8)                                         \
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(q + i), LOAD(x + i), sum); \
+        float result = hsum256(sum);                                       \
+        for (; i < d; ++i)                                                 \
+            result += q[i] * CONVERT(x[i]);                                \
+        return result;                                                     \
+    }
+
+#define VDB_HALF_AVX512_KERNELS(NAME, LOAD, ISA)                            \
+    VDB_TARGET(ISA)                                                        \
+    float l2_##NAME##_avx512(const float* q, const void* row, size_t d) {  \
+        const uint16_t* x = static_cast<const uint16_t*>(row);             \
+        __m512 sum = _mm512_setzero_ps();                                  \
+        for (size_t i = 0; i < d; i += 16) {                               \
+            __mmask16 m = (d - i >= 16)                                    \
+                ? static_cast<__mmask16>(0xFFFF)                           \
+                : static_cast<__mmask16>((1u << (d - i)) - 1);             \
+            __m512 diff = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, q + i),   \
+                                        LOAD(x + i, m));                   \
+            sum = _mm512_fmadd_ps(diff, diff, sum);                        \
+        }                                                                  \
+        return _mm512_reduce_add_ps(sum);                                  \
+    }                                                                      \
+    VDB_TARGET(ISA)                                                        \
+    float ip_##NAME##_avx512(const float* q, const void* row, size_t d) {  \
+        const uint16_t* x = static_cast<const uint16_t*>(row);             \
+        __m512 sum = _mm512_setzero_ps();                                  \
+        for (size_t i = 0; i < d; i += 16) {                               \
+            __mmask16 m = (d - i >= 16)                                    \
+                ? static_cast<__mmask16>(0xFFFF)                           \
+                : static_cast<__mmask16>((1u << (d - i)) - 1);             \
+            sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, q + i),         \
+                                  LOAD(x + i, m), sum);                    \
+        }                                                                  \
+        return _mm512_reduce_add_ps(sum);                                  \
+    }
+
+VDB_HALF_AVX2_KERNELS(fp16, load8_fp16, fp16_to_float, "avx2,fma,f16c")
+VDB_HALF_AVX2_KERNELS(bf16, load8_bf16, bf16_to_float, "avx2,fma")
+VDB_HALF_AVX512_KERNELS(fp16, load16_fp16, "avx512f,avx512bw,avx512vl")
+VDB_HALF_AVX512_KERNELS(bf16, load16_bf16, "avx512f,avx512bw,avx512vl")
+
+#undef VDB_HALF_AVX2_KERNELS
+#undef VDB_HALF_AVX512_KERNELS
+#endif
+
+} // namespace
+
+const StorageKernels& storage_kernels(ScalarType type, SimdLevel level) {
+    static const StorageKernels kFP32[] = {
+        make_fp32_storage<l2_distance_naive, inner_product_naive,
+                          l2_sq_bounded_naive>(),
+#ifdef VDB_X86
+        make_fp32_storage<l2_distance_sse4, inner_product_sse4,
+                          l2_sq_bounded_sse4>(),
+        make_fp32_storage<l2_distance_avx2, inner_product_avx2,
+                          l2_sq_bounded_avx2>(),
+        make_fp32_storage<l2_distance_avx512, inner_product_avx512,
+                          l2_sq_bounded_avx512>(),
+#endif
+    };
+    static const StorageKernels kFP16Naive =
+        make_half_storage<l2_half_naive<fp16_to_float>,
+                          ip_half_naive<fp16_to_float>, float_to_fp16,
+                          fp16_to_float>(ScalarType::FP16);
+    static const StorageKernels kBF16Naive =
+        make_half_storage<l2_half_naive<bf16_to_float>,
+                          ip_half_naive<bf16_to_float>, float_to_bf16,
+                          bf16_to_float>(ScalarType::BF16);
+
+    level = std::min(level, cpu_simd_level());
+    if (type == ScalarType::FP32)
+        return kFP32[static_cast<int>(level)];
+
+#ifdef VDB_X86
+    static const StorageKernels kFP16AVX2 =
+        make_half_storage<l2_fp16_avx2, ip_fp16_avx2, float_to_fp16,
+                          fp16_to_float>(ScalarType::FP16);
+    static const StorageKernels kBF16AVX2 =
+        make_half_storage<l2_bf16_avx2, ip_bf16_avx2, float_to_bf16,
+                          bf16_to_float>(ScalarType::BF16);
+    static const StorageKernels kFP16AVX512 =
+        make_half_storage<l2_fp16_avx512, ip_fp16_avx512, float_to_fp16,
+                          fp16_to_float>(ScalarType::FP16);
+    static const StorageKernels kBF16AVX512 =
+        make_half_storage<l2_bf16_avx512, ip_bf16_avx512, float_to_bf16,
+                          bf16_to_float>(ScalarType::BF16);
+
+    // The AVX-512 kernels need BW/VL for 16-bit masked loads; every
+    // AVX-512 server part has them, but check rather than assume.
+    static const bool has_bw_vl = __builtin_cpu_supports("avx512bw") &&
+                                  __builtin_cpu_supports("avx512vl");
+    static const bool has_f16c = __builtin_cpu_supports("f16c");
+
+    if (type == ScalarType::FP16) {
+        if (level == SimdLevel::AVX512 && has_bw_vl)
+            return kFP16AVX512;
+        if (level >= SimdLevel::AVX2 && has_f16c)
+            return kFP16AVX2;
+        return kFP16Naive;
+    }
+    if (level == SimdLevel::AVX512 && has_bw_vl)
+        return kBF16AVX512;
+    if (level >= SimdLevel::AVX2)
+        return kBF16AVX2;
+#endif
+    return type == ScalarType::FP16 ? kFP16Naive : kBF16Naive;
+}
+
+const StorageKernels& storage_kernels(ScalarType type) {
+    return storage_kernels(type, detect_simd_level());
+}
+// --8<-- [end:half_precision]
+
+
+// --8<-- [start:fixed_dim_kernels]
+/**
+ * Dimension-specialized kernels.
+ *
+ * Embedding models come in a handful of fixed sizes, so the common
+ * dimensions get kernels with D as a compile-time constant: the trip
+ * count is known, the loop is unrolled with four independent
+ * accumulators, and there is no tail. Every supported D is a multiple
+ * of 128: two passes over four full AVX-512 registers, which is also
+ * the early-abandon block of the widest bounded kernel.
+ */
+#if defined(__clang__)
+#define VDB_UNROLL _Pragma("unroll")
+#elif defined(__GNUC__)
+#define VDB_UNROLL _Pragma("GCC unroll 64")
+#else
+#define VDB_UNROLL
+#endif
+
+template <size_t D>
+static float l2_fixed_naive(const float* x, const float* y, size_t) {
+    float s[8] = {};
+    for (size_t i = 0; i < D; i += 8) {
+        for (size_t u = 0; u < 8; ++u) {
+            float diff = x[i + u] - y[i + u];
+            s[u] += diff * diff;
+        }
+    }
+    return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+template <size_t D>
+static float ip_fixed_naive(const float* x, const float* y, size_t) {
+    float s[8] = {};
+    for (size_t i = 0; i < D; i += 8) {
+        for (size_t u = 0; u < 8; ++u) {
+            s[u] += x[i + u] * y[i + u];
+        }
+    }
+    return ((s[0] + s[1]) + (s[2] + s[3])) + ((s[4] + s[5]) + (s[6] + s[7]));
+}
+
+/**
+ * Early-abandon forms (see l2_sq_bounded): the partial sum is checked
+ * after each block of the unrolled loop, with the same block sizes as
+ * the generic bounded kernels.
+ */
+template <size_t D>
+static float l2_fixed_bounded_naive(const float* x, const float* y, size_t,
+                                    float bound) {
+    constexpr size_t kBlock = 32;
+    float s[8] = {};
+    float partial = 0.0f;
+    for (size_t b = 0; b < D; b += kBlock) {
+        for (size_t i = b; i < b + kBlock; i += 8) {
+            for (size_t u = 0; u < 8; ++u) {
+                float diff = x[i + u] - y[i + u];
+                s[u] += diff * diff;
+            }
+        }
+        partial = ((s[0] + s[1]) + (s[2] + s[3])) +
+                  ((s[4] + s[5]) + (s[6] + s[7]));
+        if (partial >= bound)
+            return partial;
+    }
+    return partial;
+}
+
+/** Batch adapter for tiers without a dedicated 4-row fixed kernel. */
+template <DistanceFn F>
+static void batch_by_row(const float* q, const float* base, size_t n,
+                         size_t d, float* out) {
+    for (size_t r = 0; r < n; ++r) {
+        out[r] = F(q, base + r * d, d);
+    }
+}
+
+#ifdef VDB_X86
+template <size_t D>
+VDB_TARGET("sse4.1")
+static float l2_fixed_sse4(const float* x, const float* y, size_t) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 16) {
+        __m128 d0 = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+        __m128 d1 = _mm_sub_ps(_mm_loadu_ps(x + i + 4),
+                               _mm_loadu_ps(y + i + 4));
+        __m128 d2 = _mm_sub_ps(_mm_loadu_ps(x + i + 8),
+                               _mm_loadu_ps(y + i + 8));
+        __m128 d3 = _mm_sub_ps(_mm_loadu_ps(x + i + 12),
+                               _mm_loadu_ps(y + i + 12));
+        s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(d2, d2));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(d3, d3));
+    }
+    return hsum128(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+}
+
+template <size_t D>
+VDB_TARGET("sse4.1")
+static float l2_fixed_bounded_sse4(const float* x, const float* y, size_t,
+                                   float bound) {
+    constexpr size_t kBlock = 32;
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    float partial = 0.0f;
+    for (size_t b = 0; b < D; b += kBlock) {
+        VDB_UNROLL
+        for (size_t i = b; i < b + kBlock; i += 16) {
+            __m128 d0 = _mm_sub_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(y + i));
+            __m128 d1 = _mm_sub_ps(_mm_loadu_ps(x + i + 4),
+                                   _mm_loadu_ps(y + i + 4));
+            __m128 d2 = _mm_sub_ps(_mm_loadu_ps(x + i + 8),
+                                   _mm_loadu_ps(y + i + 8));
+            __m128 d3 = _mm_sub_ps(_mm_loadu_ps(x + i + 12),
+                                   _mm_loadu_ps(y + i + 12));
+            s0 = _mm_add_ps(s0, _mm_mul_ps(d0, d0));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(d1, d1));
+            s2 = _mm_add_ps(s2, _mm_mul_ps(d2, d2));
+            s3 = _mm_add_ps(s3, _mm_mul_ps(d3, d3));
+        }
+        partial = hsum128(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+        if (partial >= bound)
+            return partial;
+    }
+    return partial;
+}
+
+template <size_t D>
+VDB_TARGET("sse4.1")
+static float ip_fixed_sse4(const float* x, const float* y, size_t) {
+    __m128 s0 = _mm_setzero_ps(), s1 = _mm_setzero_ps();
+    __m128 s2 = _mm_setzero_ps(), s3 = _mm_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 16) {
+        s0 = _mm_add_ps(s0, _mm_mul_ps(_mm_loadu_ps(x + i),
+                                       _mm_loadu_ps(y + i)));
+        s1 = _mm_add_ps(s1, _mm_mul_ps(_mm_loadu_ps(x + i + 4),
+                                       _mm_loadu_ps(y + i + 4)));
+        s2 = _mm_add_ps(s2, _mm_mul_ps(_mm_loadu_ps(x + i + 8),
+                                       _mm_loadu_ps(y + i + 8)));
+        s3 = _mm_add_ps(s3, _mm_mul_ps(_mm_loadu_ps(x + i + 12),
+                                       _mm_loadu_ps(y + i + 12)));
+    }
+    return hsum128(_mm_add_ps(_mm_add_ps(s0, s1), _mm_add_ps(s2, s3)));
+}
+
+template <size_t D>
+VDB_TARGET("avx2,fma")
+static float l2_fixed_avx2(const float* x, const float* y, size_t) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 32) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i),
+                                  _mm256_loadu_ps(y + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8),
+                                  _mm256_loadu_ps(y + i + 8));
+        __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 16),
+                                  _mm256_loadu_ps(y + i + 16));
+        __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 24),
+                                  _mm256_loadu_ps(y + i + 24));
+        s0 = _mm256_fmadd_ps(d0, d0, s0);
+        s1 = _mm256_fmadd_ps(d1, d1, s1);
+        s2 = _mm256_fmadd_ps(d2, d2, s2);
+        s3 = _mm256_fmadd_ps(d3, d3, s3);
+    }
+    return hsum256(
+        _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+}
+
+template <size_t D>
+VDB_TARGET("avx2,fma")
+static float l2_fixed_bounded_avx2(const float* x, const float* y, size_t,
+                                   float bound) {
+    constexpr size_t kBlock = 64;
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    float partial = 0.0f;
+    for (size_t b = 0; b < D; b += kBlock) {
+        VDB_UNROLL
+        for (size_t i = b; i < b + kBlock; i += 32) {
+            __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i),
+                                      _mm256_loadu_ps(y + i));
+            __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8),
+                                      _mm256_loadu_ps(y + i + 8));
+            __m256 d2 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 16),
+                                      _mm256_loadu_ps(y + i + 16));
+            __m256 d3 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 24),
+                                      _mm256_loadu_ps(y + i + 24));
+            s0 = _mm256_fmadd_ps(d0, d0, s0);
+            s1 = _mm256_fmadd_ps(d1, d1, s1);
+            s2 = _mm256_fmadd_ps(d2, d2, s2);
+            s3 = _mm256_fmadd_ps(d3, d3, s3);
+        }
+        partial = hsum256(
+            _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+        if (partial >= bound)
+            return partial;
+    }
+    return partial;
+}
+
+template <size_t D>
+VDB_TARGET("avx2,fma")
+static float ip_fixed_avx2(const float* x, const float* y, size_t) {
+    __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+    __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 32) {
+        s0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i),
+                             s0);
+        s1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 8),
+                             _mm256_loadu_ps(y + i + 8), s1);
+        s2 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 16),
+                             _mm256_loadu_ps(y + i + 16), s2);
+        s3 = _mm256_fmadd_ps(_mm256_loadu_ps(x + i + 24),
+                             _mm256_loadu_ps(y + i + 24), s3);
+    }
+    return hsum256(
+        _mm256_add_ps(_mm256_add_ps(s0, s1), _mm256_add_ps(s2, s3)));
+}
+
+/** Four rows in lock-step, as in the generic batch kernels. */
+template <size_t D, bool L2>
+VDB_TARGET("avx2,fma")
+static void batch_fixed_avx2(const float* q, const float* base, size_t n,
+                             size_t, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * D;
+        __m256 s0 = _mm256_setzero_ps(), s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps(), s3 = _mm256_setzero_ps();
+        VDB_UNROLL
+        for (size_t i = 0; i < D; i += 8) {
+            __m256 vq = _mm256_loadu_ps(q + i);
+            __m256 x0 = _mm256_loadu_ps(x + i);
+            __m256 x1 = _mm256_loadu_ps(x + D + i);
+            __m256 x2 = _mm256_loadu_ps(x + 2 * D + i);
+            __m256 x3 = _mm256_loadu_ps(x + 3 * D + i);
+            if (L2) {
+                x0 = _mm256_sub_ps(vq, x0);
+                x1 = _mm256_sub_ps(vq, x1);
+                x2 = _mm256_sub_ps(vq, x2);
+                x3 = _mm256_sub_ps(vq, x3);
+                s0 = _mm256_fmadd_ps(x0, x0, s0);
+                s1 = _mm256_fmadd_ps(x1, x1, s1);
+                s2 = _mm256_fmadd_ps(x2, x2, s2);
+                s3 = _mm256_fmadd_ps(x3, x3, s3);
+            } else {
+                s0 = _mm256_fmadd_ps(vq, x0, s0);
+                s1 = _mm256_fmadd_ps(vq, x1, s1);
+                s2 = _mm256_fmadd_ps(vq, x2, s2);
+                s3 = _mm256_fmadd_ps(vq, x3, s3);
+            }
+        }
+        out[r] = hsum256(s0);
+        out[r + 1] = hsum256(s1);
+        out[r + 2] = hsum256(s2);
+        out[r + 3] = hsum256(s3);
+    }
+    for (; r < n; ++r) {
+        out[r] = L2 ? l2_fixed_avx2<D>(q, base + r * D, D)
+                    : ip_fixed_avx2<D>(q, base + r * D, D);
+    }
+}
+
+template <size_t D>
+VDB_TARGET("avx512f")
+static float l2_fixed_avx512(const float* x, const float* y, size_t) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 64) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(x + i),
+                                  _mm512_loadu_ps(y + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16),
+                                  _mm512_loadu_ps(y + i + 16));
+        __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 32),
+                                  _mm512_loadu_ps(y + i + 32));
+        __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 48),
+                                  _mm512_loadu_ps(y + i + 48));
+        s0 = _mm512_fmadd_ps(d0, d0, s0);
+        s1 = _mm512_fmadd_ps(d1, d1, s1);
+        s2 = _mm512_fmadd_ps(d2, d2, s2);
+        s3 = _mm512_fmadd_ps(d3, d3, s3);
+    }
+    return _mm512_reduce_add_ps(
+        _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+template <size_t D>
+VDB_TARGET("avx512f")
+static float l2_fixed_bounded_avx512(const float* x, const float* y, size_t,
+                                     float bound) {
+    constexpr size_t kBlock = 128;
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    float partial = 0.0f;
+    for (size_t b = 0; b < D; b += kBlock) {
+        VDB_UNROLL
+        for (size_t i = b; i < b + kBlock; i += 64) {
+            __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(x + i),
+                                      _mm512_loadu_ps(y + i));
+            __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 16),
+                                      _mm512_loadu_ps(y + i + 16));
+            __m512 d2 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 32),
+                                      _mm512_loadu_ps(y + i + 32));
+            __m512 d3 = _mm512_sub_ps(_mm512_loadu_ps(x + i + 48),
+                                      _mm512_loadu_ps(y + i + 48));
+            s0 = _mm512_fmadd_ps(d0, d0, s0);
+            s1 = _mm512_fmadd_ps(d1, d1, s1);
+            s2 = _mm512_fmadd_ps(d2, d2, s2);
+            s3 = _mm512_fmadd_ps(d3, d3, s3);
+        }
+        partial = _mm512_reduce_add_ps(
+            _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+        if (partial >= bound)
+            return partial;
+    }
+    return partial;
+}
+
+template <size_t D>
+VDB_TARGET("avx512f")
+static float ip_fixed_avx512(const float* x, const float* y, size_t) {
+    __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+    __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+    VDB_UNROLL
+    for (size_t i = 0; i < D; i += 64) {
+        s0 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i),
+                             s0);
+        s1 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 16),
+                             _mm512_loadu_ps(y + i + 16), s1);
+        s2 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 32),
+                             _mm512_loadu_ps(y + i + 32), s2);
+        s3 = _mm512_fmadd_ps(_mm512_loadu_ps(x + i + 48),
+                             _mm512_loadu_ps(y + i + 48), s3);
+    }
+    return _mm512_reduce_add_ps(
+        _mm512_add_ps(_mm512_add_ps(s0, s1), _mm512_add_ps(s2, s3)));
+}
+
+template <size_t D, bool L2>
+VDB_TARGET("avx512f")
+static void batch_fixed_avx512(const float* q, const float* base, size_t n,
+                               size_t, float* out) {
+    size_t r = 0;
+    for (; r + 4 <= n; r += 4) {
+        const float* x = base + r * D;
+        __m512 s0 = _mm512_setzero_ps(), s1 = _mm512_setzero_ps();
+        __m512 s2 = _mm512_setzero_ps(), s3 = _mm512_setzero_ps();
+        VDB_UNROLL
+        for (size_t i = 0; i < D; i += 16) {
+            __m512 vq = _mm512_loadu_ps(q + i);
+            __m512 x0 = _mm512_loadu_ps(x + i);
+            __m512 x1 = _mm512_loadu_ps(x + D + i);
+            __m512 x2 = _mm512_loadu_ps(x + 2 * D + i);
+            __m512 x3 = _mm512_loadu_ps(x + 3 * D + i);
+            if (L2) {
+                x0 = _mm512_sub_ps(vq, x0);
+                x1 = _mm512_sub_ps(vq, x1);
+                x2 = _mm512_sub_ps(vq, x2);
+                x3 = _mm512_sub_ps(vq, x3);
+                s0 = _mm512_fmadd_ps(x0, x0, s0);
+                s1 = _mm512_fmadd_ps(x1, x1, s1);
+                s2 = _mm512_fmadd_ps(x2, x2, s2);
+                s3 = _mm512_fmadd_ps(x3, x3, s3);
+            } else {
+                s0 = _mm512_fmadd_ps(vq, x0, s0);
+                s1 = _mm512_fmadd_ps(vq, x1, s1);
+                s2 = _mm512_fmadd_ps(vq, x2, s2);
+                s3 = _mm512_fmadd_ps(vq, x3, s3);
+            }
+        }
+        out[r] = _mm512_reduce_add_ps(s0);
+        out[r + 1] = _mm512_reduce_add_ps(s1);
+        out[r + 2] = _mm512_reduce_add_ps(s2);
+        out[r + 3] = _mm512_reduce_add_ps(s3);
+    }
+    for (; r < n; ++r) {
+        out[r] = L2 ? l2_fixed_avx512<D>(q, base + r * D, D)
+                    : ip_fixed_avx512<D>(q, base + r * D, D);
+    }
+}
+#endif
+
+/** Generic tables with the fp32 slots swapped for the D-specialized ones. */
+struct FixedDimKernels {
+    size_t dim;
+    DistanceKernels kernels[4];  // indexed by SimdLevel
+    StorageKernels storage[4];   // FP32 storage, indexed by SimdLevel
+};
+
+template <DistanceFn L2, DistanceFn IP, BatchDistanceFn L2B,
+          BatchDistanceFn IPB, BoundedDistanceFn L2Bound>
+static void set_fixed(DistanceKernels& k, StorageKernels& s) {
+    k.l2_sq = L2;
+    k.inner_product = IP;
+    k.l2_sq_batch = L2B;
+    k.inner_product_batch = IPB;
+    k.l2_sq_bounded = L2Bound;
+    s.l2_sq = fp32_stored<L2>;
+    s.inner_product = fp32_stored<IP>;
+    s.l2_sq_bounded = fp32_stored_bounded<L2Bound>;
+    s.l2_sq_gather =
+        l2_gather<fp32_stored_bounded<L2Bound>, sizeof(float)>;
+    s.inner_product_gather = ip_gather<fp32_stored<IP>, sizeof(float)>;
+}
+
+template <size_t D>
+static FixedDimKernels make_fixed_dim() {
+    static_assert(D % 128 == 0, "fixed kernels assume no tail");
+    FixedDimKernels t;
+    t.dim = D;
+    for (int l = 0; l < 4; ++l) {
+        DistanceKernels& k = t.kernels[l];
+        StorageKernels& s = t.storage[l];
+        // Levels above the host clamp down, so k.level is executable.
+        k = distance_kernels(static_cast<SimdLevel>(l));
+        s = storage_kernels(ScalarType::FP32, k.level);
+        switch (k.level) {
+        case SimdLevel::Scalar:
+            set_fixed<l2_fixed_naive<D>, ip_fixed_naive<D>,
+                      batch_by_row<l2_fixed_naive<D>>,
+                      batch_by_row<ip_fixed_naive<D>>,
+                      l2_fixed_bounded_naive<D>>(k, s);
+            break;
+#ifdef VDB_X86
+        case SimdLevel::SSE4:
+            set_fixed<l2_fixed_sse4<D>, ip_fixed_sse4<D>,
+                      batch_by_row<l2_fixed_sse4<D>>,
+                      batch_by_row<ip_fixed_sse4<D>>,
+                      l2_fixed_bounded_sse4<D>>(k, s);
+            break;
+        case SimdLevel::AVX2:
+            set_fixed<l2_fixed_avx2<D>, ip_fixed_avx2<D>,
+                      batch_fixed_avx2<D, true>,
+                      batch_fixed_avx2<D, false>,
+                      l2_fixed_bounded_avx2<D>>(k, s);
+            break;
+        case SimdLevel::AVX512:
+            set_fixed<l2_fixed_avx512<D>, ip_fixed_avx512<D>,
+                      batch_fixed_avx512<D, true>,
+                      batch_fixed_avx512<D, false>,
+                      l2_fixed_bounded_avx512<D>>(k, s);
+            break;
+#else
+        default:
+            break;
+#endif
+        }
+    }
+    return t;
+}
+
+/** The dispatch table keyed by dimension. */
+static const FixedDimKernels* find_fixed_dim(size_t d) {
+    static const FixedDimKernels kTables[] = {
+        make_fixed_dim<128>(), make_fixed_dim<384>(),
+        make_fixed_dim<768>(), make_fixed_dim<1024>(),
+        make_fixed_dim<1536>(),
+    };
+    for (const auto& t : kTables) {
+        if (t.dim == d)
+            return &t;
+    }
+    return nullptr;
+}
+
+const DistanceKernels& distance_kernels_for_dim(size_t d, SimdLevel level) {
+    const DistanceKernels& generic = distance_kernels(level);
+    const FixedDimKernels* t = find_fixed_dim(d);
+    return t ? t->kernels[static_cast<int>(generic.level)] : generic;
+}
+
+const DistanceKernels& distance_kernels_for_dim(size_t d) {
+    return distance_kernels_for_dim(d, detect_simd_level());
+}
+
+const StorageKernels& storage_kernels_for_dim(ScalarType type, size_t d) {
+    const StorageKernels& generic = storage_kernels(type);
+    const FixedDimKernels* t =
+        (type == ScalarType::FP32) ? find_fixed_dim(d) : nullptr;
+    return t ? t->storage[static_cast<int>(detect_simd_level())] : generic;
+}
+// --8<-- [end:fixed_dim_kernels]
+
+
+// --8<-- [start:brute_force_knn_batch]
+namespace {
+
+// Budget for one block of database rows. The block is scored against
+// every query of the current query tile while it is still hot in L2.
+constexpr size_t kL2BlockBytes = 256 * 1024;
+constexpr size_t kQueryTile = 32;
+
+/**
+ * Score queries [q_begin, q_end) against rows [r_begin, r_end),
+ * feeding heaps[q − q_begin].
+ */
+void knn_tile_range(const float* queries, size_t q_begin, size_t q_end,
+                    const float* database, size_t r_begin, size_t r_end,
+                    size_t d, const float* base_norms,
+                    TopKSelector* heaps) {
+    size_t rows_per_block =
+        std::max<size_t>(16, kL2BlockBytes / (d * sizeof(float)));
+    std::vector<float> dists(rows_per_block);
+
+    for (size_t qt = q_begin; qt < q_end; qt += kQueryTile) {
+        size_t qt_end = std::min(qt + kQueryTile, q_end);
+        for (size_t rb = r_begin; rb < r_end; rb += rows_per_block) {
+            size_t len = std::min(rows_per_block, r_end - rb);
+            const float* block = database + rb * d;
+            const float* norms = base_norms ? base_norms + rb : nullptr;
+            for (size_t q = qt; q < qt_end; ++q) {
+                l2_sq_batch(queries + q * d, block, len, d, dists.data(),
+                            norms);
+                heaps[q - q_begin].push_block(dists.data(), len, rb);
+            }
+        }
+    }
+}
+
+/** Run fn(thread_index) on num_threads threads, including the caller. */
+template <typename Fn>
+void run_parallel(size_t num_threads, Fn fn) {
+    std::vector<std::thread> workers;
+    workers.reserve(num_threads - 1);
+    for (size_t t = 1; t < num_threads; ++t)
+        workers.emplace_back(fn, t);
+    fn(0);
+    for (auto& w : workers)
+        w.join();
+}
+
+} // namespace
+
+std::vector<std::vector<SearchResult>> brute_force_knn_batch(
+    const float* queries, size_t nq, const float* database, size_t n,
+    size_t d, size_t k, const float* base_norms, size_t num_threads) {
+    std::vector<std::vector<SearchResult>> out(nq);
+    k = std::min(k, n);
+    if (nq == 0 || k == 0)
+        return out;
+
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector<TopKSelector> heaps(nq, TopKSelector(k));
+    size_t num_tiles = (nq + kQueryTile - 1) / kQueryTile;
+
+    if (num_tiles >= num_threads) {
+        // Enough queries: threads pull query tiles from a shared
+        // counter and each owns the heaps of the tiles it takes.
+        std::atomic<size_t> next_tile{0};
+        run_parallel(num_threads, [&](size_t) {
+            for (size_t t; (t = next_tile.fetch_add(1)) < num_tiles;) {
+                size_t q_begin = t * kQueryTile;
+                size_t q_end = std::min(q_begin + kQueryTile, nq);
+                knn_tile_range(queries, q_begin, q_end, database, 0, n, d,
+                               base_norms, &heaps[q_begin]);
+            }
+        });
+    } else {
+        // Few queries: split the database instead, keep per-thread
+        // heaps and merge them at the end.
+        num_threads = std::min(num_threads, n);
+        std::vector<std::vector<TopKSelector>> partial(
+            num_threads, std::vector<TopKSelector>(nq, TopKSelector(k)));
+        size_t rows_per_thread = (n + num_threads - 1) / num_threads;
+        run_parallel(num_threads, [&](size_t t) {
+            size_t r_begin = std::min(n, t * rows_per_thread);
+            size_t r_end = std::min(n, r_begin + rows_per_thread);
+            knn_tile_range(queries, 0, nq, database, r_begin, r_end, d,
+                           base_norms, partial[t].data());
+        });
+        for (auto& per_thread : partial)
+            for (size_t q = 0; q < nq; ++q)
+                heaps[q].merge(per_thread[q]);
+    }
+
+    for (size_t q = 0; q < nq; ++q)
+        out[q] = to_search_results(heaps[q].take_sorted());
+    return out;
+}
+// --8<-- [end:brute_force_knn_batch]
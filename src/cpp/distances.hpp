@@ -0,0 +1,290 @@
+/**
+ * Distance kernel library — public interface.
+ *
+ * The kernels themselves live in distances.cpp. Every index links
+ * against them instead of carrying its own scalar loop, so a faster
+ * kernel speeds up HNSW, IVF, PQ and LSH at once.
+ *
+ * Kernels are selected at runtime from the CPU features of the host
+ * (scalar → SSE4 → AVX2+FMA → AVX-512), so a single binary built
+ * without -march=native still runs the widest SIMD path available.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// --8<-- [start:distance_kernels]
+/**
+ * Instruction-set tiers, ordered from slowest to fastest.
+ */
+enum class SimdLevel { Scalar = 0, SSE4 = 1, AVX2 = 2, AVX512 = 3 };
+
+/** Signature shared by every float32 kernel: f(x, y, d). */
+using DistanceFn = float (*)(const float* x, const float* y, size_t d);
+
+/**
+ * One query against n contiguous rows (row-major, n × d):
+ * out[i] = f(query, base + i·d).
+ */
+using BatchDistanceFn = void (*)(const float* query, const float* base,
+                                 size_t n, size_t d, float* out);
+
+/**
+ * Integer dot product of unsigned 8-bit codes with signed 8-bit
+ * weights: Σ codes[i] · weights[i]. |weights| must stay ≤ 63 so the
+ * pairwise 16-bit sums of pmaddubsw cannot saturate.
+ */
+using DotU8S8Fn = int32_t (*)(const uint8_t* codes, const int8_t* weights,
+                              size_t d);
+
+/**
+ * Same for packed 4-bit codes: the low nibble of byte i pairs with
+ * w_lo[i], the high nibble with w_hi[i].
+ */
+using DotU4S8Fn = int32_t (*)(const uint8_t* packed, const int8_t* w_lo,
+                              const int8_t* w_hi, size_t nbytes);
+
+/** Hamming distance between two packed bit vectors of nwords words. */
+using HammingFn = uint32_t (*)(const uint64_t* a, const uint64_t* b,
+                               size_t nwords);
+
+/** Jaccard distance 1 − |a ∧ b| / |a ∨ b| (0 when both are empty). */
+using JaccardFn = float (*)(const uint64_t* a, const uint64_t* b,
+                            size_t nwords);
+
+/**
+ * Threshold filter for top-k selection: writes the indices i with
+ * dists[i] < threshold to out (in ascending order) and returns how
+ * many there are. out must hold n entries.
+ */
+using FilterFn = size_t (*)(const float* dists, size_t n, float threshold,
+                            uint32_t* out);
+
+/**
+ * Squared L2 that may stop early: if the distance is < bound it is
+ * returned exactly, otherwise any value ≥ bound (a partial sum) may
+ * be returned. Pass +inf for an exact result.
+ */
+using BoundedDistanceFn = float (*)(const float* x, const float* y,
+                                    size_t d, float bound);
+
+/**
+ * A consistent set of kernels compiled for one instruction set.
+ *
+ *   l2_sq          — Σ (x_i − y_i)²  (squared Euclidean distance)
+ *   inner_product  — Σ x_i · y_i
+ *   cosine         — x·y / (‖x‖ ‖y‖)  (similarity, not distance)
+ *
+ * The *_batch variants score one query against a block of rows,
+ * several rows per pass, reusing each loaded query chunk. The dot_u*
+ * kernels serve scalar-quantized codes (pmaddubsw, or VNNI vpdpbusd
+ * where the CPU has it); hamming/jaccard serve binary codes (popcnt,
+ * or AVX-512 VPOPCNTDQ). filter_below prunes a block of distances
+ * against the current top-k threshold; l2_sq_bounded abandons a
+ * candidate once a prefix of its distance passes the threshold.
+ */
+struct DistanceKernels {
+    SimdLevel level;
+    DistanceFn l2_sq;
+    DistanceFn inner_product;
+    DistanceFn cosine;
+    BatchDistanceFn l2_sq_batch;
+    BatchDistanceFn inner_product_batch;
+    DotU8S8Fn dot_u8s8;
+    DotU4S8Fn dot_u4s8;
+    HammingFn hamming;
+    JaccardFn jaccard;
+    FilterFn filter_below;
+    BoundedDistanceFn l2_sq_bounded;
+};
+
+/**
+ * Highest level supported by both the CPU and the OS.
+ * The VECTORDB_SIMD environment variable (scalar|sse4|avx2|avx512)
+ * can lower it, e.g. to compare paths on the same host.
+ */
+SimdLevel detect_simd_level();
+
+/** Kernels for the detected level, resolved once per process. */
+const DistanceKernels& distance_kernels();
+
+/**
+ * Kernels for a specific level. Levels the host cannot execute are
+ * clamped down to the best supported one.
+ */
+const DistanceKernels& distance_kernels(SimdLevel level);
+
+const char* simd_level_name(SimdLevel level);
+
+/**
+ * Kernels for vectors of exactly d dimensions. For the common
+ * embedding sizes (128, 384, 768, 1024, 1536) the float32 l2_sq,
+ * inner_product and batch slots are compile-time specialized on d
+ * (fully unrolled, no tail); any other d gets the generic table.
+ * Resolve once per index, at construction.
+ */
+const DistanceKernels& distance_kernels_for_dim(size_t d);
+const DistanceKernels& distance_kernels_for_dim(size_t d, SimdLevel level);
+// --8<-- [end:distance_kernels]
+
+// --8<-- [start:batch_api]
+/** out[i] = ‖x_i‖² for each of the n rows of base. */
+void compute_norms_sq(const float* base, size_t n, size_t d, float* out);
+
+/**
+ * Squared L2 from one query to n contiguous rows.
+ *
+ * With base_norms (‖x_i‖², e.g. from compute_norms_sq) the distance
+ * is expanded as ‖q‖² − 2 q·x + ‖x‖², so the inner loop is a pure
+ * dot product. Without them the differences are accumulated directly.
+ */
+void l2_sq_batch(const float* query, const float* base, size_t n, size_t d,
+                 float* out, const float* base_norms = nullptr);
+
+/** Inner product from one query to n contiguous rows. */
+void inner_product_batch(const float* query, const float* base, size_t n,
+                         size_t d, float* out);
+// --8<-- [end:batch_api]
+
+// --8<-- [start:metric]
+/**
+ * What a search ranks by.
+ *
+ *   L2     — Euclidean distance
+ *   Cosine — cosine distance 1 − cos(q, x)
+ *
+ * Cosine indexes L2-normalize vectors once at ingest (and the query
+ * once per search), so cos(q, x) = q·x and each comparison is a single
+ * inner-product kernel instead of three dot products.
+ */
+enum class Metric { L2, Cosine };
+
+/**
+ * Scale x to unit L2 norm in place and return its original norm.
+ * Zero vectors are left untouched.
+ */
+float normalize_l2(float* x, size_t d);
+// --8<-- [end:metric]
+
+// --8<-- [start:dimension_order]
+/**
+ * Dimensions sorted by decreasing variance over n rows. Storing and
+ * querying vectors in this order (permute_dims) leaves L2 and inner
+ * products unchanged but front-loads the large terms, so bounded
+ * kernels cross the threshold and abandon sooner.
+ */
+std::vector<uint32_t> variance_order(const float* data, size_t n, size_t d);
+
+/** dst[j] = src[order[j]]. */
+void permute_dims(const float* src, const uint32_t* order, size_t d,
+                  float* dst);
+// --8<-- [end:dimension_order]
+
+// --8<-- [start:search_result]
+struct SearchResult {
+    size_t index;
+    float distance;
+    bool operator<(const SearchResult& other) const {
+        return distance < other.distance;
+    }
+};
+// --8<-- [end:search_result]
+
+/**
+ * Exact k-NN over a row-major n × d database; see distances.cpp.
+ * base_norms is optional and enables the norm-decomposed kernel.
+ */
+std::vector<SearchResult> brute_force_knn(const float* query,
+                                          const float* database, size_t n,
+                                          size_t d, size_t k,
+                                          const float* base_norms = nullptr);
+
+/**
+ * Exact k-NN by cosine distance (1 − cos). The database rows must
+ * already be unit-norm (normalize_l2 at ingest); the query need not
+ * be. Each row costs one inner product.
+ */
+std::vector<SearchResult> brute_force_knn_cosine(const float* query,
+                                                 const float* database,
+                                                 size_t n, size_t d,
+                                                 size_t k);
+
+/**
+ * Exact k-NN for nq queries at once (queries: row-major nq × d).
+ *
+ * Queries and database rows are tiled so that a block of rows stays
+ * in L2 while a whole tile of queries is scored against it, and each
+ * query keeps a bounded top-k heap instead of an n-sized buffer.
+ * Work is spread over num_threads threads (0 = all hardware threads).
+ * Result lists are sorted by ascending squared L2 distance.
+ */
+std::vector<std::vector<SearchResult>> brute_force_knn_batch(
+    const float* queries, size_t nq, const float* database, size_t n,
+    size_t d, size_t k, const float* base_norms = nullptr,
+    size_t num_threads = 0);
+
+// --8<-- [start:storage_kernels]
+/**
+ * Element type used to *store* vectors. Queries stay float32; the
+ * kernels below widen stored rows on the fly while accumulating, so
+ * half-precision storage halves memory and bandwidth without
+ * quantizing the query.
+ *
+ *   FP16 — IEEE 754 binary16 (5-bit exponent, 10-bit mantissa)
+ *   BF16 — bfloat16 (float32 with the low 16 mantissa bits dropped)
+ */
+enum class ScalarType { FP32, FP16, BF16 };
+
+size_t scalar_type_size(ScalarType type);
+
+/** Query (float32) against one stored row: f(query, row, d). */
+using StoredDistanceFn = float (*)(const float* query, const void* row,
+                                   size_t d);
+
+/** Stored-row form of BoundedDistanceFn. */
+using StoredBoundedFn = float (*)(const float* query, const void* row,
+                                  size_t d, float bound);
+
+/**
+ * Score n rows scattered through memory: out[i] = f(query, row(ids[i]))
+ * with row(id) = base + id · stride (stride in bytes). Later rows are
+ * prefetched while earlier ones are computed. The L2 form takes the
+ * same bound as StoredBoundedFn (+inf for exact distances).
+ */
+using StoredGatherBoundedFn = void (*)(const float* query, const void* base,
+                                       size_t stride, const uint32_t* ids,
+                                       size_t n, size_t d, float bound,
+                                       float* out);
+using StoredGatherFn = void (*)(const float* query, const void* base,
+                                size_t stride, const uint32_t* ids, size_t n,
+                                size_t d, float* out);
+
+struct StorageKernels {
+    ScalarType type;
+    StoredDistanceFn l2_sq;
+    StoredDistanceFn inner_product;
+    void (*encode)(const float* src, void* dst, size_t d);
+    void (*decode)(const void* src, float* dst, size_t d);
+    StoredBoundedFn l2_sq_bounded; // early abandon (FP32 rows only)
+    StoredGatherBoundedFn l2_sq_gather;
+    StoredGatherFn inner_product_gather;
+};
+
+/** Kernels for a storage type, at the detected SIMD level. */
+const StorageKernels& storage_kernels(ScalarType type);
+
+/** Same, at a specific level (clamped to what the host supports). */
+const StorageKernels& storage_kernels(ScalarType type, SimdLevel level);
+
+/** FP32 storage kernels specialized on d, as distance_kernels_for_dim. */
+const StorageKernels& storage_kernels_for_dim(ScalarType type, size_t d);
+
+/** Round-to-nearest-even conversions, usable on any host. */
+uint16_t float_to_fp16(float f);
+float fp16_to_float(uint16_t h);
+uint16_t float_to_bf16(float f);
+float bf16_to_float(uint16_t h);
+// --8<-- [end:storage_kernels]
@@ -5,21 +5,404 @@
  * Reference: Malkov & Yashunin, "Efficient and Robust Approximate
  *            Nearest Neighbor Search Using HNSW Graphs" (2020)
  *
- * Compile: g++ -std=c++17 -O3 -o hnsw hnsw.hpp
+ * Compile: g++ -std=c++17 -O3 -c hnsw.hpp   (link with distances.cpp)
  */
 
 #pragma once
 
+#include "distances.hpp"
+#include "pq.hpp"
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cerrno>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <limits>
-#include <queue>
-#include <random>
-#include <unordered_set>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// --8<-- [start:visited_list]
+/**
+ * "Already seen" set for one graph search, cleared in O(1).
+ *
+ * Each node has a 16-bit tag; a node is visited when its tag equals
+ * the current epoch. Starting a new search just increments the epoch,
+ * so nothing is hashed or allocated per search, and the array is only
+ * zeroed when the epoch wraps (every 65535 searches).
+ */
+class VisitedList {
+public:
+  /** Start a new search over node ids < n. */
+  void reset(size_t n) {
+    if (tags_.size() < n)
+      tags_.resize(n, 0);
+    if (++epoch_ == 0) {
+      std::fill(tags_.begin(), tags_.end(), uint16_t{0});
+      epoch_ = 1;
+    }
+  }
+
+  /** Start loading id's tag ahead of a visit(id). */
+  void prefetch(uint32_t id) const { __builtin_prefetch(&tags_[id]); }
+
+  /** Mark id visited; true if it was not visited yet. */
+  bool visit(uint32_t id) {
+    if (tags_[id] == epoch_)
+      return false;
+    tags_[id] = epoch_;
+    return true;
+  }
+
+private:
+  std::vector<uint16_t> tags_;
+  uint16_t epoch_ = 0;
+};
+
+/**
+ * Thread-safe free list of VisitedLists. A search borrows one for its
+ * duration (one per concurrent search), so after warm-up no search
+ * allocates. Copies start with an empty pool: it is only a cache.
+ */
+class VisitedListPool {
+public:
+  struct Release {
+    VisitedListPool *pool;
+    void operator()(VisitedList *list) const { pool->release(list); }
+  };
+  using Handle = std::unique_ptr<VisitedList, Release>;
+
+  VisitedListPool() = default;
+  VisitedListPool(const VisitedListPool &) {}
+  VisitedListPool &operator=(const VisitedListPool &) { return *this; }
+
+  /** A list reset for node ids < n; returned to the pool on release. */
+  Handle acquire(size_t n) {
+    std::unique_ptr<VisitedList> list;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!free_.empty()) {
+        list = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+    if (!list)
+      list = std::make_unique<VisitedList>();
+    list->reset(n);
+    return Handle(list.release(), Release{this});
+  }
+
+private:
+  void release(VisitedList *list) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.emplace_back(list);
+  }
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<VisitedList>> free_;
+};
+// --8<-- [end:visited_list]
+
+// --8<-- [start:spin_lock]
+/**
+ * One-byte lock for a single node's edge lists. Critical sections are
+ * a few dozen instructions (copy or append a few ids), far shorter
+ * than a mutex's sleep/wake path, so waiters just spin.
+ */
+class SpinLock {
+public:
+  void lock() {
+    while (locked_.exchange(true, std::memory_order_acquire)) {
+      while (locked_.load(std::memory_order_relaxed))
+        std::this_thread::yield();
+    }
+  }
+  void unlock() { locked_.store(false, std::memory_order_release); }
+
+private:
+  std::atomic<bool> locked_{false};
+};
+// --8<-- [end:spin_lock]
+
+// --8<-- [start:virtual_arena]
+/**
+ * Fixed-stride slots in one virtual address range that never moves.
+ *
+ * The whole range is reserved up front (PROT_NONE, no memory behind
+ * it) and committed in growing chunks as slots are needed; the kernel
+ * zero-fills pages on first touch. Pointers into the arena stay valid
+ * while it grows, so readers can keep traversing while writers append,
+ * and slot i is always base + i·stride, which the gather kernels need.
+ */
+class VirtualArena {
+public:
+  /**
+   * Reserve address space for max_slots slots (capped at 1 TiB). On
+   * refusal (e.g. under a sanitizer or an address-space rlimit) the
+   * request is halved down to kMinReserve, so max_slots() may come
+   * out smaller; throws std::bad_alloc if nothing can be reserved, and
+   * std::length_error if one slot is larger than the cap.
+   */
+  VirtualArena(size_t stride, size_t max_slots) : stride_(stride) {
+    if (stride == 0 || stride > kMaxReserve)
+      throw std::length_error("VirtualArena: stride out of range");
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t want =
+        std::min(std::max<size_t>(max_slots, 1), kMaxReserve / stride) *
+        stride;
+    for (size_t floor = std::min(want, kMinReserve); want > 0 && want >= floor;
+         want /= 2) {
+      size_t bytes = (want + page - 1) / page * page;
+      void *p = mmap(nullptr, bytes, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+      if (p != MAP_FAILED) {
+        base_ = static_cast<uint8_t *>(p);
+        reserved_ = bytes;
+        break;
+      }
+    }
+    if (!base_)
+      throw std::bad_alloc();
+  }
+  ~VirtualArena() {
+    if (base_)
+      munmap(base_, reserved_);
+  }
+  VirtualArena(const VirtualArena &) = delete;
+  VirtualArena &operator=(const VirtualArena &) = delete;
+
+  uint8_t *at(size_t i) const { return base_ + i * stride_; }
+  size_t max_slots() const { return reserved_ / stride_; }
+
+  /** Make slots [0, n) usable. Thread-safe; existing slots never move. */
+  void commit(size_t n) {
+    size_t need = n * stride_;
+    if (need <= committed_.load(std::memory_order_acquire))
+      return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t have = committed_.load(std::memory_order_relaxed);
+    if (need <= have)
+      return;
+    if (need > reserved_)
+      throw std::length_error("VirtualArena: address space exhausted");
+    // Grow geometrically so commits stay rare.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t bytes = std::max({need, 2 * have, kMinCommit});
+    bytes = std::min((bytes + page - 1) / page * page, reserved_);
+    if (mprotect(base_ + have, bytes - have, PROT_READ | PROT_WRITE) != 0)
+      throw std::bad_alloc();
+    committed_.store(bytes, std::memory_order_release);
+  }
+
+  /**
+   * Back the first `bytes` of an empty arena with a private mapping of
+   * fd at `offset` (both page-aligned) instead of anonymous memory.
+   * Pages come straight from the page cache on first touch and are
+   * copied only if written; commit() keeps growing past them as usual.
+   * extra_flags is OR-ed into the mmap flags (e.g. MAP_POPULATE).
+   */
+  void map_file(int fd, size_t offset, size_t bytes, int extra_flags = 0) {
+    assert(committed_.load() == 0);
+    if (bytes > reserved_)
+      throw std::length_error("VirtualArena: address space exhausted");
+    void *p = mmap(base_, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED | extra_flags, fd,
+                   static_cast<off_t>(offset));
+    if (p == MAP_FAILED)
+      throw std::runtime_error(std::string("VirtualArena: mmap failed: ") +
+                               std::strerror(errno));
+    committed_.store(bytes, std::memory_order_release);
+  }
+
+private:
+  static constexpr size_t kMaxReserve = size_t{1} << 40;
+  static constexpr size_t kMinReserve = size_t{1} << 24;
+  static constexpr size_t kMinCommit = size_t{1} << 16;
+
+  size_t stride_;
+  uint8_t *base_ = nullptr;
+  size_t reserved_ = 0;
+  std::atomic<size_t> committed_{0}; // bytes, always page-aligned
+  std::mutex mutex_;
+};
+// --8<-- [end:virtual_arena]
+
+// --8<-- [start:search_filter]
+/**
+ * Which node ids a filtered HNSWIndex::search may return: an allowed
+ * bitmap (bit i of words[i / 64], ids ≥ num_bits rejected) or a
+ * predicate on the id. Nodes that fail the filter still carry the
+ * search through the graph; they just never become results.
+ *
+ * Modes:
+ *   Navigate — expand and score every neighbor as usual
+ *   TwoHop   — score only nodes that pass; a neighbor that fails is
+ *              replaced by its own passing neighbors (ACORN-style),
+ *              so a sparse filter still sees a connected subgraph,
+ *              or navigated as usual if none of those is new
+ *   Auto     — TwoHop when selectivity() < kTwoHopBelow
+ *
+ * The bitmap is not copied and must outlive the filter; a predicate
+ * is called on the searching thread.
+ */
+class SearchFilter {
+public:
+  enum class Mode { Auto, Navigate, TwoHop };
+
+  static constexpr float kTwoHopBelow = 0.1f;
+
+  SearchFilter(const uint64_t *words, size_t num_bits, Mode mode = Mode::Auto)
+      : words_(words), num_bits_(num_bits), mode_(mode) {}
+  explicit SearchFilter(std::function<bool(size_t)> predicate,
+                        Mode mode = Mode::Auto)
+      : predicate_(std::move(predicate)), mode_(mode) {}
+
+  bool allows(size_t id) const {
+    if (words_)
+      return id < num_bits_ && (words_[id / 64] >> (id % 64) & 1);
+    return predicate_(id);
+  }
+
+  /** Known fraction of ids that pass (skips the estimate). */
+  void set_selectivity(float selectivity) { selectivity_ = selectivity; }
+
+  /**
+   * Fraction of ids in [0, n) that pass: the value given to
+   * set_selectivity, else an estimate from kSamples evenly spaced ids.
+   */
+  float selectivity(size_t n) const {
+    if (selectivity_ >= 0 || n == 0)
+      return std::max(selectivity_, 0.0f);
+    size_t samples = std::min(n, kSamples), hits = 0;
+    for (size_t i = 0; i < samples; ++i)
+      hits += allows(i * n / samples);
+    return static_cast<float>(hits) / samples;
+  }
+
+  bool two_hop(size_t n) const {
+    if (mode_ == Mode::Auto)
+      return selectivity(n) < kTwoHopBelow;
+    return mode_ == Mode::TwoHop;
+  }
+
+private:
+  static constexpr size_t kSamples = 256;
+
+  const uint64_t *words_ = nullptr;
+  size_t num_bits_ = 0;
+  std::function<bool(size_t)> predicate_;
+  Mode mode_;
+  float selectivity_ = -1.0f;
+};
+// --8<-- [end:search_filter]
+
+// --8<-- [start:mapped_vectors]
+/**
+ * Float32 vectors in a flat file (row-major, size × dim, no header),
+ * mapped read-only: the full-precision side of a compressed HNSWIndex
+ * (see HNSWIndex::set_quantizer). Only rows a rerank touches are read
+ * from disk, and the page cache decides how many stay resident.
+ */
+class MappedVectors {
+public:
+  /**
+   * Write n rows to `path` (appending to an existing file if `append`),
+   * so a large set can be written a chunk at a time.
+   */
+  static void write(const std::string &path, const float *rows, size_t n,
+                    size_t dim, bool append = false) {
+    int fd = ::open(path.c_str(),
+                    O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0)
+      fail("MappedVectors::write: cannot create " + path);
+    const char *p = reinterpret_cast<const char *>(rows);
+    size_t bytes = n * dim * sizeof(float);
+    while (bytes > 0) {
+      ssize_t w = ::write(fd, p, bytes);
+      if (w < 0 && errno == EINTR)
+        continue;
+      if (w <= 0) {
+        ::close(fd);
+        fail("MappedVectors::write: write failed for " + path);
+      }
+      p += w;
+      bytes -= static_cast<size_t>(w);
+    }
+    if (::close(fd) != 0)
+      fail("MappedVectors::write: write failed for " + path);
+  }
+
+  MappedVectors(const std::string &path, size_t dim) : dim_(dim) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      fail("MappedVectors: cannot open " + path);
+    off_t bytes = ::lseek(fd, 0, SEEK_END);
+    size_t row_bytes = dim * sizeof(float);
+    if (bytes < 0 || static_cast<size_t>(bytes) % row_bytes != 0) {
+      ::close(fd);
+      throw std::runtime_error("MappedVectors: " + path +
+                               " is not a whole number of rows");
+    }
+    size_ = static_cast<size_t>(bytes) / row_bytes;
+    bytes_ = static_cast<size_t>(bytes);
+    if (bytes_ > 0) {
+      void *p = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        fail("MappedVectors: cannot map " + path);
+      }
+      // A rerank reads a few scattered rows: readahead would be wasted.
+      madvise(p, bytes_, MADV_RANDOM);
+      data_ = static_cast<const float *>(p);
+    }
+    ::close(fd);
+  }
+  ~MappedVectors() {
+    if (data_)
+      ::munmap(const_cast<float *>(data_), bytes_);
+  }
+  MappedVectors(const MappedVectors &) = delete;
+  MappedVectors &operator=(const MappedVectors &) = delete;
+
+  size_t size() const { return size_; }
+  size_t dimension() const { return dim_; }
+  const float *row(size_t i) const { return data_ + i * dim_; }
+
+  /**
+   * Copy rows ids[0..n) to out (n × dim). Usable as the fetch function
+   * of HNSWIndex::set_rerank, from any number of threads.
+   */
+  void fetch(const size_t *ids, size_t n, float *out) const {
+    for (size_t i = 0; i < n; ++i) {
+      assert(ids[i] < size_);
+      std::copy(row(ids[i]), row(ids[i]) + dim_, out + i * dim_);
+    }
+  }
+
+private:
+  [[noreturn]] static void fail(const std::string &what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+
+  size_t dim_, size_ = 0, bytes_ = 0;
+  const float *data_ = nullptr;
+};
+// --8<-- [end:mapped_vectors]
+
 // --8<-- [start:hnsw_index]
 /**
  * HNSW Index for approximate nearest neighbor search.
@@ -38,6 +421,45 @@
  *   ef_construction  — beam width during build
  *   ef_search        — beam width during query
  *   mL              — level generation factor = 1/ln(M)
+ *   storage         — element type of stored vectors (FP32/FP16/BF16);
+ *                     queries are always float32
+ *   metric          — L2 (distances are Euclidean) or Cosine (vectors
+ *                     normalized at insert, distances are 1 − cos)
+ *   max_elements    — capacity hint (default kDefaultMaxElements):
+ *                     address space is reserved for this many nodes,
+ *                     and insert() throws std::length_error past it
+ *
+ * Beam search scores a node's unvisited neighbors in one gather call
+ * that prefetches rows ahead of the one being computed. For L2 the
+ * kernel is bounded: once a candidate's partial distance passes the
+ * current ef-th best it is abandoned. set_dimension_order() (e.g.
+ * variance_order on a sample) makes that happen earlier by storing
+ * high-variance dimensions first.
+ *
+ * Memory layout (32-bit node ids, no per-node allocations at layer 0):
+ *
+ *   nodes — one fixed-size block per node, contiguous:
+ *           [count][M_max0 neighbor ids][vector, row_bytes_]
+ *           so visiting a node reads its edges and its vector from
+ *           adjacent cache lines; in compressed mode (set_quantizer)
+ *           the vector is replaced by its PQ or SQ code
+ *   meta  — per node: its level, a writer lock, and for the few nodes
+ *           above layer 0 a small array of level × [count][M ids]
+ *
+ * Both live in VirtualArenas, so a node never moves once written. Only
+ * address space is reserved up front (max_elements slots of each);
+ * memory is committed as nodes arrive.
+ *
+ * Concurrency: insert() and search() may be called from any number of
+ * threads at once. Searches take no locks. Writers publish each edge
+ * list entry with a release store and its count last, and readers load
+ * them with acquire, so a reader sees either the old or the new list
+ * (or a mix of both, every id valid) and every node it reaches is
+ * fully written. Writers serialize per node on a spin lock, and on a
+ * mutex when a node may become the new top; the entry point and top
+ * layer are packed in one atomic word so a search reads a consistent
+ * pair. Node levels come from a hash of the id, not a shared RNG, so
+ * they do not depend on thread interleaving.
  */
 class HNSWIndex {
 public:
@@ -53,10 +475,18 @@ public:
   };
 
   HNSWIndex(size_t dim, size_t M = 16, size_t ef_construction = 200,
-            size_t ef_search = 50)
+            size_t ef_search = 50, ScalarType storage = ScalarType::FP32,
+            Metric metric = Metric::L2,
+            size_t max_elements = kDefaultMaxElements)
       : dim_(dim), M_(M), M_max0_(2 * M), ef_construction_(ef_construction),
         ef_search_(ef_search), mL_(1.0 / std::log(static_cast<double>(M))),
-        entry_point_(NONE), max_layer_(0), rng_(42), uniform_(0.0, 1.0) {}
+        storage_(storage_kernels_for_dim(storage, dim)),
+        kernels_(distance_kernels_for_dim(dim)),
+        row_bytes_(dim * scalar_type_size(storage)),
+        links0_bytes_((1 + M_max0_) * sizeof(uint32_t)),
+        node_bytes_(align4(links0_bytes_ + row_bytes_)), metric_(metric),
+        max_elements_(std::min<size_t>(max_elements, NONE)),
+        state_(std::make_unique<State>(node_bytes_, max_elements_)) {}
 
   /**
    * Insert a single vector into the index.
@@ -66,237 +496,1817 @@ public:
    * 2. From entry point, greedily descend to layer l+1
    * 3. At each layer [l..0], beam-search for ef_construction
    *    neighbors and add bidirectional edges
+   *
+   * Safe to call from several threads, and concurrently with search().
+   * Returns the new node's id: that of a slot freed by
+   * repair_deleted() if there is one, otherwise size() before the call.
+   * Throws std::length_error, leaving the index unchanged, once
+   * max_elements nodes are stored.
+   */
+  size_t insert(const std::vector<float> &input) {
+    std::vector<float> vec = prepare(input);
+    size_t id = take_free_slot();
+    if (id == NONE)
+      id = claim_slot();
+    insert_at(id, vec);
+    return external_id(id);
+  }
+
+  /**
+   * Search for k approximate nearest neighbors.
+   *
+   * 1. Greedy descent from top layer to layer 1
+   * 2. Beam search at layer 0 with ef = max(ef_search, k)
+   * 3. Return top-k results sorted by distance
    */
-  size_t insert(const std::vector<float> &vec) {
-    size_t id = vectors_.size();
-    vectors_.push_back(vec);
+  std::vector<SearchResult> search(const std::vector<float> &input,
+                                   size_t k) const {
+    assert(input.size() == dim_);
+    SearchScratch s;
+    search_into(input.data(), k, s);
+    return std::move(s.results);
+  }
 
-    int level = random_level();
+  /**
+   * search() restricted to ids the filter allows. Up to k of them are
+   * returned even when few ids pass: the beam keeps expanding through
+   * rejected nodes until it holds ef allowed ones (or runs out), and
+   * sparse filters switch to two-hop expansion (see SearchFilter).
+   */
+  std::vector<SearchResult> search(const std::vector<float> &input,
+                                   size_t k,
+                                   const SearchFilter &filter) const {
+    assert(input.size() == dim_);
+    SearchScratch s;
+    search_into(input.data(), k, s, &filter);
+    return std::move(s.results);
+  }
 
-    // Grow graph layers if needed
-    while (static_cast<int>(graph_.size()) <= level) {
-      graph_.emplace_back();
-    }
+  // --8<-- [start:hnsw_search_batch]
+  /**
+   * k nearest neighbors for each of nq queries (row-major, nq × dim),
+   * on num_threads threads (0 = all hardware threads).
+   *
+   * Row q of the results is ids[q·k .. q·k+k) and the matching
+   * distances, sorted as search() returns them; rows with fewer than k
+   * hits are padded with NO_RESULT and +inf. Each thread pulls small
+   * chunks of queries from a shared counter and keeps one scratch
+   * (query buffer, heaps, visited list) for all of them, so after the
+   * first few queries nothing is allocated per query.
+   */
+  void search_batch(const float *queries, size_t nq, size_t k, size_t *ids,
+                    float *distances, size_t num_threads = 0) const {
+    if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t num_chunks = (nq + kBatchChunk - 1) / kBatchChunk;
+    num_threads = std::max<size_t>(1, std::min(num_threads, num_chunks));
 
-    // First element
-    if (entry_point_ == NONE) {
-      entry_point_ = id;
-      max_layer_ = level;
-      for (int l = 0; l <= level; ++l) {
-        if (graph_[l].size() <= id)
-          graph_[l].resize(id + 1);
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+      SearchScratch s;
+      for (size_t c; (c = next.fetch_add(1)) < num_chunks;) {
+        size_t end = std::min(nq, (c + 1) * kBatchChunk);
+        for (size_t q = c * kBatchChunk; q < end; ++q) {
+          search_into(queries + q * dim_, k, s);
+          for (size_t i = 0; i < k; ++i) {
+            bool hit = i < s.results.size();
+            ids[q * k + i] = hit ? s.results[i].id : NO_RESULT;
+            distances[q * k + i] =
+                hit ? s.results[i].distance
+                    : std::numeric_limits<float>::infinity();
+          }
+        }
       }
-      return id;
+    };
+    if (num_threads == 1) {
+      worker();
+      return;
     }
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t)
+      threads.emplace_back(worker);
+    for (auto &th : threads)
+      th.join();
+  }
+  // --8<-- [end:hnsw_search_batch]
 
-    // Ensure node has adjacency lists at all its layers
-    for (int l = 0; l <= level; ++l) {
-      if (graph_[l].size() <= id)
-        graph_[l].resize(id + 1);
+  // --8<-- [start:hnsw_range_search]
+  /**
+   * Every node within distance `radius` of the query (Euclidean, or
+   * 1 − cos), closest first: at most max_results of them (0 = no cap),
+   * the closest ones if there are more.
+   *
+   * The layer-0 beam is search()'s with ef = ef_search, except that it
+   * does not stop while the frontier still holds candidates inside the
+   * radius: a node is expanded if it is closer than the ef-th best seen
+   * or than the radius. A small radius costs about one search(); a
+   * large one grows with the number of hits, instead of costing
+   * repeated searches with growing k. Once max_results hits are held,
+   * the radius shrinks to the farthest of them.
+   *
+   * Approximate like search(): hits reachable only through nodes
+   * outside both bounds can be missed. Deleted nodes are skipped. A
+   * compressed index compares code distances (rescored exactly, and
+   * cut to the radius again, when set_rerank is set).
+   */
+  std::vector<SearchResult> range_search(const std::vector<float> &input,
+                                         float radius,
+                                         size_t max_results = 0) const {
+    assert(input.size() == dim_);
+    SearchScratch s;
+    uint64_t top = state_->entry.load(std::memory_order_acquire);
+    if (top == EMPTY || radius < 0)
+      return {};
+    s.query.resize(dim_);
+    prepare(input.data(), s.query.data());
+    prepare_tables(s.query.data(), s);
+
+    size_t current = greedy_descent(s.query.data(), top, 0, s);
+    Admit admit;
+    admit.skip_deleted = state_->deleted.load(std::memory_order_relaxed) > 0;
+    // Graph units: squared L2, or 1 − cos as is.
+    float limit = metric_ == Metric::L2 ? radius * radius : radius;
+    size_t cap = max_results == 0 ? std::numeric_limits<size_t>::max()
+                                  : max_results;
+    std::vector<SearchResult> hits;
+    range_layer(s.query.data(), current, limit, cap, s, admit, hits);
+
+    for (auto &r : hits)
+      r.id = external_id(r.id);
+    if (compressed() && fetch_) {
+      s.results.swap(hits);
+      rerank(s);
+      s.results.swap(hits);
+      while (!hits.empty() && hits.back().distance > limit)
+        hits.pop_back();
+    }
+    if (metric_ == Metric::L2) {
+      for (auto &r : hits)
+        r.distance = std::sqrt(r.distance);
     }
+    return hits;
+  }
+  // --8<-- [end:hnsw_range_search]
 
-    size_t current = entry_point_;
+  /**
+   * Bulk insert all vectors.
+   */
+  void build(const std::vector<std::vector<float>> &vectors) {
+    for (const auto &v : vectors)
+      insert(v);
+  }
 
-    // Phase 1: Greedy descent from max_layer to level+1
-    for (int l = max_layer_; l > level; --l) {
-      auto nearest = search_layer(vec, current, 1, l);
-      if (!nearest.empty())
-        current = nearest[0].id;
+  // --8<-- [start:hnsw_build_parallel]
+  /**
+   * Bulk insert on num_threads threads (0 = all hardware threads).
+   * vectors[i] gets id size() + i, exactly as with build().
+   *
+   * Threads pull the next vector from a shared counter and insert it
+   * concurrently; which neighbors a node ends up with depends on the
+   * interleaving. With deterministic = true the vectors are inserted
+   * in order on the calling thread instead, giving the same graph as
+   * build() on every run (for tests and reproducible benchmarks).
+   */
+  void build_parallel(const std::vector<std::vector<float>> &vectors,
+                      size_t num_threads = 0, bool deterministic = false) {
+    if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (deterministic || num_threads == 1 || vectors.size() < 2) {
+      build(vectors);
+      return;
     }
+    size_t base = size();
+    if (base + vectors.size() > max_elements_)
+      throw std::length_error("HNSWIndex: max_elements reached");
+    reserve(base + vectors.size());
+    state_->count.store(base + vectors.size());
 
-    // Phase 2: Insert at layers [min(level, max_layer)..0]
-    for (int l = std::min(level, max_layer_); l >= 0; --l) {
-      auto candidates = search_layer(vec, current, ef_construction_, l);
-      size_t M_max = (l == 0) ? M_max0_ : M_;
-      auto neighbors = select_neighbors(candidates, M_max);
+    // The first node must exist before anyone can search from it.
+    std::atomic<size_t> next{0};
+    if (base == 0)
+      insert_at(next++, prepare(vectors[0]));
+    auto worker = [&] {
+      for (size_t i; (i = next.fetch_add(1)) < vectors.size();)
+        insert_at(base + i, prepare(vectors[i]));
+    };
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < num_threads; ++t)
+      threads.emplace_back(worker);
+    for (auto &th : threads)
+      th.join();
+  }
+  // --8<-- [end:hnsw_build_parallel]
 
-      // Add bidirectional edges
-      for (auto &nb : neighbors) {
-        graph_[l][id].push_back(nb.id);
-        graph_[l][nb.id].push_back(id);
+  /** Commit storage for n nodes up front (insert grows it as needed). */
+  void reserve(size_t n) {
+    state_->nodes.commit(n);
+    state_->meta.commit(n);
+  }
 
-        // Prune neighbor if over capacity
-        if (graph_[l][nb.id].size() > M_max) {
-          prune(nb.id, l, M_max);
+  size_t size() const { return state_->count.load(); }
+  size_t dimension() const { return dim_; }
+  size_t num_layers() const {
+    uint64_t top = state_->entry.load(std::memory_order_acquire);
+    return top == EMPTY ? 0 : static_cast<size_t>(entry_level(top)) + 1;
+  }
+  Metric metric() const { return metric_; }
+  size_t max_elements() const { return max_elements_; }
+
+  void set_ef_search(size_t ef) { ef_search_ = ef; }
+
+  // --8<-- [start:hnsw_deletion]
+  /**
+   * Exclude node `id` from search results. The node stays in the graph
+   * as a waypoint, so recall does not drop, until repair_deleted()
+   * unlinks it. Safe to call concurrently with insert() and search().
+   */
+  void mark_deleted(size_t id) {
+    assert(id < size());
+    if (!meta(internal_id(id)).deleted.exchange(true))
+      state_->deleted.fetch_add(1);
+  }
+
+  bool is_deleted(size_t id) const { return node_deleted(internal_id(id)); }
+
+  /** Nodes marked deleted and not yet unlinked by repair_deleted(). */
+  size_t deleted_count() const { return state_->deleted.load(); }
+
+  /**
+   * Unlink every deleted node and recycle its slot for insert().
+   *
+   * Each live node with a deleted neighbor at some layer gets a new
+   * edge list, re-selected from its live neighbors plus the deleted
+   * neighbors' own neighbors at that layer. Deleted nodes then have
+   * no in-edges left, so they can be reused. If the entry point was
+   * deleted, the live node with the highest level takes its place.
+   *
+   * Cost is one pass over all nodes plus a re-selection per affected
+   * list. Must not run concurrently with insert() or search().
+   * Returns the number of slots freed.
+   */
+  size_t repair_deleted() {
+    size_t n = size();
+    std::vector<uint8_t> dead(n, 0);
+    {
+      std::lock_guard<std::mutex> lock(state_->free_mutex);
+      for (size_t i = 0; i < n; ++i)
+        dead[i] = node_deleted(i);
+      for (uint32_t id : state_->free)
+        dead[id] = 0; // already unlinked
+    }
+    size_t num_dead = std::count(dead.begin(), dead.end(), 1);
+    if (num_dead == 0)
+      return 0;
+
+    std::vector<uint32_t> adj, hop;
+    std::vector<float> base(dim_), dists;
+    auto seen = visited_pool_.acquire(n);
+    for (size_t u = 0; u < n; ++u) {
+      if (node_deleted(u))
+        continue;
+      bool decoded = false;
+      for (int l = 0; l <= meta(u).level; ++l) {
+        copy_links(u, l, adj);
+        if (std::none_of(adj.begin(), adj.end(),
+                         [&](uint32_t v) { return dead[v]; }))
+          continue;
+        // Live neighbors, then the live neighbors of dead ones.
+        seen->reset(n);
+        seen->visit(static_cast<uint32_t>(u));
+        std::vector<uint32_t> ids;
+        for (uint32_t v : adj) {
+          if (!dead[v] && seen->visit(v))
+            ids.push_back(v);
         }
+        for (uint32_t v : adj) {
+          if (!dead[v])
+            continue;
+          copy_links(v, l, hop);
+          for (uint32_t w : hop) {
+            if (!node_deleted(w) && seen->visit(w))
+              ids.push_back(w);
+          }
+        }
+        if (!decoded) {
+          decode_row(u, base.data());
+          decoded = true;
+        }
+        dists.resize(ids.size());
+        score_batch(base.data(), ids.data(), ids.size(),
+                    std::numeric_limits<float>::infinity(), dists.data());
+        std::vector<SearchResult> scored;
+        for (size_t i = 0; i < ids.size(); ++i)
+          scored.push_back({dists[i], ids[i]});
+        size_t M_max = (l == 0) ? M_max0_ : M_;
+        auto kept = select_neighbors(u, base.data(), std::move(scored),
+                                     M_max, l);
+        uint32_t *list = links(u, l);
+        for (size_t i = 0; i < kept.size(); ++i)
+          store_release(list + 1 + i, static_cast<uint32_t>(kept[i].id));
+        store_release(list, static_cast<uint32_t>(kept.size()));
       }
+    }
 
-      if (!candidates.empty())
-        current = candidates[0].id;
+    // Release the dead slots: no lists point at them any more.
+    for (size_t v = 0; v < n; ++v) {
+      if (!dead[v])
+        continue;
+      NodeMeta &m = meta(v);
+      delete[] m.upper;
+      m.upper = nullptr;
+      m.level = 0;
+      store_release(links(v, 0), 0);
+    }
+    uint64_t entry = state_->entry.load();
+    if (entry != EMPTY && dead[entry_id(entry)]) {
+      entry = EMPTY;
+      for (size_t u = 0; u < n; ++u) {
+        if (!node_deleted(u) &&
+            (entry == EMPTY || meta(u).level > entry_level(entry)))
+          entry = pack_entry(u, meta(u).level);
+      }
+      state_->entry.store(entry, std::memory_order_release);
+    }
+    std::lock_guard<std::mutex> lock(state_->free_mutex);
+    for (size_t v = 0; v < n; ++v) {
+      if (dead[v])
+        state_->free.push_back(static_cast<uint32_t>(v));
+    }
+    state_->deleted.fetch_sub(num_dead);
+    return num_dead;
+  }
+  // --8<-- [end:hnsw_deletion]
+
+  // --8<-- [start:hnsw_reorder]
+  /**
+   * Node orders for reorder().
+   *
+   *   BFS    — breadth-first over layer 0 from the entry point, i.e.
+   *            roughly the order in which searches reach nodes
+   *   RCM    — reverse Cuthill–McKee: breadth-first over the undirected
+   *            layer-0 graph from a low-degree node, neighbors taken by
+   *            increasing degree, the whole order then reversed
+   *   Gorder — greedy: the next node is the one with the most edges to,
+   *            and in-neighbors shared with, the last kGorderWindow
+   *            placed ones (Wei et al., SIGMOD 2016). Best locality, but
+   *            costs Σ in-degree × out-degree instead of one graph pass
+   */
+  enum class Reorder { BFS, RCM, Gorder };
+
+  /**
+   * Relabel nodes so that graph neighbors get nearby slots, and so
+   * nearby node blocks: a beam search then touches fewer pages and
+   * cache lines per hop than with insertion-order ids.
+   *
+   * Node blocks (vectors and level-0 edges), upper-layer lists, the
+   * entry point and the free list are rewritten into fresh storage, so
+   * peak memory is twice the node section. Ids seen by callers do not
+   * change: search results, mark_deleted, is_deleted and filters keep
+   * using the ids insert() returned, through a mapping that save()
+   * stores with the index.
+   *
+   * Offline: must not run concurrently with insert() or search(). Run
+   * it after bulk loading (and repair_deleted), before save().
+   */
+  void reorder(Reorder method = Reorder::BFS) {
+    size_t n = size();
+    uint64_t entry = state_->entry.load();
+    if (n < 2 || entry == EMPTY)
+      return;
+    // Free slots have no edges; they go last, in any order.
+    std::vector<uint8_t> placed(n, 0);
+    for (uint32_t id : state_->free)
+      placed[id] = 1;
+    std::vector<uint32_t> order;
+    order.reserve(n);
+    if (method == Reorder::Gorder)
+      gorder(entry_id(entry), placed, order);
+    else
+      bfs_order(method, entry_id(entry), placed, order);
+    order.insert(order.end(), state_->free.begin(), state_->free.end());
+    assert(order.size() == n);
+    relabel(order);
+  }
+  // --8<-- [end:hnsw_reorder]
+
+  /**
+   * Neighbor selection used on insert and when pruning a full list:
+   * the diversity heuristic (default) or plain M-closest. See
+   * select_neighbors for the two heuristic options.
+   */
+  void set_neighbor_selection(bool heuristic, bool extend_candidates = false,
+                              bool keep_pruned = false) {
+    heuristic_ = heuristic;
+    extend_candidates_ = extend_candidates;
+    keep_pruned_ = keep_pruned;
+  }
+
+  /**
+   * Store and compare vectors with their dimensions permuted by
+   * `order` (a permutation of 0..dim−1). Distances are unchanged; only
+   * the early-abandon point moves. Must be set before the first insert.
+   */
+  void set_dimension_order(std::vector<uint32_t> order) {
+    assert(size() == 0 && !compressed() &&
+           (order.empty() || order.size() == dim_));
+    dim_order_ = std::move(order);
+  }
+
+  // --8<-- [start:hnsw_compressed]
+  /**
+   * Compressed mode: node blocks keep a quantizer's codes instead of
+   * the vectors, e.g. 64 PQ bytes instead of 3 KB for 768-d float32.
+   * With M = 16 a node is then 212 bytes in total (see
+   * bytes_per_node): 132 of level-0 edges, the 64-byte code and a
+   * 16-byte NodeMeta.
+   *
+   * The graph is built and searched on approximate distances: a
+   * search computes one table per query (ADC for PQ, int8 weights for
+   * SQ) and scores each code from it; construction compares decoded
+   * codes. Results carry those approximate distances unless set_rerank
+   * supplies the full vectors.
+   *
+   * Call on an empty index, with a trained quantizer that saw vectors
+   * like the ones to be inserted (unit-norm ones for Cosine). Not
+   * combinable with set_dimension_order, nor with save().
+   */
+  void set_quantizer(const ProductQuantizer &pq) {
+    use_codec(pq.code_size());
+    pq_ = std::make_shared<const ProductQuantizer>(pq);
+  }
+  void set_quantizer(const ScalarQuantizer &sq) {
+    // The cached ‖x̃‖² of the code goes first, keeping it aligned.
+    use_codec(sizeof(float) + sq.code_size());
+    sq_ = std::make_shared<const ScalarQuantizer>(sq);
+  }
+
+  /**
+   * fetch(ids, n, out) writes the full vectors of the n given ids (as
+   * returned by insert()) to out, n × dim. It is called from the
+   * searching thread, so it must be safe to call concurrently.
+   */
+  using VectorFetcher =
+      std::function<void(const size_t *ids, size_t n, float *out)>;
+
+  /**
+   * Rerank compressed searches: the best max(k, candidates) hits by
+   * code distance are rescored exactly with vectors from `fetch` (e.g.
+   * MappedVectors::fetch), and the best k of those returned with exact
+   * distances. The beam is widened to at least `candidates`.
+   */
+  void set_rerank(VectorFetcher fetch, size_t candidates) {
+    fetch_ = std::move(fetch);
+    rerank_ = candidates;
+  }
+
+  bool compressed() const { return pq_ || sq_; }
+
+  /** Memory per node: level-0 block plus metadata (upper lists aside). */
+  size_t bytes_per_node() const { return node_bytes_ + sizeof(NodeMeta); }
+  // --8<-- [end:hnsw_compressed]
+
+  /** Padding id in search_batch rows with fewer than k hits. */
+  static constexpr size_t NO_RESULT = std::numeric_limits<size_t>::max();
+
+  /**
+   * Default capacity hint: 16M nodes. That reserves about 50 GiB of
+   * address space for a 768-d float32 index and 10 GiB at 128-d, so
+   * thousands of indexes fit in one process.
+   */
+  static constexpr size_t kDefaultMaxElements = size_t{1} << 24;
+
+  // --8<-- [start:hnsw_persistence]
+  /**
+   * How load() brings the node blocks (level-0 edges + vectors, i.e.
+   * nearly the whole file) into memory.
+   *
+   *   Read        — read them into anonymous memory
+   *   Map         — map the file privately: nothing is read up front,
+   *                 searches fault pages in from the page cache
+   *   MapPopulate — map with MAP_POPULATE, so the file is read ahead
+   *                 and page tables are filled before load() returns
+   */
+  enum class LoadMode { Read, Map, MapPopulate };
+
+  /**
+   * Write the index to `path`. Not safe during concurrent inserts.
+   *
+   * File format (version 3, host byte order):
+   *   FileHeader
+   *   dim_order    — header.order_size × uint32
+   *   levels       — count × uint8
+   *   states       — count × uint8: 0 live, 1 deleted, 2 free slot
+   *                  (absent in version 1 files)
+   *   labels       — count × uint32, the caller id of each slot, if
+   *                  header.flags has flag 8 (bit 3) set (after reorder();
+   *                  never in version 1–2 files)
+   *   upper lists  — level × (1 + M) uint32 for each node above
+   *                  layer 0, in id order
+   *   padding to kFileAlign
+   *   node blocks  — count × node_bytes, exactly as in memory
+   *
+   * The node section is aligned so load() can map it in place. The
+   * file is written next to `path` and renamed over it, so an index
+   * mapped from `path` (even this one) keeps its pages.
+   */
+  void save(const std::string &path) const {
+    if (compressed())
+      throw std::runtime_error("HNSWIndex::save: the file format has no "
+                               "place for quantizer state");
+    FileHeader h{};
+    std::memcpy(h.magic, kFileMagic, sizeof(h.magic));
+    h.version = kFileVersion;
+    h.storage = static_cast<uint32_t>(storage_.type);
+    h.metric = static_cast<uint32_t>(metric_);
+    h.flags = (heuristic_ ? 1u : 0u) | (extend_candidates_ ? 2u : 0u) |
+              (keep_pruned_ ? 4u : 0u) | (external_.empty() ? 0u : 8u);
+    h.dim = dim_;
+    h.M = M_;
+    h.ef_construction = ef_construction_;
+    h.ef_search = ef_search_;
+    h.count = size();
+    h.entry = state_->entry.load(std::memory_order_acquire);
+    h.node_bytes = node_bytes_;
+    h.order_size = dim_order_.size();
+
+    std::vector<uint8_t> levels(h.count), states(h.count);
+    std::vector<uint32_t> upper;
+    for (size_t i = 0; i < h.count; ++i) {
+      const NodeMeta &m = meta(i);
+      levels[i] = m.level;
+      states[i] = m.deleted.load() ? 1 : 0;
+      upper.insert(upper.end(), m.upper, m.upper + m.level * (1 + M_));
+    }
+    for (uint32_t id : state_->free)
+      states[id] = 2;
+    // Slots created after reorder() keep their own id.
+    std::vector<uint32_t> labels;
+    if (!external_.empty()) {
+      for (size_t i = 0; i < h.count; ++i)
+        labels.push_back(static_cast<uint32_t>(external_id(i)));
+    }
+    h.upper_words = upper.size();
+    size_t meta_end = sizeof(h) + h.order_size * sizeof(uint32_t) +
+                      2 * h.count + labels.size() * sizeof(uint32_t) +
+                      h.upper_words * sizeof(uint32_t);
+    h.nodes_offset = align_up(meta_end, kFileAlign);
+
+    const std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+      throw_errno("HNSWIndex::save: cannot create " + tmp);
+    std::vector<uint8_t> pad(h.nodes_offset - meta_end);
+    size_t node_section = h.count * node_bytes_;
+    bool ok = write_all(fd, &h, sizeof(h)) &&
+              write_all(fd, dim_order_.data(),
+                        h.order_size * sizeof(uint32_t)) &&
+              write_all(fd, levels.data(), levels.size()) &&
+              write_all(fd, states.data(), states.size()) &&
+              write_all(fd, labels.data(), labels.size() * sizeof(uint32_t)) &&
+              write_all(fd, upper.data(), upper.size() * sizeof(uint32_t)) &&
+              write_all(fd, pad.data(), pad.size()) &&
+              write_all(fd, state_->nodes.at(0), node_section);
+    // Pad the node section too, so mapping whole pages stays in the file.
+    pad.assign(align_up(node_section, kFileAlign) - node_section, 0);
+    ok = ok && write_all(fd, pad.data(), pad.size());
+    if (::close(fd) != 0 || !ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+      int err = errno;
+      ::unlink(tmp.c_str());
+      errno = err;
+      throw_errno("HNSWIndex::save: write failed for " + path);
+    }
+  }
+
+  /**
+   * Open an index written by save(). Throws std::runtime_error if the
+   * file is missing, truncated, or from another format version, or if
+   * its header, dimension order, entry point or per-node metadata is
+   * inconsistent (checked before anything is sized from it).
+   *
+   * Only the small per-node metadata (levels and upper-layer lists) is
+   * decoded; the node blocks are read or mapped as they are. A mapped
+   * index is fully usable: inserts append to anonymous memory past the
+   * mapping, and edges they add to mapped nodes go to private copies
+   * of those pages, never to the file. max_elements is the capacity
+   * for those inserts (raised to the node count if smaller); 0 picks
+   * max(2 × node count, kDefaultMaxElements).
+   */
+  static HNSWIndex load(const std::string &path,
+                        LoadMode mode = LoadMode::Map,
+                        size_t max_elements = 0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw_errno("HNSWIndex::load: cannot open " + path);
+    struct Closer {
+      int fd;
+      ~Closer() { ::close(fd); }
+    } closer{fd};
+
+    FileHeader h;
+    size_t pos = 0;
+    auto read_next = [&](void *dst, size_t bytes) {
+      if (!read_at(fd, dst, bytes, pos))
+        throw std::runtime_error("HNSWIndex::load: truncated file " + path);
+      pos += bytes;
+    };
+    read_next(&h, sizeof(h));
+    if (std::memcmp(h.magic, kFileMagic, sizeof(h.magic)) != 0)
+      throw std::runtime_error("HNSWIndex::load: not an HNSW index: " + path);
+    if (h.version < 1 || h.version > kFileVersion)
+      throw std::runtime_error("HNSWIndex::load: unsupported version " +
+                               std::to_string(h.version) + " in " + path);
+    auto corrupt = [&](const std::string &what) {
+      return std::runtime_error("HNSWIndex::load: corrupt " + what + " in " +
+                                path);
+    };
+
+    // Every header field is checked before it sizes an allocation.
+    if (h.dim == 0 || h.dim > kMaxFileDim || h.M < 2 || h.M > kMaxFileM ||
+        h.storage > static_cast<uint32_t>(ScalarType::BF16) ||
+        h.metric > static_cast<uint32_t>(Metric::Cosine) || h.count >= NONE)
+      throw corrupt("header");
+    auto storage = static_cast<ScalarType>(h.storage);
+    size_t node_bytes = align4((1 + 2 * h.M) * sizeof(uint32_t) +
+                               h.dim * scalar_type_size(storage));
+    if (h.node_bytes != node_bytes ||
+        (h.order_size != 0 && h.order_size != h.dim) ||
+        (h.count == 0) != (h.entry == EMPTY))
+      throw corrupt("header");
+
+    HNSWIndex idx(h.dim, h.M, h.ef_construction, h.ef_search, storage,
+                  static_cast<Metric>(h.metric),
+                  max_elements ? std::max<size_t>(max_elements, h.count)
+                               : std::max<size_t>(2 * h.count,
+                                                  kDefaultMaxElements));
+    idx.set_neighbor_selection(h.flags & 1u, h.flags & 2u, h.flags & 4u);
+    idx.dim_order_.resize(h.order_size);
+    read_next(idx.dim_order_.data(), h.order_size * sizeof(uint32_t));
+    std::vector<bool> seen(h.order_size, false);
+    for (uint32_t j : idx.dim_order_) {
+      if (j >= h.order_size || seen[j])
+        throw corrupt("dimension order");
+      seen[j] = true;
+    }
+
+    std::vector<uint8_t> levels(h.count), states(h.count, 0);
+    std::vector<uint32_t> upper(h.upper_words);
+    read_next(levels.data(), levels.size());
+    if (h.count > 0 && (entry_id(h.entry) >= h.count ||
+                        h.entry >> 32 != levels[entry_id(h.entry)]))
+      throw corrupt("entry point");
+    if (h.version >= 2)
+      read_next(states.data(), states.size());
+    if (h.version >= 3 && (h.flags & 8u)) {
+      std::vector<uint32_t> labels(h.count);
+      read_next(labels.data(), labels.size() * sizeof(uint32_t));
+      idx.internal_.assign(h.count, NONE);
+      for (size_t i = 0; i < h.count; ++i) {
+        if (labels[i] >= h.count || idx.internal_[labels[i]] != NONE)
+          throw corrupt("labels");
+        idx.internal_[labels[i]] = static_cast<uint32_t>(i);
+      }
+      idx.external_ = std::move(labels);
+    }
+    read_next(upper.data(), upper.size() * sizeof(uint32_t));
+
+    State &st = *idx.state_;
+    st.meta.commit(h.count);
+    const uint32_t *src = upper.data();
+    for (size_t i = 0; i < h.count; ++i) {
+      NodeMeta *m = new (st.meta.at(i)) NodeMeta();
+      m->level = levels[i];
+      m->deleted.store(states[i] != 0, std::memory_order_relaxed);
+      if (states[i] == 1)
+        ++st.deleted;
+      else if (states[i] == 2)
+        st.free.push_back(static_cast<uint32_t>(i));
+      size_t words = levels[i] * (1 + idx.M_);
+      if (src + words > upper.data() + upper.size())
+        throw corrupt("levels");
+      if (words > 0) {
+        m->upper = new uint32_t[words];
+        std::copy(src, src + words, m->upper);
+        src += words;
+      }
+      st.count.store(i + 1, std::memory_order_relaxed); // for ~State
     }
 
-    if (level > max_layer_) {
-      entry_point_ = id;
-      max_layer_ = level;
+    size_t node_section = h.count * h.node_bytes;
+    if (node_section > 0) {
+      if (mode == LoadMode::Read) {
+        st.nodes.commit(h.count);
+        if (!read_at(fd, st.nodes.at(0), node_section, h.nodes_offset))
+          throw std::runtime_error("HNSWIndex::load: truncated file " + path);
+      } else {
+        // The file must cover the mapping: touching a page past its end
+        // would raise SIGBUS instead of an exception.
+        size_t mapped = align_up(node_section, kFileAlign);
+        off_t file_size = ::lseek(fd, 0, SEEK_END);
+        if (file_size < 0 ||
+            static_cast<size_t>(file_size) < h.nodes_offset + mapped)
+          throw std::runtime_error("HNSWIndex::load: truncated file " + path);
+        st.nodes.map_file(fd, h.nodes_offset, mapped,
+                          mode == LoadMode::MapPopulate ? MAP_POPULATE : 0);
+        // Graph walks jump around the file: readahead would only
+        // evict useful pages.
+        if (mode == LoadMode::Map)
+          madvise(st.nodes.at(0), mapped, MADV_RANDOM);
+      }
     }
+    st.entry.store(h.entry, std::memory_order_release);
+    return idx;
+  }
+  // --8<-- [end:hnsw_persistence]
+
+private:
+  static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
 
+  static constexpr uint64_t EMPTY = std::numeric_limits<uint64_t>::max();
+
+  /** On-disk header; see save(). */
+  struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t storage; // ScalarType
+    uint32_t metric;  // Metric
+    uint32_t flags;   // heuristic | extend | keep (1, 2, 4), labels (8)
+    uint64_t dim, M, ef_construction, ef_search;
+    uint64_t count, entry; // entry: pack_entry(id, level) or EMPTY
+    uint64_t node_bytes, order_size, upper_words, nodes_offset;
+  };
+  static constexpr char kFileMagic[8] = {'H', 'N', 'S', 'W',
+                                         'I', 'D', 'X', '\0'};
+  static constexpr uint32_t kFileVersion = 3;
+  // Largest dimension and M a file may declare (sanity bounds).
+  static constexpr uint64_t kMaxFileDim = uint64_t{1} << 20;
+  static constexpr uint64_t kMaxFileM = uint64_t{1} << 12;
+  // Node section alignment: a multiple of every common page size.
+  static constexpr size_t kFileAlign = size_t{1} << 16;
+
+  static size_t align_up(size_t bytes, size_t a) {
+    return (bytes + a - 1) / a * a;
+  }
+  [[noreturn]] static void throw_errno(const std::string &what) {
+    throw std::runtime_error(what + ": " + std::strerror(errno));
+  }
+  static bool write_all(int fd, const void *data, size_t bytes) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    while (bytes > 0) {
+      ssize_t n = ::write(fd, p, bytes);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      bytes -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+  static bool read_at(int fd, void *data, size_t bytes, size_t offset) {
+    uint8_t *p = static_cast<uint8_t *>(data);
+    while (bytes > 0) {
+      ssize_t n = ::pread(fd, p, bytes, static_cast<off_t>(offset));
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        return false;
+      p += n;
+      offset += static_cast<size_t>(n);
+      bytes -= static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  /** Queries a search_batch thread claims at a time. */
+  static constexpr size_t kBatchChunk = 16;
+
+  /**
+   * Buffers for one search at a time, reused across layers and, in
+   * search_batch, across all queries of a thread.
+   */
+  struct SearchScratch {
+    std::vector<float> query;
+    std::vector<SearchResult> candidates; // min-heap (closest first)
+    std::vector<SearchResult> results;    // max-heap, sorted on return
+    std::vector<uint32_t> batch_ids;
+    std::vector<float> batch_dists;
+    VisitedListPool::Handle visited;
+    // Compressed mode: per-query code tables and the rerank buffers
+    std::vector<float> adc_table;
+    ScalarQuantizer::QueryTable sq_table;
+    std::vector<size_t> rerank_ids;
+    std::vector<float> rerank_rows;
+  };
+
+  static size_t align4(size_t bytes) { return (bytes + 3) & ~size_t{3}; }
+
+  /** Entry point and top layer, packed so both are read atomically. */
+  static uint64_t pack_entry(size_t id, int level) {
+    return static_cast<uint64_t>(level) << 32 | static_cast<uint32_t>(id);
+  }
+  static size_t entry_id(uint64_t top) { return static_cast<uint32_t>(top); }
+  static int entry_level(uint64_t top) { return static_cast<int>(top >> 32); }
+
+  /**
+   * Edge-list words are shared with lock-free readers: writers store
+   * with release (ids first, count last), readers load with acquire.
+   */
+  static uint32_t load_acquire(const uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+  }
+  static void store_release(uint32_t *p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+  }
+
+  /** Per-node data besides the level-0 block. */
+  struct NodeMeta {
+    SpinLock lock;                    // serializes writers of its lists
+    uint8_t level = 0;                // top layer of the node
+    std::atomic<bool> deleted{false}; // mark_deleted, or a freed slot
+    // level × (1 + M_) words for layers 1..level, or null
+    uint32_t *upper = nullptr;
+  };
+
+  /**
+   * Append a slot: its storage is committed before size() counts it,
+   * so a failed commit leaves no half-made node behind.
+   */
+  size_t claim_slot() {
+    size_t id = state_->count.load();
+    do {
+      if (id >= max_elements_)
+        throw std::length_error("HNSWIndex: max_elements reached");
+      reserve(id + 1);
+    } while (!state_->count.compare_exchange_weak(id, id + 1));
+    return id;
+  }
+
+  /** A slot freed by repair_deleted(), or NONE. */
+  size_t take_free_slot() {
+    std::lock_guard<std::mutex> lock(state_->free_mutex);
+    if (state_->free.empty())
+      return NONE;
+    uint32_t id = state_->free.back();
+    state_->free.pop_back();
     return id;
   }
 
+  NodeMeta &meta(size_t id) const {
+    return *reinterpret_cast<NodeMeta *>(state_->meta.at(id));
+  }
+
+  bool node_deleted(size_t id) const {
+    return meta(id).deleted.load(std::memory_order_relaxed);
+  }
+
   /**
-   * Search for k approximate nearest neighbors.
-   *
-   * 1. Greedy descent from top layer to layer 1
-   * 2. Beam search at layer 0 with ef = max(ef_search, k)
-   * 3. Return top-k results sorted by distance
+   * Node ids as callers see them, and back. They are the slot ids
+   * until reorder() moves nodes; slots created after that keep their
+   * own id.
    */
-  std::vector<SearchResult> search(const std::vector<float> &query,
-                                   size_t k) const {
-    if (entry_point_ == NONE)
-      return {};
+  size_t external_id(size_t id) const {
+    return id < external_.size() ? external_[id] : id;
+  }
+  size_t internal_id(size_t id) const {
+    return id < internal_.size() ? internal_[id] : id;
+  }
 
-    size_t current = entry_point_;
+  /**
+   * Edge list of node `id` at `layer`: [0] is the count, [1..] the
+   * neighbor ids (capacity M_max0 at layer 0, M above).
+   */
+  uint32_t *links(size_t id, int layer) const {
+    if (layer == 0)
+      return reinterpret_cast<uint32_t *>(state_->nodes.at(id));
+    return meta(id).upper + static_cast<size_t>(layer - 1) * (1 + M_);
+  }
 
-    // Descend from top
-    for (int l = max_layer_; l > 0; --l) {
-      auto nearest = search_layer(query, current, 1, l);
-      if (!nearest.empty())
-        current = nearest[0].id;
+  /**
+   * Start loading the edge list of `id` at `layer`. Above layer 0 this
+   * reads the node's metadata for the list pointer; those few nodes
+   * are usually cached.
+   */
+  void prefetch_links(size_t id, int layer) const {
+    __builtin_prefetch(links(id, layer));
+  }
+
+  /** Stored vector of node `id`, right after its level-0 edges. */
+  const uint8_t *row(size_t id) const {
+    return state_->nodes.at(id) + links0_bytes_;
+  }
+
+  /** Write a prepared vector into a node's row (or its code). */
+  void encode_row(const float *vec, uint8_t *dst) const {
+    if (pq_) {
+      pq_->encode(vec, dst);
+    } else if (sq_) {
+      sq_->encode(vec, dst + sizeof(float));
+      float norm = sq_->code_norm_sq(dst + sizeof(float));
+      std::memcpy(dst, &norm, sizeof(norm));
+    } else {
+      storage_.encode(vec, dst, dim_);
     }
+  }
 
-    size_t ef = std::max(ef_search_, k);
-    auto results = search_layer(query, current, ef, 0);
+  /** Stored vector of node `id` as float32 (reconstructed if coded). */
+  void decode_row(size_t id, float *out) const {
+    if (pq_)
+      pq_->decode(row(id), out);
+    else if (sq_)
+      sq_->decode(row(id) + sizeof(float), out);
+    else
+      storage_.decode(row(id), out, dim_);
+  }
 
-    // Take sqrt for actual Euclidean distances
-    if (results.size() > k)
-      results.resize(k);
-    for (auto &r : results) {
-      r.distance = std::sqrt(r.distance);
+  /** Switch an empty index to rows of `row_bytes` code bytes. */
+  void use_codec(size_t row_bytes) {
+    assert(size() == 0 && !compressed() && dim_order_.empty());
+    row_bytes_ = row_bytes;
+    node_bytes_ = align4(links0_bytes_ + row_bytes_);
+    state_ = std::make_unique<State>(node_bytes_, max_elements_);
+  }
+
+  /**
+   * Graph distance for a squared L2 measured against a reconstructed
+   * (code) vector. Cosine graphs hold unit vectors, for which
+   * ‖q − x‖² / 2 = 1 − cos.
+   */
+  float code_distance(float l2_sq) const {
+    return metric_ == Metric::Cosine ? 0.5f * l2_sq : l2_sq;
+  }
+
+  /**
+   * Graph distance from a (prepared) float32 query to n nodes: squared
+   * L2, or 1 − q·x for unit-norm cosine vectors, through the
+   * prefetching gather kernels. L2 distances may stop early once they
+   * reach `bound`: exact below it, some value ≥ bound otherwise.
+   *
+   * Compressed nodes are decoded one by one; that serves construction,
+   * which scores few nodes per call. Searches use score_search.
+   */
+  void score_batch(const float *query, const uint32_t *ids, size_t n,
+                   float bound, float *out) const {
+    if (compressed()) {
+      std::vector<float> x(dim_);
+      for (size_t i = 0; i < n; ++i) {
+        decode_row(ids[i], x.data());
+        out[i] = code_distance(kernels_.l2_sq(query, x.data(), dim_));
+      }
+      return;
+    }
+    // Rows are node_bytes_ apart, starting after node 0's edges.
+    const uint8_t *base = row(0);
+    if (metric_ == Metric::Cosine) {
+      storage_.inner_product_gather(query, base, node_bytes_, ids, n, dim_,
+                                    out);
+      for (size_t i = 0; i < n; ++i)
+        out[i] = 1.0f - out[i];
+      return;
+    }
+    storage_.l2_sq_gather(query, base, node_bytes_, ids, n, dim_, bound, out);
+  }
+
+  /** Per-query tables for scoring codes; a no-op for plain nodes. */
+  void prepare_tables(const float *query, SearchScratch &s) const {
+    if (pq_) {
+      s.adc_table.resize(pq_->code_size() * pq_->num_centroids());
+      pq_->compute_distance_table(query, s.adc_table.data());
+      if (metric_ == Metric::Cosine) {
+        for (float &t : s.adc_table)
+          t *= 0.5f; // see code_distance
+      }
+    } else if (sq_) {
+      s.sq_table = sq_->prepare_query(query);
     }
-    return results;
   }
 
   /**
-   * Bulk insert all vectors.
+   * score_batch for the query of a search: codes are scored from the
+   * tables prepare_tables left in s (PQ sums stop at `bound`), a few
+   * rows ahead being prefetched as the gather kernels do.
    */
-  void build(const std::vector<std::vector<float>> &vectors) {
-    for (const auto &v : vectors)
-      insert(v);
+  void score_search(const float *query, const SearchScratch &s,
+                    const uint32_t *ids, size_t n, float bound,
+                    float *out) const {
+    if (!compressed()) {
+      score_batch(query, ids, n, bound, out);
+      return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i + 4 < n)
+        __builtin_prefetch(row(ids[i + 4]));
+      const uint8_t *code = row(ids[i]);
+      if (pq_) {
+        out[i] = pq_->adc_l2_sq(s.adc_table.data(), code, bound);
+        continue;
+      }
+      float norm;
+      std::memcpy(&norm, code, sizeof(norm));
+      out[i] = code_distance(
+          sq_->l2_sq(s.sq_table, code + sizeof(float), norm));
+    }
   }
 
-  size_t size() const { return vectors_.size(); }
-  size_t num_layers() const { return graph_.size(); }
+  /**
+   * Rescore s.results (caller ids) exactly, against the full vectors
+   * fetch_ returns for them, and sort them again.
+   */
+  void rerank(SearchScratch &s) const {
+    size_t n = s.results.size();
+    s.rerank_ids.resize(n);
+    for (size_t i = 0; i < n; ++i)
+      s.rerank_ids[i] = s.results[i].id;
+    s.rerank_rows.resize(n * dim_);
+    fetch_(s.rerank_ids.data(), n, s.rerank_rows.data());
+    for (size_t i = 0; i < n; ++i) {
+      float *x = &s.rerank_rows[i * dim_];
+      if (metric_ == Metric::Cosine) {
+        normalize_l2(x, dim_);
+        s.results[i].distance =
+            1.0f - kernels_.inner_product(s.query.data(), x, dim_);
+      } else {
+        s.results[i].distance = kernels_.l2_sq(s.query.data(), x, dim_);
+      }
+    }
+    std::sort(s.results.begin(), s.results.end());
+  }
 
-  void set_ef_search(size_t ef) { ef_search_ = ef; }
+  /**
+   * Copy of a vector in the form the graph stores (dimensions in
+   * dim_order_, unit-norm for cosine).
+   */
+  std::vector<float> prepare(const std::vector<float> &vec) const {
+    assert(vec.size() == dim_);
+    std::vector<float> out(dim_);
+    prepare(vec.data(), out.data());
+    return out;
+  }
+  void prepare(const float *vec, float *out) const {
+    if (dim_order_.empty())
+      std::copy(vec, vec + dim_, out);
+    else
+      permute_dims(vec, dim_order_.data(), dim_, out);
+    if (metric_ == Metric::Cosine)
+      normalize_l2(out, dim_);
+  }
 
-private:
-  static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+  /**
+   * search() for one raw query, using s for every buffer. Leaves the
+   * top-k, sorted and in user units (Euclidean or 1 − cos), in
+   * s.results. The filter, if any, applies at layer 0 only; the
+   * descent through the upper layers just finds a good start.
+   */
+  void search_into(const float *input, size_t k, SearchScratch &s,
+                   const SearchFilter *filter = nullptr) const {
+    s.results.clear();
+    uint64_t top = state_->entry.load(std::memory_order_acquire);
+    if (top == EMPTY)
+      return;
+    s.query.resize(dim_);
+    prepare(input, s.query.data());
+    prepare_tables(s.query.data(), s);
+
+    size_t current = greedy_descent(s.query.data(), top, 0, s);
+
+    Admit admit;
+    admit.skip_deleted = state_->deleted.load(std::memory_order_relaxed) > 0;
+    admit.filter = filter;
+    admit.two_hop = filter && filter->two_hop(size());
+    bool exact = compressed() && fetch_;
+    size_t shortlist = exact ? std::max(k, rerank_) : k;
+    search_layer(s.query.data(), current, std::max(ef_search_, shortlist), 0,
+                 s, admit);
+    if (s.results.size() > shortlist)
+      s.results.resize(shortlist);
+    if (!external_.empty()) {
+      for (auto &r : s.results)
+        r.id = external_id(r.id);
+    }
+    if (exact)
+      rerank(s);
+    if (s.results.size() > k)
+      s.results.resize(k);
+    // Take sqrt for actual Euclidean distances
+    if (metric_ == Metric::L2) {
+      for (auto &r : s.results)
+        r.distance = std::sqrt(r.distance);
+    }
+  }
 
-  float distance_sq(const std::vector<float> &a,
-                    const std::vector<float> &b) const {
-    float sum = 0.0f;
-    for (size_t i = 0; i < dim_; ++i) {
-      float d = a[i] - b[i];
-      sum += d * d;
+  /**
+   * Greedy descent (ef = 1) from the entry point in `top` down to layer
+   * stop + 1; returns the node to continue from at layer `stop`.
+   */
+  size_t greedy_descent(const float *query, uint64_t top, int stop,
+                        SearchScratch &s) const {
+    size_t current = entry_id(top);
+    for (int l = entry_level(top); l > stop; --l) {
+      search_layer(query, current, 1, l, s, Admit());
+      if (!s.results.empty())
+        current = s.results[0].id;
     }
-    return sum;
+    return current;
   }
 
-  int random_level() {
-    return static_cast<int>(-std::log(uniform_(rng_)) * mL_);
+  /**
+   * Level ~ Geometric(mL), capped to what NodeMeta::level can hold.
+   * Drawn from a hash of the id so concurrent inserts need no shared
+   * RNG and a node's level does not depend on insertion order.
+   */
+  int random_level(size_t id) const {
+    uint64_t z = (id + 1) * 0x9E3779B97F4A7C15ull; // splitmix64
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    double u = (static_cast<double>(z >> 11) + 1.0) * 0x1.0p-53; // (0, 1]
+    return static_cast<int>(std::min(-std::log(u) * mL_, 255.0));
   }
 
   /**
-   * Beam search in a single layer.
-   * Returns up to ef nearest elements, sorted by distance (ascending).
+   * Link a prepared vector into the graph under the given id (storage
+   * for it already committed). The vector and metadata are written
+   * before the id appears in any list, so readers never see them
+   * half-done.
    */
-  std::vector<SearchResult> search_layer(const std::vector<float> &query,
-                                         size_t entry, size_t ef,
-                                         int layer) const {
-    if (layer >= static_cast<int>(graph_.size()))
-      return {};
-    if (entry >= graph_[layer].size())
-      return {};
+  void insert_at(size_t id, const std::vector<float> &vec) {
+    encode_row(vec.data(), state_->nodes.at(id) + links0_bytes_);
+    int level = random_level(id);
+    NodeMeta *m = new (state_->meta.at(id)) NodeMeta();
+    m->level = static_cast<uint8_t>(level);
+    if (level > 0)
+      m->upper = new uint32_t[static_cast<size_t>(level) * (1 + M_)]();
+
+    // A node that may become the new top keeps the lock for its whole
+    // insert, so two such nodes cannot race on the entry point.
+    std::unique_lock<std::mutex> top(state_->top);
+    uint64_t entry = state_->entry.load(std::memory_order_relaxed);
+    if (entry == EMPTY) {
+      state_->entry.store(pack_entry(id, level), std::memory_order_release);
+      return;
+    }
+    int max_layer = entry_level(entry);
+    if (level <= max_layer)
+      top.unlock();
+
+    // Phase 1: Greedy descent from max_layer to level+1
+    SearchScratch s;
+    prepare_tables(vec.data(), s);
+    size_t current = greedy_descent(vec.data(), entry, level, s);
+
+    // Phase 2: Choose neighbors at layers [min(level, max_layer)..0]
+    // and fill the node's own lists. Nobody links to it yet. Deleted
+    // nodes are passed through but not linked to.
+    int top_layer = std::min(level, max_layer);
+    std::vector<std::vector<SearchResult>> chosen(top_layer + 1);
+    Admit admit;
+    admit.skip_deleted = state_->deleted.load(std::memory_order_relaxed) > 0;
+    for (int l = top_layer; l >= 0; --l) {
+      search_layer(vec.data(), current, ef_construction_, l, s, admit);
+      const auto &candidates = s.results;
+      size_t M_max = (l == 0) ? M_max0_ : M_;
+      chosen[l] = select_neighbors(id, vec.data(), candidates, M_max, l);
+      {
+        std::lock_guard<SpinLock> lock(m->lock);
+        uint32_t *own = links(id, l);
+        for (size_t i = 0; i < chosen[l].size(); ++i)
+          store_release(own + 1 + i, static_cast<uint32_t>(chosen[l][i].id));
+        store_release(own, static_cast<uint32_t>(chosen[l].size()));
+      }
+      if (!candidates.empty())
+        current = candidates[0].id;
+    }
 
-    std::unordered_set<size_t> visited;
-    visited.insert(entry);
+    // Phase 3: Add the reverse edges, bottom layer first. A search that
+    // reaches the node on some layer then finds every layer below it
+    // already linked, instead of an empty list to continue from.
+    for (int l = 0; l <= top_layer; ++l) {
+      size_t M_max = (l == 0) ? M_max0_ : M_;
+      for (const auto &nb : chosen[l])
+        add_link(nb.id, id, l, M_max);
+    }
 
-    float d = distance_sq(query, vectors_[entry]);
+    if (level > max_layer)
+      state_->entry.store(pack_entry(id, level), std::memory_order_release);
+  }
 
-    // candidates: min-heap (closest first)
-    std::priority_queue<SearchResult, std::vector<SearchResult>,
-                        std::greater<SearchResult>>
-        candidates;
-    // results: max-heap (farthest first, for bounding)
-    std::priority_queue<SearchResult> results;
+  /** Snapshot of the edge list of node `id` at `layer` (no lock). */
+  void copy_links(size_t id, int layer, std::vector<uint32_t> &out) const {
+    const uint32_t *adj = links(id, layer);
+    out.resize(load_acquire(adj));
+    for (size_t i = 0; i < out.size(); ++i)
+      out[i] = load_acquire(adj + 1 + i);
+  }
 
-    candidates.push({d, entry});
-    results.push({d, entry});
+  /** Which nodes search_layer may return, and how it expands. */
+  struct Admit {
+    bool skip_deleted = false;
+    const SearchFilter *filter = nullptr;
+    bool two_hop = false; // see SearchFilter::Mode
+
+    bool active() const { return skip_deleted || filter; }
+  };
+
+  bool admits(const Admit &a, size_t id) const {
+    return (!a.skip_deleted || !node_deleted(id)) &&
+           (!a.filter || a.filter->allows(external_id(id)));
+  }
+
+  /**
+   * Beam search in a single layer. Leaves up to ef nearest elements in
+   * s.results, sorted by distance (ascending).
+   *
+   * Nodes inserted after the search started (ids ≥ the size seen on
+   * entry) are skipped: they do not fit the visited list. Nodes that
+   * `admit` rejects are expanded like any other but never enter the
+   * results; in two-hop mode they are not scored at all, and their
+   * admitted neighbors are expanded in their place (unless there are
+   * none left to visit, when the node is expanded itself).
+   */
+  void search_layer(const float *query, size_t entry, size_t ef, int layer,
+                    SearchScratch &s, const Admit &admit) const {
+    auto &candidates = s.candidates;
+    auto &results = s.results;
+    candidates.clear();
+    results.clear();
+    size_t n = size();
+    if (entry >= n || meta(entry).level < layer)
+      return;
+
+    if (s.visited)
+      s.visited->reset(n);
+    else
+      s.visited = visited_pool_.acquire(n);
+    VisitedList &visited = *s.visited;
+    visited.visit(static_cast<uint32_t>(entry));
+
+    float d;
+    uint32_t first = static_cast<uint32_t>(entry);
+    score_search(query, s, &first, 1, std::numeric_limits<float>::infinity(),
+                 &d);
+    candidates.push_back({d, entry});
+    bool filtered = admit.active();
+    if (!filtered || admits(admit, entry))
+      results.push_back({d, entry});
 
     while (!candidates.empty()) {
-      auto [c_dist, c_id] = candidates.top();
-      candidates.pop();
+      std::pop_heap(candidates.begin(), candidates.end(), std::greater<>());
+      SearchResult c = candidates.back();
+      candidates.pop_back();
 
-      float farthest = results.top().distance;
-      if (c_dist > farthest)
+      // Stop once the nearest open candidate is worse than a full
+      // result set. (Unfiltered, a set that is not full holds every
+      // candidate, so this is the paper's test; filtered, it keeps the
+      // beam going until ef admitted nodes are found.)
+      if (results.size() >= ef && c.distance > results.front().distance)
         break;
 
-      // Expand neighbors
-      if (c_id < graph_[layer].size()) {
-        for (size_t nb : graph_[layer][c_id]) {
-          if (visited.count(nb))
-            continue;
-          visited.insert(nb);
+      // Three steps, so the misses overlap instead of queueing:
+      //   1. collect the unvisited neighbors (their visited tags are
+      //      requested together first: one random access each),
+      //   2. request the edge list of the next candidate, which the
+      //      following iteration reads right away,
+      //   3. score the batch with one gather call, which prefetches
+      //      rows a few ahead of the one being computed.
+      s.batch_ids.clear();
+      const uint32_t *adj = links(c.id, layer);
+      uint32_t count = load_acquire(adj);
+      for (uint32_t j = 1; j <= count; ++j) {
+        uint32_t nb = load_acquire(adj + j);
+        if (nb < n)
+          visited.prefetch(nb);
+      }
+      for (uint32_t j = 1; j <= count; ++j) {
+        uint32_t nb = load_acquire(adj + j);
+        if (nb >= n || !visited.visit(nb))
+          continue;
+        if (!admit.two_hop || admits(admit, nb)) {
+          s.batch_ids.push_back(nb);
+          continue;
+        }
+        size_t before = s.batch_ids.size();
+        const uint32_t *hop = links(nb, layer);
+        for (uint32_t h = 1, hops = load_acquire(hop); h <= hops; ++h) {
+          uint32_t nb2 = load_acquire(hop + h);
+          if (nb2 < n && admits(admit, nb2) && visited.visit(nb2))
+            s.batch_ids.push_back(nb2);
+        }
+        // Nothing new admitted two hops out: keep nb as a plain
+        // navigation candidate, or a sparse filter ends the search here.
+        if (s.batch_ids.size() == before)
+          s.batch_ids.push_back(nb);
+      }
+      if (!candidates.empty())
+        prefetch_links(candidates.front().id, layer);
 
-          float nb_dist = distance_sq(query, vectors_[nb]);
-          farthest = results.top().distance;
+      // The ef-th best only shrinks while the batch is merged, so the
+      // value at the start is a valid early-abandon bound for all.
+      float bound = results.size() < ef
+                        ? std::numeric_limits<float>::infinity()
+                        : results.front().distance;
+      s.batch_dists.resize(s.batch_ids.size());
+      score_search(query, s, s.batch_ids.data(), s.batch_ids.size(), bound,
+                   s.batch_dists.data());
 
-          if (nb_dist < farthest || results.size() < ef) {
-            candidates.push({nb_dist, nb});
-            results.push({nb_dist, nb});
-            if (results.size() > ef)
-              results.pop();
+      for (size_t i = 0; i < s.batch_ids.size(); ++i) {
+        float nb_dist = s.batch_dists[i];
+        size_t nb = s.batch_ids[i];
+        if (results.size() < ef || nb_dist < results.front().distance) {
+          candidates.push_back({nb_dist, nb});
+          std::push_heap(candidates.begin(), candidates.end(),
+                         std::greater<>());
+          if (filtered && !admits(admit, nb))
+            continue;
+          results.push_back({nb_dist, nb});
+          std::push_heap(results.begin(), results.end());
+          if (results.size() > ef) {
+            std::pop_heap(results.begin(), results.end());
+            results.pop_back();
           }
         }
       }
     }
+    std::sort(results.begin(), results.end());
+  }
+
+  /**
+   * Layer-0 beam for range_search: leaves the admitted nodes within
+   * `radius` (graph units) in hits, at most cap of them, sorted.
+   *
+   * s.results keeps the ef best nodes seen, as in search_layer. A node
+   * enters the frontier if it is closer than the larger of two bounds:
+   * that ef-th best (to find the region at all) and the radius (to
+   * sweep all of it). hits is a max-heap, so once it is full its top
+   * is the radius still worth searching.
+   */
+  void range_layer(const float *query, size_t entry, float radius, size_t cap,
+                   SearchScratch &s, const Admit &admit,
+                   std::vector<SearchResult> &hits) const {
+    auto &candidates = s.candidates;
+    auto &beam = s.results;
+    candidates.clear();
+    beam.clear();
+    hits.clear();
+    size_t n = size(), ef = ef_search_;
+    if (entry >= n)
+      return;
 
-    // Extract sorted results
-    std::vector<SearchResult> out;
-    out.reserve(results.size());
-    while (!results.empty()) {
-      out.push_back(results.top());
-      results.pop();
+    if (s.visited)
+      s.visited->reset(n);
+    else
+      s.visited = visited_pool_.acquire(n);
+    VisitedList &visited = *s.visited;
+    const float inf = std::numeric_limits<float>::infinity();
+    auto within = [&] {
+      return hits.size() < cap ? radius : hits.front().distance;
+    };
+    auto bound = [&] {
+      return beam.size() < ef ? inf : std::max(within(), beam.front().distance);
+    };
+    auto add = [&](float dist, size_t id) {
+      candidates.push_back({dist, id});
+      std::push_heap(candidates.begin(), candidates.end(), std::greater<>());
+      beam.push_back({dist, id});
+      std::push_heap(beam.begin(), beam.end());
+      if (beam.size() > ef) {
+        std::pop_heap(beam.begin(), beam.end());
+        beam.pop_back();
+      }
+      if (dist > within() || (admit.active() && !admits(admit, id)))
+        return;
+      hits.push_back({dist, id});
+      std::push_heap(hits.begin(), hits.end());
+      if (hits.size() > cap) {
+        std::pop_heap(hits.begin(), hits.end());
+        hits.pop_back();
+      }
+    };
+
+    visited.visit(static_cast<uint32_t>(entry));
+    float d;
+    uint32_t first = static_cast<uint32_t>(entry);
+    score_search(query, s, &first, 1, inf, &d);
+    add(d, entry);
+
+    while (!candidates.empty()) {
+      std::pop_heap(candidates.begin(), candidates.end(), std::greater<>());
+      SearchResult c = candidates.back();
+      candidates.pop_back();
+      if (c.distance > bound())
+        break;
+
+      // Same access pattern as search_layer: visited tags first, then
+      // the next candidate's edges, then one gather over the batch.
+      s.batch_ids.clear();
+      const uint32_t *adj = links(c.id, 0);
+      uint32_t count = load_acquire(adj);
+      for (uint32_t j = 1; j <= count; ++j) {
+        uint32_t nb = load_acquire(adj + j);
+        if (nb < n)
+          visited.prefetch(nb);
+      }
+      for (uint32_t j = 1; j <= count; ++j) {
+        uint32_t nb = load_acquire(adj + j);
+        if (nb < n && visited.visit(nb))
+          s.batch_ids.push_back(nb);
+      }
+      if (!candidates.empty())
+        prefetch_links(candidates.front().id, 0);
+
+      // The bound only shrinks while the batch is merged.
+      s.batch_dists.resize(s.batch_ids.size());
+      score_search(query, s, s.batch_ids.data(), s.batch_ids.size(), bound(),
+                   s.batch_dists.data());
+      for (size_t i = 0; i < s.batch_ids.size(); ++i) {
+        if (s.batch_dists[i] < bound())
+          add(s.batch_dists[i], s.batch_ids[i]);
+      }
     }
-    std::sort(out.begin(), out.end());
-    return out;
+    std::sort(hits.begin(), hits.end());
   }
 
+  // --8<-- [start:hnsw_select_neighbors]
+  /**
+   * Choose up to M neighbors for `base` from candidates scored against
+   * it (Algorithm 4 of the paper, or the M closest when the heuristic
+   * is off).
+   *
+   * The heuristic walks candidates from closest to farthest and keeps
+   * one only if it is closer to the base than to every neighbor kept
+   * so far, so edges point in diverse directions instead of all into
+   * the nearest cluster. Options:
+   *   extend_candidates — also consider the candidates' own neighbors
+   *   keep_pruned       — top the result up to M with the closest
+   *                       rejected candidates
+   */
   std::vector<SearchResult>
-  select_neighbors(const std::vector<SearchResult> &candidates,
-                   size_t M) const {
-    auto sorted = candidates;
-    std::sort(sorted.begin(), sorted.end());
-    if (sorted.size() > M)
-      sorted.resize(M);
-    return sorted;
+  select_neighbors(size_t base_id, const float *base,
+                   std::vector<SearchResult> candidates, size_t M,
+                   int layer) const {
+    if (heuristic_ && extend_candidates_) {
+      size_t limit = size();
+      auto seen = visited_pool_.acquire(limit);
+      seen->visit(static_cast<uint32_t>(base_id)); // never link to itself
+      for (const auto &c : candidates)
+        seen->visit(static_cast<uint32_t>(c.id));
+      std::vector<uint32_t> extra, adj;
+      for (size_t i = 0, n = candidates.size(); i < n; ++i) {
+        copy_links(candidates[i].id, layer, adj);
+        for (uint32_t nb : adj) {
+          if (nb < limit && !node_deleted(nb) && seen->visit(nb))
+            extra.push_back(nb);
+        }
+      }
+      std::vector<float> dists(extra.size());
+      score_batch(base, extra.data(), extra.size(),
+                  std::numeric_limits<float>::infinity(), dists.data());
+      for (size_t i = 0; i < extra.size(); ++i)
+        candidates.push_back({dists[i], extra[i]});
+    }
+    std::sort(candidates.begin(), candidates.end());
+    if (!heuristic_ || candidates.size() <= M) {
+      if (candidates.size() > M)
+        candidates.resize(M);
+      return candidates;
+    }
+
+    std::vector<SearchResult> selected, pruned;
+    std::vector<uint32_t> selected_ids;
+    std::vector<float> c_vec(dim_), dists;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      const SearchResult &c = candidates[i];
+      if (selected.size() >= M)
+        break;
+      // The next candidate's row is decoded in the next iteration.
+      if (i + 1 < candidates.size())
+        __builtin_prefetch(row(candidates[i + 1].id));
+      // Distances from c to the kept neighbors, abandoned past c's own
+      // distance to the base: only "is any of them closer?" matters.
+      decode_row(c.id, c_vec.data());
+      dists.resize(selected_ids.size());
+      score_batch(c_vec.data(), selected_ids.data(), selected_ids.size(),
+                  c.distance, dists.data());
+      bool diverse = std::all_of(dists.begin(), dists.end(),
+                                 [&](float d) { return d >= c.distance; });
+      if (diverse) {
+        selected.push_back(c);
+        selected_ids.push_back(static_cast<uint32_t>(c.id));
+      } else if (keep_pruned_) {
+        pruned.push_back(c);
+      }
+    }
+    for (size_t i = 0; i < pruned.size() && selected.size() < M; ++i)
+      selected.push_back(pruned[i]);
+    return selected;
+  }
+  // --8<-- [end:hnsw_select_neighbors]
+
+  /**
+   * Add the edge node → new_id. A full list is re-selected from its
+   * current neighbors plus new_id by select_neighbors.
+   *
+   * The selection runs without the node's lock (it may read other
+   * nodes' lists, and nested node locks could deadlock); if another
+   * thread changed the list meanwhile, the selection is redone. Under
+   * the lock the list can be read plainly; only stores must be atomic.
+   */
+  void add_link(size_t node, size_t new_id, int layer, size_t M_max) {
+    std::vector<uint32_t> ids;
+    std::vector<float> base(dim_), dists;
+    decode_row(node, base.data());
+    SpinLock &node_lock = meta(node).lock;
+    for (;;) {
+      {
+        std::lock_guard<SpinLock> lock(node_lock);
+        uint32_t *adj = links(node, layer);
+        if (adj[0] < M_max) {
+          store_release(adj + 1 + adj[0], static_cast<uint32_t>(new_id));
+          store_release(adj, adj[0] + 1);
+          return;
+        }
+        ids.assign(adj + 1, adj + 1 + adj[0]);
+      }
+      size_t old_count = ids.size();
+      ids.push_back(static_cast<uint32_t>(new_id));
+      dists.resize(ids.size());
+      score_batch(base.data(), ids.data(), ids.size(),
+                  std::numeric_limits<float>::infinity(), dists.data());
+      std::vector<SearchResult> scored;
+      for (size_t i = 0; i < ids.size(); ++i)
+        scored.push_back({dists[i], ids[i]});
+      auto kept = select_neighbors(node, base.data(), std::move(scored),
+                                   M_max, layer);
+
+      std::lock_guard<SpinLock> lock(node_lock);
+      uint32_t *adj = links(node, layer);
+      if (adj[0] != old_count || !std::equal(ids.begin(), ids.end() - 1,
+                                             adj + 1))
+        continue; // changed under us: start over from the new list
+      for (size_t i = 0; i < kept.size(); ++i)
+        store_release(adj + 1 + i, static_cast<uint32_t>(kept[i].id));
+      store_release(adj, static_cast<uint32_t>(kept.size()));
+      return;
+    }
+  }
+
+  /** Nodes scored against at once by Gorder (the paper's w). */
+  static constexpr size_t kGorderWindow = 5;
+
+  /**
+   * Layer-0 graph in compressed rows: the out-edges of u (in-edges if
+   * `reverse`) are edges[offsets[u] .. offsets[u + 1]).
+   */
+  void layer0_adjacency(bool reverse, std::vector<size_t> &offsets,
+                        std::vector<uint32_t> &edges) const {
+    size_t n = size();
+    offsets.assign(n + 1, 0);
+    for (size_t u = 0; u < n; ++u) {
+      const uint32_t *adj = links(u, 0);
+      for (uint32_t j = 1; j <= adj[0]; ++j)
+        ++offsets[(reverse ? adj[j] : u) + 1];
+    }
+    for (size_t u = 0; u < n; ++u)
+      offsets[u + 1] += offsets[u];
+    edges.resize(offsets[n]);
+    std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t u = 0; u < n; ++u) {
+      const uint32_t *adj = links(u, 0);
+      for (uint32_t j = 1; j <= adj[0]; ++j) {
+        if (reverse)
+          edges[fill[adj[j]]++] = static_cast<uint32_t>(u);
+        else
+          edges[fill[u]++] = adj[j];
+      }
+    }
+  }
+
+  /**
+   * Append the BFS or RCM order of the nodes not yet `placed`. The
+   * order itself serves as the queue; nodes a traversal cannot reach
+   * start the next one (RCM: lowest degree first).
+   */
+  void bfs_order(Reorder method, size_t entry, std::vector<uint8_t> &placed,
+                 std::vector<uint32_t> &order) const {
+    size_t n = size();
+    bool rcm = method == Reorder::RCM;
+    std::vector<size_t> out_off, in_off;
+    std::vector<uint32_t> out, in;
+    layer0_adjacency(false, out_off, out);
+    if (rcm)
+      layer0_adjacency(true, in_off, in);
+    auto degree = [&](uint32_t u) {
+      return out_off[u + 1] - out_off[u] + in_off[u + 1] - in_off[u];
+    };
+    auto by_degree = [&](uint32_t a, uint32_t b) {
+      return degree(a) < degree(b);
+    };
+
+    std::vector<uint32_t> roots(n);
+    std::iota(roots.begin(), roots.end(), 0);
+    if (rcm)
+      std::stable_sort(roots.begin(), roots.end(), by_degree);
+    else
+      roots.insert(roots.begin(), static_cast<uint32_t>(entry));
+    size_t first = order.size();
+    std::vector<uint32_t> next;
+    auto take = [&](uint32_t u, const std::vector<size_t> &off,
+                    const std::vector<uint32_t> &edges) {
+      for (size_t j = off[u]; j < off[u + 1]; ++j) {
+        if (!placed[edges[j]]) {
+          placed[edges[j]] = 1;
+          next.push_back(edges[j]);
+        }
+      }
+    };
+    for (uint32_t root : roots) {
+      if (placed[root])
+        continue;
+      placed[root] = 1;
+      order.push_back(root);
+      for (size_t head = order.size() - 1; head < order.size(); ++head) {
+        uint32_t u = order[head];
+        next.clear();
+        take(u, out_off, out);
+        if (rcm) {
+          take(u, in_off, in);
+          std::stable_sort(next.begin(), next.end(), by_degree);
+        }
+        order.insert(order.end(), next.begin(), next.end());
+      }
+    }
+    if (rcm)
+      std::reverse(order.begin() + first, order.end());
   }
 
-  void prune(size_t node, int layer, size_t M_max) {
-    auto &adj = graph_[layer][node];
-    std::vector<SearchResult> scored;
-    for (size_t nb : adj) {
-      scored.push_back({distance_sq(vectors_[node], vectors_[nb]), nb});
+  /**
+   * Append the Gorder of the nodes not yet `placed`, starting at the
+   * entry point. Scores against the window live in a bucket queue (the
+   * paper's unit heap): one linked list of nodes per score, so moving
+   * a node up or down by one and taking a best node are O(1).
+   */
+  void gorder(size_t entry, std::vector<uint8_t> &placed,
+              std::vector<uint32_t> &order) const {
+    size_t n = size();
+    std::vector<size_t> out_off, in_off;
+    std::vector<uint32_t> out, in;
+    layer0_adjacency(false, out_off, out);
+    layer0_adjacency(true, in_off, in);
+
+    std::vector<uint32_t> score(n, 0), prev(n, NONE), next(n, NONE);
+    std::vector<uint32_t> bucket(1, NONE); // first node of each score
+    size_t best = 0; // no bucket above it holds a node
+    auto unlink = [&](uint32_t v) {
+      (prev[v] != NONE ? next[prev[v]] : bucket[score[v]]) = next[v];
+      if (next[v] != NONE)
+        prev[next[v]] = prev[v];
+    };
+    auto link = [&](uint32_t v) {
+      if (score[v] >= bucket.size())
+        bucket.resize(score[v] + 1, NONE);
+      prev[v] = NONE;
+      next[v] = bucket[score[v]];
+      if (next[v] != NONE)
+        prev[next[v]] = v;
+      bucket[score[v]] = v;
+    };
+    auto bump = [&](uint32_t v, bool up) {
+      if (placed[v])
+        return;
+      unlink(v);
+      up ? ++score[v] : --score[v];
+      link(v);
+      best = std::max<size_t>(best, score[v]);
+    };
+    // u entering (up) or leaving the window changes the score of its
+    // neighbors either way and of the nodes sharing an in-neighbor.
+    auto update = [&](uint32_t u, bool up) {
+      for (size_t j = out_off[u]; j < out_off[u + 1]; ++j)
+        bump(out[j], up);
+      for (size_t j = in_off[u]; j < in_off[u + 1]; ++j) {
+        uint32_t x = in[j];
+        bump(x, up);
+        for (size_t i = out_off[x]; i < out_off[x + 1]; ++i) {
+          if (out[i] != u)
+            bump(out[i], up);
+        }
+      }
+    };
+
+    for (uint32_t v = 0; v < n; ++v) {
+      if (!placed[v])
+        link(v);
     }
-    std::sort(scored.begin(), scored.end());
-    adj.clear();
-    for (size_t i = 0; i < std::min(M_max, scored.size()); ++i) {
-      adj.push_back(scored[i].id);
+    size_t first = order.size();
+    uint32_t v = placed[entry] ? NONE : static_cast<uint32_t>(entry);
+    for (;;) {
+      if (v == NONE) {
+        while (best > 0 && bucket[best] == NONE)
+          --best;
+        if ((v = bucket[best]) == NONE)
+          break;
+      }
+      unlink(v);
+      placed[v] = 1;
+      order.push_back(v);
+      update(v, true);
+      if (order.size() - first > kGorderWindow)
+        update(order[order.size() - 1 - kGorderWindow], false);
+      v = NONE;
     }
   }
 
+  /**
+   * Move node order[i] to slot i and rewrite every stored id to match.
+   * Upper-layer lists change owner instead of being copied.
+   */
+  void relabel(const std::vector<uint32_t> &order) {
+    size_t n = order.size();
+    std::vector<uint32_t> slot(n), external(n);
+    for (size_t i = 0; i < n; ++i)
+      slot[order[i]] = static_cast<uint32_t>(i);
+
+    auto fresh = std::make_unique<State>(node_bytes_, max_elements_);
+    fresh->nodes.commit(n);
+    fresh->meta.commit(n);
+    for (size_t i = 0; i < n; ++i) {
+      size_t old = order[i];
+      std::memcpy(fresh->nodes.at(i), state_->nodes.at(old), node_bytes_);
+      NodeMeta &from = meta(old);
+      NodeMeta *to = new (fresh->meta.at(i)) NodeMeta();
+      to->level = from.level;
+      to->deleted.store(from.deleted.load(), std::memory_order_relaxed);
+      to->upper = from.upper;
+      from.upper = nullptr;
+      fresh->count.store(i + 1, std::memory_order_relaxed); // for ~State
+      external[i] = static_cast<uint32_t>(external_id(old));
+    }
+    uint64_t entry = state_->entry.load();
+    fresh->entry.store(pack_entry(slot[entry_id(entry)], entry_level(entry)));
+    fresh->deleted.store(state_->deleted.load());
+    for (uint32_t id : state_->free)
+      fresh->free.push_back(slot[id]);
+    state_ = std::move(fresh);
+
+    for (size_t i = 0; i < n; ++i) {
+      for (int l = 0; l <= meta(i).level; ++l) {
+        uint32_t *adj = links(i, l);
+        for (uint32_t j = 1; j <= adj[0]; ++j)
+          adj[j] = slot[adj[j]];
+      }
+    }
+    internal_.assign(n, 0);
+    for (size_t i = 0; i < n; ++i)
+      internal_[external[i]] = static_cast<uint32_t>(i);
+    external_ = std::move(external);
+  }
+
   size_t dim_;
   size_t M_, M_max0_;
   size_t ef_construction_, ef_search_;
   double mL_;
-  size_t entry_point_;
-  int max_layer_;
+  StorageKernels storage_; // runtime-dispatched kernels for the element type
+  DistanceKernels kernels_; // float32 kernels: decoded codes, rerank
+  size_t row_bytes_;    // stored vector, storage type (or code)
+  size_t links0_bytes_; // level-0 count + M_max0 ids
+  size_t node_bytes_;   // level-0 block: edges + vector, 4-byte aligned
+  Metric metric_;
+  size_t max_elements_; // capacity hint, see the constructor
+  bool heuristic_ = true;
+  bool extend_candidates_ = false;
+  bool keep_pruned_ = false;
+  std::vector<uint32_t> dim_order_; // storage order of dimensions, or empty
+  std::vector<uint32_t> external_;  // slot → caller id, empty if identity
+  std::vector<uint32_t> internal_;  // caller id → slot (inverse)
+  std::shared_ptr<const ProductQuantizer> pq_; // compressed mode: PQ codes,
+  std::shared_ptr<const ScalarQuantizer> sq_;  // or SQ codes
+  VectorFetcher fetch_; // full vectors for rerank, or empty
+  size_t rerank_ = 0;   // rerank shortlist length
 
-  std::mt19937 rng_;
-  std::uniform_real_distribution<double> uniform_;
+  /**
+   * Graph storage and synchronization, behind a pointer so the index
+   * stays movable: node count, packed entry point, the entry-point
+   * mutex, and the two arenas.
+   */
+  struct State {
+    State(size_t node_bytes, size_t max_elements)
+        : nodes(node_bytes, max_elements),
+          meta(sizeof(NodeMeta), max_elements) {}
+    ~State() {
+      for (size_t i = 0, n = count.load(); i < n; ++i)
+        delete[] reinterpret_cast<NodeMeta *>(meta.at(i))->upper;
+    }
+
+    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> entry{EMPTY}; // pack_entry(id, level) or EMPTY
+    std::mutex top;
+    std::atomic<size_t> deleted{0}; // marked, not yet repaired
+    std::mutex free_mutex;
+    std::vector<uint32_t> free; // slots released by repair_deleted()
+    VirtualArena nodes; // node_bytes_ per node: level-0 edges + vector
+    VirtualArena meta;  // one NodeMeta per node
+  };
 
-  std::vector<std::vector<float>> vectors_;
-  // graph_[layer][node_id] = list of neighbor IDs
-  std::vector<std::vector<std::vector<size_t>>> graph_;
+  // Reusable visited sets, one per concurrent search_layer call
+  mutable VisitedListPool visited_pool_;
+  std::unique_ptr<State> state_;
 };
 // --8<-- [end:hnsw_index]
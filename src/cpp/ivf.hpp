@@ -4,14 +4,18 @@
  * Partitions vector space into Voronoi cells using k-means,
  * then searches only the nprobe nearest cells at query time.
  *
- * Compile: g++ -std=c++17 -O3 -o ivf ivf.hpp
+ * Compile: g++ -std=c++17 -O3 -c ivf.hpp   (link with distances.cpp)
  */
 
 #pragma once
 
+#include "distances.hpp"
+#include "topk.hpp"
+
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <limits>
 #include <numeric>
 #include <random>
@@ -26,6 +30,15 @@
  * Parameters:
  *   nlist  — number of Voronoi cells (centroids)
  *   nprobe — number of cells to search (trade-off: recall vs speed)
+ *   storage — element type of the vectors kept in the inverted lists
+ *             (FP32, or FP16/BF16 for half the memory)
+ *   metric  — L2, or Cosine (vectors and centroids live on the unit
+ *             sphere; members are scored by one inner product)
+ *
+ * For high-dimensional FP32 L2 lists, once the top-k is full each
+ * member is scored with a bounded kernel that abandons it as soon as
+ * its partial distance passes the current k-th best; an optional
+ * dimension order (set_dimension_order) makes that happen earlier.
  */
 class IVFIndex {
 public:
@@ -37,17 +50,26 @@ public:
     }
   };
 
-  IVFIndex(size_t dim, size_t nlist = 100, size_t nprobe = 10)
-      : dim_(dim), nlist_(nlist), nprobe_(nprobe) {
+  IVFIndex(size_t dim, size_t nlist = 100, size_t nprobe = 10,
+           ScalarType storage = ScalarType::FP32, Metric metric = Metric::L2)
+      : dim_(dim), nlist_(nlist), nprobe_(nprobe),
+        storage_(storage_kernels_for_dim(storage, dim)),
+        row_bytes_(dim * scalar_type_size(storage)), metric_(metric) {
     inverted_lists_.resize(nlist);
   }
 
   /**
-   * Train centroids using k-means.
+   * Train centroids using k-means. In cosine mode this is spherical
+   * k-means: each updated mean is scaled back to unit norm, so cells
+   * are ranked by cosine to their centroid.
    */
-  void train(const std::vector<std::vector<float>> &data, size_t n_iter = 20) {
+  void train(const std::vector<std::vector<float>> &input,
+             size_t n_iter = 20) {
+    std::vector<std::vector<float>> copy;
+    const auto &data = prepare(input, copy);
     size_t n = data.size();
-    centroids_.resize(nlist_, std::vector<float>(dim_));
+    centroids_.assign(nlist_ * dim_, 0.0f);
+    centroid_norms_.assign(nlist_, 0.0f);
 
     std::mt19937 rng(42);
     std::vector<size_t> indices(n);
@@ -55,61 +77,73 @@ public:
     std::shuffle(indices.begin(), indices.end(), rng);
 
     for (size_t c = 0; c < nlist_; ++c) {
-      centroids_[c] = data[indices[c % n]];
+      std::copy(data[indices[c % n]].begin(), data[indices[c % n]].end(),
+                centroids_.begin() + c * dim_);
     }
 
     std::vector<size_t> assignments(n);
+    std::vector<float> scratch(nlist_);
     for (size_t iter = 0; iter < n_iter; ++iter) {
       // Assign to nearest centroid
+      compute_norms_sq(centroids_.data(), nlist_, dim_,
+                       centroid_norms_.data());
       for (size_t i = 0; i < n; ++i) {
-        float best = std::numeric_limits<float>::max();
-        for (size_t c = 0; c < nlist_; ++c) {
-          float d = l2_sq(data[i], centroids_[c]);
-          if (d < best) {
-            best = d;
-            assignments[i] = c;
-          }
-        }
+        assignments[i] = nearest_centroid(data[i].data(), scratch.data());
       }
       // Update centroids
-      std::vector<std::vector<float>> sums(nlist_, std::vector<float>(dim_, 0));
+      std::vector<float> sums(nlist_ * dim_, 0.0f);
       std::vector<size_t> counts(nlist_, 0);
       for (size_t i = 0; i < n; ++i) {
         counts[assignments[i]]++;
+        float *sum = &sums[assignments[i] * dim_];
         for (size_t d = 0; d < dim_; ++d)
-          sums[assignments[i]][d] += data[i][d];
+          sum[d] += data[i][d];
       }
       for (size_t c = 0; c < nlist_; ++c) {
         if (counts[c] > 0) {
           for (size_t d = 0; d < dim_; ++d)
-            centroids_[c][d] = sums[c][d] / counts[c];
+            centroids_[c * dim_ + d] = sums[c * dim_ + d] / counts[c];
+          if (metric_ == Metric::Cosine)
+            normalize_l2(&centroids_[c * dim_], dim_);
         }
       }
     }
+    compute_norms_sq(centroids_.data(), nlist_, dim_, centroid_norms_.data());
     trained_ = true;
   }
 
   /**
    * Add vectors to the inverted lists.
+   *
+   * Each list keeps its vectors contiguously (plus their squared
+   * norms), so a probe is one batched scan instead of a pointer chase
+   * per member. Half-precision lists are encoded here once.
    */
-  void add(const std::vector<std::vector<float>> &data) {
+  void add(const std::vector<std::vector<float>> &input) {
     assert(trained_);
-    vectors_ = data;
-    for (auto &list : inverted_lists_)
-      list.clear();
+    std::vector<std::vector<float>> copy;
+    const auto &data = prepare(input, copy);
+    for (auto &list : inverted_lists_) {
+      list.ids.clear();
+      list.data.clear();
+      list.norms.clear();
+    }
 
+    std::vector<float> scratch(nlist_);
     for (size_t i = 0; i < data.size(); ++i) {
-      float best = std::numeric_limits<float>::max();
-      size_t best_c = 0;
-      for (size_t c = 0; c < nlist_; ++c) {
-        float d = l2_sq(data[i], centroids_[c]);
-        if (d < best) {
-          best = d;
-          best_c = c;
-        }
+      auto &list = inverted_lists_[nearest_centroid(data[i].data(),
+                                                    scratch.data())];
+      list.ids.push_back(i);
+      list.data.resize(list.data.size() + row_bytes_);
+      storage_.encode(data[i].data(), &list.data[list.data.size() - row_bytes_],
+                      dim_);
+      if (storage_.type == ScalarType::FP32 && metric_ == Metric::L2) {
+        float norm;
+        compute_norms_sq(data[i].data(), 1, dim_, &norm);
+        list.norms.push_back(norm);
       }
-      inverted_lists_[best_c].push_back(i);
     }
+    ntotal_ = data.size();
   }
 
   /**
@@ -117,57 +151,170 @@ public:
    *
    * 1. Find nprobe nearest centroids
    * 2. Scan vectors in those cells
-   * 3. Return top-k
+   * 3. Keep the top-k in a bounded selector (O(k) memory)
    */
-  std::vector<SearchResult> search(const std::vector<float> &query,
+  std::vector<SearchResult> search(const std::vector<float> &input,
                                    size_t k) const {
     assert(trained_);
+    std::vector<float> query(input);
+    if (!dim_order_.empty())
+      permute_dims(input.data(), dim_order_.data(), dim_, query.data());
+    if (metric_ == Metric::Cosine)
+      normalize_l2(query.data(), dim_);
 
     // Find nearest centroids
+    std::vector<float> dists(nlist_);
+    l2_sq_batch(query.data(), centroids_.data(), nlist_, dim_, dists.data(),
+                centroid_norms_.data());
     std::vector<std::pair<float, size_t>> centroid_dists(nlist_);
     for (size_t c = 0; c < nlist_; ++c) {
-      centroid_dists[c] = {l2_sq(query, centroids_[c]), c};
+      centroid_dists[c] = {dists[c], c};
     }
     std::partial_sort(centroid_dists.begin(),
                       centroid_dists.begin() + std::min(nprobe_, nlist_),
                       centroid_dists.end());
 
-    // Collect and score candidates
-    std::vector<SearchResult> candidates;
+    // Score each probed list and stream it through a bounded top-k
+    TopKSelector topk(std::min(k, ntotal_));
     for (size_t p = 0; p < std::min(nprobe_, nlist_); ++p) {
-      size_t cell = centroid_dists[p].second;
-      for (size_t idx : inverted_lists_[cell]) {
-        float d = std::sqrt(l2_sq(query, vectors_[idx]));
-        candidates.push_back({d, idx});
+      const auto &list = inverted_lists_[centroid_dists[p].second];
+      size_t len = list.ids.size();
+      if (use_bounded_scan(topk)) {
+        scan_list_bounded(query.data(), list, topk);
+        continue;
       }
+      dists.resize(std::max(dists.size(), len));
+      scan_list(query.data(), list, dists.data());
+      topk.push_block(dists.data(), len, list.ids.data());
     }
 
-    k = std::min(k, candidates.size());
-    if (k > 0) {
-      std::partial_sort(candidates.begin(), candidates.begin() + k,
-                        candidates.end());
-      candidates.resize(k);
+    std::vector<SearchResult> results;
+    for (const auto &e : topk.take_sorted()) {
+      float dist = (metric_ == Metric::L2) ? std::sqrt(e.distance) : e.distance;
+      results.push_back({dist, e.id});
     }
-    return candidates;
+    return results;
   }
 
   void set_nprobe(size_t nprobe) { nprobe_ = nprobe; }
-  size_t size() const { return vectors_.size(); }
+
+  /**
+   * Keep vector dimensions permuted by `order` (e.g. variance_order on
+   * the training set) so bounded scans abandon sooner. Distances are
+   * unchanged. Must be set before train().
+   */
+  void set_dimension_order(std::vector<uint32_t> order) {
+    assert(!trained_ && (order.empty() || order.size() == dim_));
+    dim_order_ = std::move(order);
+  }
+
+  size_t size() const { return ntotal_; }
 
 private:
-  static float l2_sq(const std::vector<float> &a, const std::vector<float> &b) {
-    float s = 0;
-    for (size_t i = 0; i < a.size(); ++i) {
-      float d = a[i] - b[i];
-      s += d * d;
+  /**
+   * One inverted list: ids and their vectors stored row-major, with
+   * ‖x‖² cached for the norm-decomposed batch kernel.
+   */
+  struct InvertedList {
+    std::vector<size_t> ids;
+    std::vector<uint8_t> data; // ids.size() × row_bytes_, storage type
+    std::vector<float> norms;  // FP32 L2 lists only
+  };
+
+  /**
+   * Below this dimension the batched, norm-decomposed scan is cheaper
+   * than per-row bounded calls: there is little left to abandon.
+   */
+  static constexpr size_t kBoundedMinDim = 256;
+
+  /**
+   * Cosine mode and dimension reordering work on copies (unit-norm,
+   * permuted); plain L2 uses the input as is.
+   */
+  const std::vector<std::vector<float>> &
+  prepare(const std::vector<std::vector<float>> &data,
+          std::vector<std::vector<float>> &copy) const {
+    if (metric_ == Metric::L2 && dim_order_.empty())
+      return data;
+    copy = data;
+    for (size_t i = 0; i < copy.size(); ++i) {
+      if (!dim_order_.empty())
+        permute_dims(data[i].data(), dim_order_.data(), dim_, copy[i].data());
+      if (metric_ == Metric::Cosine)
+        normalize_l2(copy[i].data(), dim_);
+    }
+    return copy;
+  }
+
+  bool use_bounded_scan(const TopKSelector &topk) const {
+    return metric_ == Metric::L2 && storage_.type == ScalarType::FP32 &&
+           dim_ >= kBoundedMinDim && topk.size() == topk.capacity() &&
+           topk.threshold() < std::numeric_limits<float>::infinity();
+  }
+
+  /**
+   * Score a list row by row against the live top-k threshold, so each
+   * member stops reading dimensions once it can no longer qualify.
+   */
+  void scan_list_bounded(const float *query, const InvertedList &list,
+                         TopKSelector &topk) const {
+    for (size_t j = 0; j < list.ids.size(); ++j) {
+      float bound = topk.threshold();
+      float d = storage_.l2_sq_bounded(query, &list.data[j * row_bytes_],
+                                       dim_, bound);
+      if (d < bound)
+        topk.push(d, list.ids[j]);
     }
-    return s;
+  }
+
+  /**
+   * Distance from query to every member of a list: squared L2, or
+   * 1 − q·x in cosine mode.
+   */
+  void scan_list(const float *query, const InvertedList &list,
+                 float *out) const {
+    size_t len = list.ids.size();
+    if (metric_ == Metric::Cosine) {
+      if (storage_.type == ScalarType::FP32) {
+        inner_product_batch(query,
+                            reinterpret_cast<const float *>(list.data.data()),
+                            len, dim_, out);
+      } else {
+        for (size_t j = 0; j < len; ++j)
+          out[j] = storage_.inner_product(query, &list.data[j * row_bytes_],
+                                          dim_);
+      }
+      for (size_t j = 0; j < len; ++j)
+        out[j] = 1.0f - out[j];
+      return;
+    }
+    if (storage_.type == ScalarType::FP32) {
+      l2_sq_batch(query, reinterpret_cast<const float *>(list.data.data()),
+                  len, dim_, out, list.norms.data());
+      return;
+    }
+    // Half-precision rows are widened on the fly, one row per call.
+    for (size_t j = 0; j < len; ++j)
+      out[j] = storage_.l2_sq(query, &list.data[j * row_bytes_], dim_);
+  }
+
+  /** Index of the closest centroid; scratch must hold nlist floats. */
+  size_t nearest_centroid(const float *vec, float *scratch) const {
+    l2_sq_batch(vec, centroids_.data(), nlist_, dim_, scratch,
+                centroid_norms_.data());
+    return static_cast<size_t>(
+        std::min_element(scratch, scratch + nlist_) - scratch);
   }
 
   size_t dim_, nlist_, nprobe_;
+  StorageKernels storage_; // runtime-dispatched kernels for the element type
+  size_t row_bytes_;
+  Metric metric_;
+  std::vector<uint32_t> dim_order_; // storage order of dimensions, or empty
+  size_t ntotal_ = 0;
   bool trained_ = false;
-  std::vector<std::vector<float>> centroids_;
-  std::vector<std::vector<size_t>> inverted_lists_;
-  std::vector<std::vector<float>> vectors_;
+  std::vector<float> centroids_;      // nlist × dim, row-major
+  std::vector<float> centroid_norms_; // ‖c‖² per centroid
+  std::vector<InvertedList> inverted_lists_;
 };
 // --8<-- [end:ivf_index]
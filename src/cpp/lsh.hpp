@@ -4,15 +4,18 @@
  * Implements random-hyperplane LSH (cosine similarity) and
  * p-stable distribution LSH (Euclidean distance).
  *
- * Compile: g++ -std=c++17 -O3 -o lsh lsh.cpp
+ * Compile: g++ -std=c++17 -O3 -c lsh.hpp   (link with distances.cpp)
  */
 
 #pragma once
 
+#include "distances.hpp"
+
 #include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <numeric>
 #include <random>
@@ -58,12 +61,20 @@ struct HashSignatureHash {
  * Parameters:
  *   dim         — dimensionality of input vectors
  *   num_tables  — number of hash tables L (more tables → higher recall)
- *   num_hashes  — hash bits per table k (more bits → higher precision)
+ *   num_hashes  — hash bits per table k (more bits → higher precision),
+ *                 at most 64
+ *
+ * Each table's signature is packed into one uint64_t word (bit h =
+ * sign of hyperplane h), so buckets are keyed by an integer and the
+ * L words of a vector form a binary code that the popcount kernels
+ * (hamming, BinaryFlatIndex::add_codes) can consume directly.
  */
 class RandomHyperplaneLSH {
 public:
   RandomHyperplaneLSH(size_t dim, size_t num_tables = 10, size_t num_hashes = 8)
-      : dim_(dim), num_tables_(num_tables), num_hashes_(num_hashes) {
+      : dim_(dim), num_tables_(num_tables), num_hashes_(num_hashes),
+        kernels_(distance_kernels_for_dim(dim)) {
+    assert(num_hashes >= 1 && num_hashes <= 64);
     std::mt19937 rng(42);
     std::normal_distribution<float> normal(0.0f, 1.0f);
 
@@ -87,27 +98,55 @@ public:
     for (auto &table : tables_)
       table.clear();
 
+    codes_.resize(vectors.size() * num_tables_);
+    inv_norms_.resize(vectors.size());
     for (size_t i = 0; i < vectors.size(); ++i) {
+      inv_norms_[i] = inverse_norm(vectors[i].data());
+      uint64_t *code = &codes_[i * num_tables_];
+      encode(vectors[i].data(), code);
       for (size_t t = 0; t < num_tables_; ++t) {
-        auto sig = hash(vectors[i], t);
-        tables_[t][sig].push_back(i);
+        tables_[t][code[t]].push_back(i);
+      }
+    }
+  }
+
+  /**
+   * Packed signature of a vector: one word per table (num_tables
+   * words in total), bit h of word t = sign(r_{t,h} · x).
+   */
+  void encode(const float *vec, uint64_t *out) const {
+    std::vector<float> dots(num_hashes_);
+    for (size_t t = 0; t < num_tables_; ++t) {
+      // All hyperplanes of a table are one row-major block.
+      inner_product_batch(vec, hyperplanes_[t].data(), num_hashes_, dim_,
+                          dots.data());
+      uint64_t word = 0;
+      for (size_t h = 0; h < num_hashes_; ++h) {
+        if (dots[h] > 0.0f)
+          word |= uint64_t{1} << h;
       }
+      out[t] = word;
     }
   }
 
+  /** Signature of an indexed vector (num_tables words). */
+  const uint64_t *code(size_t id) const { return &codes_[id * num_tables_]; }
+
   /**
    * Query for k approximate nearest neighbors.
    *
    * 1. Hash query into each table
    * 2. Collect all candidate IDs from matching buckets
-   * 3. Re-rank candidates by exact cosine similarity
+   * 3. Re-rank candidates by exact cosine similarity; norms are
+   *    cached at build, so each candidate costs one inner product
    */
   std::vector<size_t> query(const std::vector<float> &q, size_t k) const {
     std::unordered_set<size_t> candidates;
 
+    std::vector<uint64_t> sig(num_tables_);
+    encode(q.data(), sig.data());
     for (size_t t = 0; t < num_tables_; ++t) {
-      auto sig = hash(q, t);
-      auto it = tables_[t].find(sig);
+      auto it = tables_[t].find(sig[t]);
       if (it != tables_[t].end()) {
         for (size_t idx : it->second) {
           candidates.insert(idx);
@@ -116,10 +155,11 @@ public:
     }
 
     // Re-rank by cosine similarity
+    float q_inv = inverse_norm(q.data());
     std::vector<std::pair<float, size_t>> scored;
     scored.reserve(candidates.size());
     for (size_t idx : candidates) {
-      float sim = cosine_sim(q, vectors_[idx]);
+      float sim = cosine_sim(q, q_inv, idx);
       scored.push_back({-sim, idx}); // negate for ascending sort
     }
     std::sort(scored.begin(), scored.end());
@@ -134,37 +174,24 @@ public:
   size_t num_vectors() const { return vectors_.size(); }
 
 private:
-  HashSignature hash(const std::vector<float> &vec, size_t table_idx) const {
-    HashSignature sig;
-    sig.bits.resize(num_hashes_);
-    for (size_t h = 0; h < num_hashes_; ++h) {
-      float dot = 0.0f;
-      const float *plane = &hyperplanes_[table_idx][h * dim_];
-      for (size_t d = 0; d < dim_; ++d) {
-        dot += plane[d] * vec[d];
-      }
-      sig.bits[h] = (dot > 0.0f) ? 1 : 0;
-    }
-    return sig;
+  float inverse_norm(const float *x) const {
+    float norm = std::sqrt(kernels_.inner_product(x, x, dim_));
+    return norm > 0.0f ? 1.0f / norm : 0.0f;
   }
 
-  static float cosine_sim(const std::vector<float> &a,
-                          const std::vector<float> &b) {
-    float dot = 0, na = 0, nb = 0;
-    for (size_t i = 0; i < a.size(); ++i) {
-      dot += a[i] * b[i];
-      na += a[i] * a[i];
-      nb += b[i] * b[i];
-    }
-    float denom = std::sqrt(na) * std::sqrt(nb);
-    return (denom > 1e-10f) ? dot / denom : 0.0f;
+  /** cos(q, x_idx) from the cached inverse norms: one dot product. */
+  float cosine_sim(const std::vector<float> &q, float q_inv,
+                   size_t idx) const {
+    return kernels_.inner_product(q.data(), vectors_[idx].data(), dim_) *
+           q_inv * inv_norms_[idx];
   }
 
   size_t dim_, num_tables_, num_hashes_;
+  DistanceKernels kernels_; // runtime-dispatched SIMD kernels
   std::vector<std::vector<float>> hyperplanes_; // [table][hash*dim + d]
-  std::vector<
-      std::unordered_map<HashSignature, std::vector<size_t>, HashSignatureHash>>
-      tables_;
+  std::vector<std::unordered_map<uint64_t, std::vector<size_t>>> tables_;
+  std::vector<uint64_t> codes_; // n × num_tables packed signatures
+  std::vector<float> inv_norms_; // 1 / ‖x‖ per vector (0 for zero vectors)
   std::vector<std::vector<float>> vectors_;
 };
 // --8<-- [end:random_hyperplane_lsh]
@@ -184,7 +211,7 @@ public:
   EuclideanLSH(size_t dim, size_t num_tables = 10, size_t num_hashes = 8,
                float bucket_width = 4.0f)
       : dim_(dim), num_tables_(num_tables), num_hashes_(num_hashes),
-        w_(bucket_width) {
+        w_(bucket_width), kernels_(distance_kernels_for_dim(dim)) {
     std::mt19937 rng(123);
     std::normal_distribution<float> normal(0.0f, 1.0f);
     std::uniform_real_distribution<float> uniform(0.0f, bucket_width);
@@ -244,27 +271,22 @@ private:
     HashSignature sig;
     sig.bits.resize(num_hashes_);
     for (size_t h = 0; h < num_hashes_; ++h) {
-      float proj = offsets_[table_idx][h];
       const float *a = &projections_[table_idx][h * dim_];
-      for (size_t d = 0; d < dim_; ++d)
-        proj += a[d] * vec[d];
+      float proj = offsets_[table_idx][h] +
+                   kernels_.inner_product(a, vec.data(), dim_);
       sig.bits[h] = static_cast<int>(std::floor(proj / w_));
     }
     return sig;
   }
 
-  static float l2_squared(const std::vector<float> &a,
-                          const std::vector<float> &b) {
-    float sum = 0;
-    for (size_t i = 0; i < a.size(); ++i) {
-      float d = a[i] - b[i];
-      sum += d * d;
-    }
-    return sum;
+  float l2_squared(const std::vector<float> &a,
+                   const std::vector<float> &b) const {
+    return kernels_.l2_sq(a.data(), b.data(), dim_);
   }
 
   size_t dim_, num_tables_, num_hashes_;
   float w_;
+  DistanceKernels kernels_; // runtime-dispatched SIMD kernels
   std::vector<std::vector<float>> projections_;
   std::vector<std::vector<float>> offsets_;
   std::vector<
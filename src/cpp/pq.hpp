@@ -4,11 +4,17 @@
  * Decomposes d-dimensional vectors into M subspaces and quantizes
  * each independently using k-means clustering.
  *
- * Compile: g++ -std=c++17 -O3 -o pq pq.hpp
+ * Also provides Scalar Quantization (SQ8/SQ4), which quantizes every
+ * dimension independently to 8 or 4 bits, and a flat SQ index.
+ *
+ * Compile: g++ -std=c++17 -O3 -c pq.hpp   (link with distances.cpp)
  */
 
 #pragma once
 
+#include "distances.hpp"
+#include "topk.hpp"
+
 #include <algorithm>
 #include <cassert>
 #include <cmath>
@@ -38,8 +44,10 @@
 class ProductQuantizer {
 public:
   ProductQuantizer(size_t dim, size_t M = 8, size_t K = 256)
-      : dim_(dim), M_(M), K_(K), ds_(dim / M) {
+      : dim_(dim), M_(M), K_(K), ds_(dim / M),
+        l2_sq_fn_(distance_kernels_for_dim(dim / M).l2_sq) {
     assert(dim % M == 0 && "dim must be divisible by M");
+    assert(K <= 256 && "codes are one byte per subspace");
     codebooks_.resize(
         M, std::vector<std::vector<float>>(K, std::vector<float>(ds_)));
   }
@@ -105,47 +113,53 @@ public:
     trained_ = true;
   }
 
+  /** Bytes per encoded vector (one code per subspace). */
+  size_t code_size() const { return M_; }
+  size_t num_centroids() const { return K_; }
+
+  /** Encode one vector into code_size() bytes. */
+  void encode(const float *x, uint8_t *code) const {
+    assert(trained_);
+    for (size_t m = 0; m < M_; ++m) {
+      float best_dist = std::numeric_limits<float>::max();
+      uint8_t best_k = 0;
+      for (size_t k = 0; k < K_; ++k) {
+        float d = l2_sq_fn_(x + m * ds_, codebooks_[m][k].data(), ds_);
+        if (d < best_dist) {
+          best_dist = d;
+          best_k = static_cast<uint8_t>(k);
+        }
+      }
+      code[m] = best_k;
+    }
+  }
+
   /**
    * Encode vectors to PQ codes (M uint8 per vector).
    */
   std::vector<std::vector<uint8_t>>
   encode(const std::vector<std::vector<float>> &data) const {
-    assert(trained_);
-    size_t n = data.size();
-    std::vector<std::vector<uint8_t>> codes(n, std::vector<uint8_t>(M_));
-
-    for (size_t i = 0; i < n; ++i) {
-      for (size_t m = 0; m < M_; ++m) {
-        float best_dist = std::numeric_limits<float>::max();
-        uint8_t best_k = 0;
-        for (size_t k = 0; k < K_; ++k) {
-          float d = 0;
-          for (size_t dd = 0; dd < ds_; ++dd) {
-            float diff = data[i][m * ds_ + dd] - codebooks_[m][k][dd];
-            d += diff * diff;
-          }
-          if (d < best_dist) {
-            best_dist = d;
-            best_k = static_cast<uint8_t>(k);
-          }
-        }
-        codes[i][m] = best_k;
-      }
-    }
+    std::vector<std::vector<uint8_t>> codes(data.size(),
+                                            std::vector<uint8_t>(M_));
+    for (size_t i = 0; i < data.size(); ++i)
+      encode(data[i].data(), codes[i].data());
     return codes;
   }
 
+  /** Decode one code back to an approximate vector. */
+  void decode(const uint8_t *code, float *out) const {
+    assert(trained_);
+    for (size_t m = 0; m < M_; ++m)
+      std::copy(codebooks_[m][code[m]].begin(), codebooks_[m][code[m]].end(),
+                out + m * ds_);
+  }
+
   /**
    * Decode PQ codes back to approximate vectors.
    */
   std::vector<float> decode(const std::vector<uint8_t> &code) const {
-    assert(trained_);
     std::vector<float> vec(dim_);
-    for (size_t m = 0; m < M_; ++m) {
-      for (size_t d = 0; d < ds_; ++d) {
-        vec[m * ds_ + d] = codebooks_[m][code[m]][d];
-      }
-    }
+    decode(code.data(), vec.data());
     return vec;
   }
   // --8<-- [end:product_quantizer]
@@ -174,49 +188,342 @@ public:
     assert(trained_);
     size_t n = codes.size();
 
-    // Precompute distance table: M × K
-    std::vector<std::vector<float>> dist_table(M_, std::vector<float>(K_));
-    for (size_t m = 0; m < M_; ++m) {
-      for (size_t kk = 0; kk < K_; ++kk) {
-        float d = 0;
-        for (size_t dd = 0; dd < ds_; ++dd) {
-          float diff = query[m * ds_ + dd] - codebooks_[m][kk][dd];
-          d += diff * diff;
-        }
-        dist_table[m][kk] = d;
-      }
-    }
+    // Precompute distance table: M × K (row-major)
+    std::vector<float> dist_table(M_ * K_);
+    compute_distance_table(query.data(), dist_table.data());
 
-    // Compute approximate distances via table lookups
-    std::vector<SearchResult> results(n);
+    // Approximate distances via table lookups, streamed into a
+    // bounded top-k. The partial sum only grows, so a code is
+    // abandoned as soon as it reaches the current k-th best.
+    TopKSelector topk(std::min(k, n));
     for (size_t i = 0; i < n; ++i) {
-      float d = 0;
-      for (size_t m = 0; m < M_; ++m) {
-        d += dist_table[m][codes[i][m]];
-      }
-      results[i] = {std::sqrt(d), i};
+      float threshold = topk.threshold();
+      float d = adc_l2_sq(dist_table.data(), codes[i].data(), threshold);
+      if (d < threshold)
+        topk.push(d, i);
     }
 
-    // Partial sort for top-k
-    k = std::min(k, n);
-    std::partial_sort(results.begin(), results.begin() + k, results.end());
-    results.resize(k);
+    std::vector<SearchResult> results;
+    for (const auto &e : topk.take_sorted())
+      results.push_back({std::sqrt(e.distance), e.id});
     return results;
   }
+
+  /** table[m·K + k] = ‖q^(m) − c_k^(m)‖² for a query; table holds M × K. */
+  void compute_distance_table(const float *query, float *table) const {
+    assert(trained_);
+    for (size_t m = 0; m < M_; ++m) {
+      for (size_t k = 0; k < K_; ++k)
+        table[m * K_ + k] =
+            l2_sq_fn_(query + m * ds_, codebooks_[m][k].data(), ds_);
+    }
+  }
+
+  /**
+   * ADC distance of one code: Σ_m table[m·K + code_m]. Summing stops
+   * once the partial sum reaches `bound`, which is then returned (or
+   * a larger value); pass +inf for the exact sum.
+   */
+  float adc_l2_sq(const float *table, const uint8_t *code,
+                  float bound = std::numeric_limits<float>::infinity()) const {
+    float d = 0;
+    size_t m = 0;
+    for (; m + 4 <= M_ && d < bound; m += 4) {
+      d += table[m * K_ + code[m]] + table[(m + 1) * K_ + code[m + 1]] +
+           table[(m + 2) * K_ + code[m + 2]] +
+           table[(m + 3) * K_ + code[m + 3]];
+    }
+    if (!(d < bound))
+      return d;
+    for (; m < M_; ++m)
+      d += table[m * K_ + code[m]];
+    return d;
+  }
   // --8<-- [end:adc_search]
 
 private:
-  static float l2_sq(const std::vector<float> &a, const std::vector<float> &b) {
-    float s = 0;
-    for (size_t i = 0; i < a.size(); ++i) {
-      float d = a[i] - b[i];
-      s += d * d;
-    }
-    return s;
+  float l2_sq(const std::vector<float> &a, const std::vector<float> &b) const {
+    return l2_sq_fn_(a.data(), b.data(), a.size());
   }
 
   size_t dim_, M_, K_, ds_;
+  DistanceFn l2_sq_fn_; // runtime-dispatched SIMD kernel
   bool trained_ = false;
   // codebooks_[m][k][d] = centroid value
   std::vector<std::vector<std::vector<float>>> codebooks_;
 };
+
+// --8<-- [start:scalar_quantizer]
+/**
+ * Scalar Quantizer (SQ8 / SQ4).
+ *
+ * Each dimension j gets its own range [lo_j, hi_j] and is mapped
+ * uniformly onto 2^bits levels:
+ *
+ *   c_j = round((x_j − lo_j) / s_j),   x̃_j = lo_j + s_j · c_j
+ *
+ * Compression: 4 bytes → 1 byte (SQ8) or ½ byte (SQ4) per dimension.
+ *
+ * Distances use integer SIMD. Expanding the reconstruction,
+ *
+ *   ‖q − x̃‖² = ‖q‖² − 2 q·lo − 2 Σ_j (q_j s_j) c_j + ‖x̃‖²
+ *
+ * only the middle sum depends on both sides. The query weights
+ * q_j s_j are quantized once per query to int8 (scale α), so each
+ * code costs one u8×s8 dot product plus the cached ‖x̃‖².
+ */
+class ScalarQuantizer {
+public:
+  ScalarQuantizer(size_t dim, size_t bits = 8)
+      : dim_(dim), bits_(bits), kernels_(distance_kernels_for_dim(dim)) {
+    assert((bits == 8 || bits == 4) && "SQ supports 8 or 4 bits");
+  }
+
+  /** Bytes per encoded vector. */
+  size_t code_size() const { return bits_ == 8 ? dim_ : (dim_ + 1) / 2; }
+  size_t bits() const { return bits_; }
+
+  /**
+   * Learn per-dimension ranges.
+   *
+   * clip = 0 uses the exact min/max. clip > 0 uses the clip and
+   * 1 − clip quantiles instead, so a few outliers do not stretch the
+   * range and waste levels for everyone else.
+   */
+  void train(const std::vector<std::vector<float>> &data, float clip = 0.0f) {
+    size_t n = data.size();
+    assert(n > 0);
+    lo_.assign(dim_, 0.0f);
+    scale_.assign(dim_, 0.0f);
+    float levels = static_cast<float>((1u << bits_) - 1);
+
+    std::vector<float> column(n);
+    for (size_t j = 0; j < dim_; ++j) {
+      for (size_t i = 0; i < n; ++i)
+        column[i] = data[i][j];
+      float lo, hi;
+      if (clip > 0.0f) {
+        size_t a = static_cast<size_t>(clip * (n - 1));
+        size_t b = (n - 1) - a;
+        std::nth_element(column.begin(), column.begin() + a, column.end());
+        lo = column[a];
+        std::nth_element(column.begin(), column.begin() + b, column.end());
+        hi = column[b];
+      } else {
+        auto mm = std::minmax_element(column.begin(), column.end());
+        lo = *mm.first;
+        hi = *mm.second;
+      }
+      lo_[j] = lo;
+      scale_[j] = (hi - lo) / levels; // 0 for a constant dimension
+    }
+    trained_ = true;
+  }
+
+  /** Encode one vector into code_size() bytes. */
+  void encode(const float *x, uint8_t *code) const {
+    assert(trained_);
+    int levels = (1 << bits_) - 1;
+    auto quantize = [&](size_t j) -> uint8_t {
+      if (scale_[j] <= 0.0f)
+        return 0;
+      float v = std::round((x[j] - lo_[j]) / scale_[j]);
+      return static_cast<uint8_t>(
+          std::min(std::max(v, 0.0f), static_cast<float>(levels)));
+    };
+    if (bits_ == 8) {
+      for (size_t j = 0; j < dim_; ++j)
+        code[j] = quantize(j);
+    } else {
+      // Two dimensions per byte: even j in the low nibble.
+      for (size_t b = 0; b < code_size(); ++b) {
+        uint8_t low = quantize(2 * b);
+        uint8_t high = (2 * b + 1 < dim_) ? quantize(2 * b + 1) : 0;
+        code[b] = static_cast<uint8_t>(low | (high << 4));
+      }
+    }
+  }
+
+  std::vector<std::vector<uint8_t>>
+  encode(const std::vector<std::vector<float>> &data) const {
+    std::vector<std::vector<uint8_t>> codes(data.size(),
+                                            std::vector<uint8_t>(code_size()));
+    for (size_t i = 0; i < data.size(); ++i)
+      encode(data[i].data(), codes[i].data());
+    return codes;
+  }
+
+  /** Decode one code back to an approximate vector. */
+  void decode(const uint8_t *code, float *out) const {
+    assert(trained_);
+    for (size_t j = 0; j < dim_; ++j)
+      out[j] = lo_[j] + scale_[j] * code_at(code, j);
+  }
+
+  std::vector<float> decode(const std::vector<uint8_t> &code) const {
+    std::vector<float> vec(dim_);
+    decode(code.data(), vec.data());
+    return vec;
+  }
+
+  /** ‖x̃‖² of a code, cached per vector by the flat index. */
+  float code_norm_sq(const uint8_t *code) const {
+    std::vector<float> x(dim_);
+    decode(code, x.data());
+    return kernels_.inner_product(x.data(), x.data(), dim_);
+  }
+
+  /** Per-query state for the integer distance kernels. */
+  struct QueryTable {
+    std::vector<int8_t> weights; // SQ8: dim; SQ4: low nibbles then high
+    float alpha = 0.0f;          // q_j s_j ≈ alpha · weights_j
+    float bias = 0.0f;           // ‖q‖² − 2 q·lo
+  };
+
+  QueryTable prepare_query(const float *query) const {
+    assert(trained_);
+    QueryTable t;
+    std::vector<float> w(dim_);
+    float max_abs = 0.0f;
+    for (size_t j = 0; j < dim_; ++j) {
+      w[j] = query[j] * scale_[j];
+      max_abs = std::max(max_abs, std::abs(w[j]));
+    }
+    // SQ8 keeps |weight| ≤ 63 so pmaddubsw pairs (255·63·2) fit int16.
+    float wmax = (bits_ == 8) ? 63.0f : 127.0f;
+    t.alpha = (max_abs > 0.0f) ? max_abs / wmax : 1.0f;
+
+    auto q8 = [&](size_t j) -> int8_t {
+      return (j < dim_) ? static_cast<int8_t>(std::lround(w[j] / t.alpha))
+                        : 0;
+    };
+    if (bits_ == 8) {
+      t.weights.resize(dim_);
+      for (size_t j = 0; j < dim_; ++j)
+        t.weights[j] = q8(j);
+    } else {
+      size_t cs = code_size();
+      t.weights.resize(2 * cs);
+      for (size_t b = 0; b < cs; ++b) {
+        t.weights[b] = q8(2 * b);
+        t.weights[cs + b] = q8(2 * b + 1);
+      }
+    }
+    t.bias = kernels_.inner_product(query, query, dim_) -
+             2.0f * kernels_.inner_product(query, lo_.data(), dim_);
+    return t;
+  }
+
+  /** Approximate ‖q − x̃‖² from a prepared query and a code. */
+  float l2_sq(const QueryTable &t, const uint8_t *code,
+              float code_norm_sq) const {
+    int32_t dot =
+        (bits_ == 8)
+            ? kernels_.dot_u8s8(code, t.weights.data(), dim_)
+            : kernels_.dot_u4s8(code, t.weights.data(),
+                                t.weights.data() + code_size(), code_size());
+    return std::max(0.0f, t.bias - 2.0f * t.alpha * static_cast<float>(dot) +
+                              code_norm_sq);
+  }
+
+private:
+  uint8_t code_at(const uint8_t *code, size_t j) const {
+    if (bits_ == 8)
+      return code[j];
+    uint8_t byte = code[j / 2];
+    return (j % 2 == 0) ? (byte & 0x0F) : (byte >> 4);
+  }
+
+  size_t dim_, bits_;
+  DistanceKernels kernels_; // runtime-dispatched SIMD kernels
+  bool trained_ = false;
+  std::vector<float> lo_;    // per-dimension range start
+  std::vector<float> scale_; // per-dimension step
+};
+// --8<-- [end:scalar_quantizer]
+
+// --8<-- [start:sq_flat_index]
+/**
+ * Flat index over scalar-quantized codes.
+ *
+ * Codes are stored contiguously and scanned with the integer kernels.
+ * With rerank_factor > 0, the original vectors are kept as well: the
+ * scan selects k · rerank_factor candidates, which are re-scored with
+ * exact float32 L2 before the final top-k.
+ */
+class SQFlatIndex {
+public:
+  struct SearchResult {
+    float distance;
+    size_t id;
+    bool operator<(const SearchResult &o) const {
+      return distance < o.distance;
+    }
+  };
+
+  SQFlatIndex(size_t dim, size_t bits = 8, size_t rerank_factor = 0)
+      : dim_(dim), sq_(dim, bits), rerank_factor_(rerank_factor),
+        l2_sq_fn_(distance_kernels_for_dim(dim).l2_sq) {}
+
+  void train(const std::vector<std::vector<float>> &data, float clip = 0.0f) {
+    sq_.train(data, clip);
+  }
+
+  void add(const std::vector<std::vector<float>> &data) {
+    size_t cs = sq_.code_size();
+    for (const auto &v : data) {
+      codes_.resize(codes_.size() + cs);
+      uint8_t *code = &codes_[codes_.size() - cs];
+      sq_.encode(v.data(), code);
+      code_norms_.push_back(sq_.code_norm_sq(code));
+      if (rerank_factor_ > 0)
+        raw_.insert(raw_.end(), v.begin(), v.end());
+    }
+    ntotal_ += data.size();
+  }
+
+  std::vector<SearchResult> search(const std::vector<float> &query,
+                                   size_t k) const {
+    k = std::min(k, ntotal_);
+    size_t k_scan = (rerank_factor_ > 0) ? std::min(ntotal_, k * rerank_factor_)
+                                         : k;
+    auto table = sq_.prepare_query(query.data());
+    size_t cs = sq_.code_size();
+
+    TopKSelector topk(k_scan);
+    for (size_t i = 0; i < ntotal_; ++i) {
+      topk.push(sq_.l2_sq(table, &codes_[i * cs], code_norms_[i]), i);
+    }
+    auto candidates = topk.take_sorted();
+
+    if (rerank_factor_ > 0) {
+      // Exact re-scoring of the short list with the float32 vectors.
+      topk.reset(k);
+      for (const auto &c : candidates) {
+        topk.push(l2_sq_fn_(query.data(), &raw_[c.id * dim_], dim_), c.id);
+      }
+      candidates = topk.take_sorted();
+    }
+
+    std::vector<SearchResult> results;
+    results.reserve(k);
+    for (size_t i = 0; i < std::min(k, candidates.size()); ++i) {
+      results.push_back({std::sqrt(candidates[i].distance), candidates[i].id});
+    }
+    return results;
+  }
+
+  size_t size() const { return ntotal_; }
+  const ScalarQuantizer &quantizer() const { return sq_; }
+
+private:
+  size_t dim_;
+  ScalarQuantizer sq_;
+  size_t rerank_factor_;
+  DistanceFn l2_sq_fn_; // runtime-dispatched SIMD kernel
+  size_t ntotal_ = 0;
+  std::vector<uint8_t> codes_;    // ntotal × code_size
+  std::vector<float> code_norms_; // ‖x̃‖² per code
+  std::vector<float> raw_;        // ntotal × dim, only when reranking
+};
+// --8<-- [end:sq_flat_index]
@@ -0,0 +1,207 @@
+/**
+ * Bounded top-k selection for nearest-neighbor search.
+ *
+ * Keeps the k smallest distances seen so far in a max-heap, so the
+ * worst kept candidate is always at the root and can be used as a
+ * pruning threshold. Memory is O(k) regardless of how many candidates
+ * are streamed through it.
+ *
+ * TopKSelector builds on it for streaming scans: a heap for small k,
+ * a threshold-filtered buffer for large k.
+ */
+
+#pragma once
+
+#include "distances.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// --8<-- [start:topk_heap]
+class TopKHeap {
+public:
+  struct Entry {
+    float distance;
+    size_t id;
+    bool operator<(const Entry &o) const { return distance < o.distance; }
+  };
+
+  explicit TopKHeap(size_t k = 0) : k_(k) { heap_.reserve(k); }
+
+  /** Worst distance that still makes it into the heap (+inf until full). */
+  float threshold() const {
+    if (k_ == 0)
+      return -std::numeric_limits<float>::infinity();
+    return (heap_.size() < k_) ? std::numeric_limits<float>::infinity()
+                               : heap_.front().distance;
+  }
+
+  /** Offer a candidate; returns true if it was kept. */
+  bool push(float distance, size_t id) {
+    if (heap_.size() < k_) {
+      heap_.push_back({distance, id});
+      std::push_heap(heap_.begin(), heap_.end());
+      return true;
+    }
+    if (k_ == 0 || !(distance < heap_.front().distance))
+      return false;
+    // Replace the current worst in place.
+    std::pop_heap(heap_.begin(), heap_.end());
+    heap_.back() = {distance, id};
+    std::push_heap(heap_.begin(), heap_.end());
+    return true;
+  }
+
+  /** Merge another heap's contents into this one. */
+  void merge(const TopKHeap &other) {
+    for (const auto &e : other.heap_)
+      push(e.distance, e.id);
+  }
+
+  /** Kept entries, in heap order. */
+  const std::vector<Entry> &entries() const { return heap_; }
+
+  /** Kept entries in ascending distance order; empties the heap. */
+  std::vector<Entry> take_sorted() {
+    std::sort_heap(heap_.begin(), heap_.end());
+    std::vector<Entry> out;
+    out.swap(heap_);
+    return out;
+  }
+
+  void reset(size_t k) {
+    k_ = k;
+    heap_.clear();
+    heap_.reserve(k);
+  }
+
+  size_t size() const { return heap_.size(); }
+  size_t capacity() const { return k_; }
+
+private:
+  size_t k_;
+  std::vector<Entry> heap_;
+};
+// --8<-- [end:topk_heap]
+
+// --8<-- [start:topk_selector]
+/**
+ * Streaming top-k selector used by every exhaustive scan.
+ *
+ *   k ≤ kHeapMaxK — a bounded max-heap (TopKHeap)
+ *   k > kHeapMaxK — an unordered buffer of up to 2k candidates below
+ *                   the threshold; when it fills, nth_element keeps
+ *                   the best k and the k-th distance becomes the new
+ *                   threshold (amortized O(1) per accepted candidate
+ *                   instead of O(log k) heap moves)
+ *
+ * State is O(k) either way. push_block() compares a whole block of
+ * distances against threshold() with the SIMD filter kernel first, so
+ * the common case (worse than the current k-th best) never touches
+ * the selector. Callers can also read threshold() to abandon a
+ * distance computation early.
+ */
+class TopKSelector {
+public:
+  using Entry = TopKHeap::Entry;
+  static constexpr size_t kHeapMaxK = 64;
+
+  explicit TopKSelector(size_t k = 0)
+      : filter_(distance_kernels().filter_below) {
+    reset(k);
+  }
+
+  /** Distances at or above this cannot enter the top-k. */
+  float threshold() const {
+    return use_heap_ ? heap_.threshold() : threshold_;
+  }
+
+  /** Offer a candidate; returns true if it was kept (for now). */
+  bool push(float distance, size_t id) {
+    if (use_heap_)
+      return heap_.push(distance, id);
+    if (!(distance < threshold_))
+      return false;
+    buffer_.push_back({distance, id});
+    if (buffer_.size() >= 2 * k_)
+      shrink();
+    return true;
+  }
+
+  /** Offer dists[0..n) with ids first_id + i. */
+  void push_block(const float *dists, size_t n, size_t first_id) {
+    size_t m = filter(dists, n);
+    for (size_t j = 0; j < m; ++j)
+      push(dists[survivors_[j]], first_id + survivors_[j]);
+  }
+
+  /** Offer dists[0..n) with ids ids[i]. */
+  void push_block(const float *dists, size_t n, const size_t *ids) {
+    size_t m = filter(dists, n);
+    for (size_t j = 0; j < m; ++j)
+      push(dists[survivors_[j]], ids[survivors_[j]]);
+  }
+
+  void merge(const TopKSelector &other) {
+    for (const auto &e : other.use_heap_ ? other.heap_.entries()
+                                         : other.buffer_)
+      push(e.distance, e.id);
+  }
+
+  /** The (up to) k best entries in ascending order; empties it. */
+  std::vector<Entry> take_sorted() {
+    if (use_heap_)
+      return heap_.take_sorted();
+    if (buffer_.size() > k_)
+      shrink();
+    std::sort(buffer_.begin(), buffer_.end());
+    std::vector<Entry> out;
+    out.swap(buffer_);
+    threshold_ = std::numeric_limits<float>::infinity();
+    return out;
+  }
+
+  void reset(size_t k) {
+    k_ = k;
+    use_heap_ = k <= kHeapMaxK;
+    heap_.reset(use_heap_ ? k : 0);
+    buffer_.clear();
+    if (!use_heap_)
+      buffer_.reserve(2 * k);
+    threshold_ = (k == 0) ? -std::numeric_limits<float>::infinity()
+                          : std::numeric_limits<float>::infinity();
+  }
+
+  size_t size() const {
+    return use_heap_ ? heap_.size() : std::min(buffer_.size(), k_);
+  }
+  size_t capacity() const { return k_; }
+
+private:
+  size_t filter(const float *dists, size_t n) {
+    if (survivors_.size() < n)
+      survivors_.resize(n);
+    return filter_(dists, n, threshold(), survivors_.data());
+  }
+
+  /** Keep the best k of the buffer and tighten the threshold. */
+  void shrink() {
+    std::nth_element(buffer_.begin(), buffer_.begin() + (k_ - 1),
+                     buffer_.end());
+    threshold_ = buffer_[k_ - 1].distance;
+    buffer_.resize(k_);
+  }
+
+  size_t k_ = 0;
+  bool use_heap_ = true;
+  TopKHeap heap_;
+  std::vector<Entry> buffer_;       // large-k mode: < 2k candidates
+  float threshold_ = 0.0f;          // large-k mode: k-th best so far
+  std::vector<uint32_t> survivors_; // filter output scratch
+  FilterFn filter_;                 // runtime-dispatched SIMD kernel
+};
+// --8<-- [end:topk_selector]
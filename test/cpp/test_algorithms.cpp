@@ -3,17 +3,24 @@
  *
  * Compile & run:
  *   g++ -std=c++17 -O2 -I../../src/cpp -o test_algorithms test_algorithms.cpp
- * && ./test_algorithms
+ *   ../../src/cpp/distances.cpp && ./test_algorithms
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <random>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "../../src/cpp/binary.hpp"
 #include "../../src/cpp/hnsw.hpp"
 #include "../../src/cpp/ivf.hpp"
 #include "../../src/cpp/lsh.hpp"
@@ -95,6 +102,30 @@ void test_hnsw_basic() {
   check(!results.empty(), "search returns results");
   check(results[0].id == 0, "nearest to [1,0,0,0] is itself");
   check(results[0].distance < 1e-6f, "distance to itself is ~0");
+
+  // Past max_elements, insert throws and leaves the index as it was.
+  HNSWIndex small(4, 8, 100, 50, ScalarType::FP32, Metric::L2,
+                  /*max_elements=*/3);
+  for (int i = 0; i < 3; ++i)
+    small.insert({float(i), 0, 0, 0});
+  bool caught = false;
+  try {
+    small.insert({3, 0, 0, 0});
+  } catch (const std::length_error &) {
+    caught = true;
+  }
+  check(caught && small.size() == 3, "insert past max_elements throws");
+  check(small.search({2, 0, 0, 0}, 3).size() == 3,
+        "full index still searchable");
+
+  // A node larger than any reservation is refused up front.
+  caught = false;
+  try {
+    HNSWIndex huge(size_t{1} << 39);
+  } catch (const std::length_error &) {
+    caught = true;
+  }
+  check(caught, "oversized node stride throws");
 }
 
 void test_hnsw_recall() {
@@ -123,6 +154,754 @@ void test_hnsw_recall() {
         "recall@10 ≥ 0.7 (got " + std::to_string(avg_recall) + ")");
 }
 
+void test_hnsw_neighbor_selection() {
+  std::cout << "\n[test_hnsw_neighbor_selection]" << std::endl;
+
+  // Tight clusters are where M-closest selection loses navigability.
+  const size_t n = 1000, d = 16, k = 10, clusters = 20;
+  auto centers = generate_data(clusters, d, 5);
+  auto noise = generate_data(n, d, 6);
+  std::vector<std::vector<float>> data(n, std::vector<float>(d));
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      data[i][j] = 10.0f * centers[i % clusters][j] + 0.1f * noise[i][j];
+  auto queries = generate_data(20, d, 999);
+  for (auto &q : queries)
+    for (size_t j = 0; j < d; ++j)
+      q[j] *= 10.0f;
+
+  auto recall = [&](bool heuristic, bool extend, bool keep) {
+    HNSWIndex idx(d, /*M=*/8, /*ef_construction=*/100, /*ef_search=*/20);
+    idx.set_neighbor_selection(heuristic, extend, keep);
+    idx.build(data);
+    float total = 0;
+    for (const auto &q : queries) {
+      std::vector<size_t> ids;
+      for (const auto &r : idx.search(q, k))
+        ids.push_back(r.id);
+      total += compute_recall(ids, brute_force_knn(q, data, k), k);
+    }
+    return total / queries.size();
+  };
+
+  float simple = recall(false, false, false);
+  float heuristic = recall(true, false, false);
+  float extended = recall(true, true, true);
+  check(heuristic >= simple, "heuristic recall ≥ M-closest (" +
+                                 std::to_string(heuristic) + " vs " +
+                                 std::to_string(simple) + ")");
+  check(extended >= 0.8f, "extend + keep-pruned recall@10 ≥ 0.8 (got " +
+                              std::to_string(extended) + ")");
+}
+
+void test_hnsw_build_parallel() {
+  std::cout << "\n[test_hnsw_build_parallel]" << std::endl;
+
+  const size_t n = 2000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/100);
+  idx.build_parallel(data, /*num_threads=*/4);
+  check(idx.size() == n, "parallel build inserted every vector");
+
+  bool own_ids = true;
+  for (size_t i = 0; i < n; i += 97)
+    own_ids &= idx.search(data[i], 1)[0].id == i;
+  check(own_ids, "vector i is stored under id i");
+
+  float total_recall = 0;
+  for (const auto &q : queries) {
+    std::vector<size_t> ids;
+    for (const auto &r : idx.search(q, k))
+      ids.push_back(r.id);
+    total_recall += compute_recall(ids, brute_force_knn(q, data, k), k);
+  }
+  float avg_recall = total_recall / queries.size();
+  check(avg_recall >= 0.8f, "parallel-built recall@10 ≥ 0.8 (got " +
+                                std::to_string(avg_recall) + ")");
+
+  // Deterministic mode reproduces the serial graph exactly.
+  HNSWIndex a(d, 16, 100, 100), b(d, 16, 100, 100);
+  a.build(data);
+  b.build_parallel(data, 4, /*deterministic=*/true);
+  bool same = true;
+  for (const auto &q : queries) {
+    auto ra = a.search(q, k), rb = b.search(q, k);
+    for (size_t i = 0; i < k; ++i)
+      same &= ra[i].id == rb[i].id;
+  }
+  check(same, "deterministic parallel build matches build()");
+}
+
+void test_hnsw_concurrent_search() {
+  std::cout << "\n[test_hnsw_concurrent_search]" << std::endl;
+
+  const size_t n = 3000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(20, d, 999);
+
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/100);
+  for (size_t i = 0; i < 500; ++i)
+    idx.insert(data[i]);
+
+  // Two writers append the rest while two readers keep searching.
+  std::atomic<size_t> next{500};
+  std::atomic<bool> done{false}, sane{true};
+  std::atomic<size_t> searches{0};
+  auto writer = [&] {
+    for (size_t i; (i = next.fetch_add(1)) < n;)
+      idx.insert(data[i]);
+  };
+  auto reader = [&] {
+    for (size_t q = 0; !done.load(); q = (q + 1) % queries.size()) {
+      auto res = idx.search(queries[q], k);
+      bool ok = res.size() == k;
+      for (size_t i = 0; i < res.size(); ++i) {
+        ok &= res[i].id < idx.size();
+        ok &= i == 0 || res[i - 1].distance <= res[i].distance;
+      }
+      if (!ok)
+        sane = false;
+      searches++;
+    }
+  };
+  std::vector<std::thread> writers, readers;
+  for (int t = 0; t < 2; ++t) {
+    readers.emplace_back(reader);
+    writers.emplace_back(writer);
+  }
+  for (auto &th : writers)
+    th.join();
+  done = true;
+  for (auto &th : readers)
+    th.join();
+
+  check(idx.size() == n, "every concurrent insert landed");
+  check(sane && searches > 0, "searches during inserts return k sorted, "
+                              "valid ids");
+
+  float total_recall = 0;
+  for (const auto &q : queries) {
+    std::vector<size_t> ids;
+    for (const auto &r : idx.search(q, k))
+      ids.push_back(r.id);
+    total_recall += compute_recall(ids, brute_force_knn(q, data, k), k);
+  }
+  float avg_recall = total_recall / queries.size();
+  check(avg_recall >= 0.8f, "recall@10 after concurrent build ≥ 0.8 (got " +
+                                std::to_string(avg_recall) + ")");
+}
+
+void test_hnsw_search_batch() {
+  std::cout << "\n[test_hnsw_search_batch]" << std::endl;
+
+  const size_t n = 1000, d = 32, k = 10, nq = 50;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(nq, d, 999);
+  std::vector<float> flat;
+  for (const auto &q : queries)
+    flat.insert(flat.end(), q.begin(), q.end());
+
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/50);
+  idx.build(data);
+
+  std::vector<size_t> ids(nq * k);
+  std::vector<float> dists(nq * k);
+  idx.search_batch(flat.data(), nq, k, ids.data(), dists.data(),
+                   /*num_threads=*/4);
+  bool same = true;
+  for (size_t q = 0; q < nq; ++q) {
+    auto res = idx.search(queries[q], k);
+    for (size_t i = 0; i < k; ++i) {
+      same &= res[i].id == ids[q * k + i];
+      same &= res[i].distance == dists[q * k + i];
+    }
+  }
+  check(same, "search_batch rows match search() per query");
+
+  // Fewer nodes than k: rows are padded.
+  HNSWIndex small(d);
+  small.build({data[0], data[1], data[2]});
+  small.search_batch(flat.data(), 2, k, ids.data(), dists.data(), 1);
+  check(ids[2] != HNSWIndex::NO_RESULT && ids[3] == HNSWIndex::NO_RESULT &&
+            std::isinf(dists[k - 1]),
+        "short rows are padded with NO_RESULT / inf");
+}
+
+void test_hnsw_save_load() {
+  std::cout << "\n[test_hnsw_save_load]" << std::endl;
+
+  const size_t n = 1000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+  std::vector<float> flat;
+  for (const auto &v : data)
+    flat.insert(flat.end(), v.begin(), v.end());
+
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/50,
+                ScalarType::FP16);
+  idx.set_dimension_order(variance_order(flat.data(), n, d));
+  idx.build(data);
+  const std::string path = "/tmp/test_hnsw_save_load.hnsw";
+  idx.save(path);
+
+  using Mode = HNSWIndex::LoadMode;
+  for (Mode mode : {Mode::Read, Mode::Map, Mode::MapPopulate}) {
+    HNSWIndex loaded = HNSWIndex::load(path, mode);
+    bool same = loaded.size() == n && loaded.num_layers() == idx.num_layers();
+    for (const auto &q : queries) {
+      auto a = idx.search(q, k), b = loaded.search(q, k);
+      for (size_t i = 0; i < k; ++i)
+        same &= a[i].id == b[i].id && a[i].distance == b[i].distance;
+    }
+    check(same, "load mode " + std::to_string(static_cast<int>(mode)) +
+                    " answers exactly like the saved index");
+  }
+
+  // Inserting into a mapped index must not write through to the file.
+  {
+    HNSWIndex mapped = HNSWIndex::load(path, Mode::Map);
+    for (size_t i = 0; i < 200; ++i)
+      mapped.insert(queries[i % queries.size()]);
+    check(mapped.size() == n + 200 && mapped.search(queries[3], 1)[0].id >= n,
+          "mapped index accepts inserts");
+  }
+  check(HNSWIndex::load(path).size() == n, "file unchanged by those inserts");
+
+  // Capacity: explicit, raised to the node count, or a default.
+  {
+    HNSWIndex tight = HNSWIndex::load(path, Mode::Read, n + 1);
+    tight.insert(queries[0]);
+    bool full = false;
+    try {
+      tight.insert(queries[1]);
+    } catch (const std::length_error &) {
+      full = true;
+    }
+    check(full && HNSWIndex::load(path, Mode::Read, 10).max_elements() == n &&
+              HNSWIndex::load(path).max_elements() ==
+                  HNSWIndex::kDefaultMaxElements,
+          "load honours max_elements");
+  }
+
+  bool caught = false;
+  try {
+    HNSWIndex::load("/tmp/does_not_exist.hnsw");
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+  check(caught, "missing file throws");
+
+  // Corrupt one field of a copy; load must throw, not crash or hang.
+  // Header offsets: dim 24, count 56, entry 64; dim order follows at 104.
+  auto corrupted_throws = [&](size_t offset, const void *value,
+                              size_t bytes) {
+    const std::string bad = "/tmp/test_hnsw_corrupt.hnsw";
+    std::ifstream in(path, std::ios::binary);
+    std::string image((std::istreambuf_iterator<char>(in)),
+                      std::istreambuf_iterator<char>());
+    std::memcpy(&image[offset], value, bytes);
+    std::ofstream(bad, std::ios::binary) << image;
+    bool threw = false;
+    try {
+      HNSWIndex::load(bad, Mode::Read);
+    } catch (const std::runtime_error &) {
+      threw = true;
+    }
+    std::remove(bad.c_str());
+    return threw;
+  };
+  uint64_t huge_dim = uint64_t{1} << 39, far_entry = n + 5;
+  uint32_t bad_dim = d;
+  check(corrupted_throws(24, &huge_dim, sizeof(huge_dim)),
+        "absurd dimension throws");
+  check(corrupted_throws(104, &bad_dim, sizeof(bad_dim)),
+        "out-of-range dimension order throws");
+  check(corrupted_throws(64, &far_entry, sizeof(far_entry)),
+        "entry point past the node count throws");
+
+  // Saving over the file an index is mapped from leaves it readable.
+  {
+    HNSWIndex mapped = HNSWIndex::load(path, Mode::Map);
+    mapped.insert(queries[0]);
+    mapped.save(path);
+    check(mapped.search(queries[0], 1)[0].id == n &&
+              HNSWIndex::load(path).size() == n + 1,
+          "save over the mapped file");
+  }
+  std::remove(path.c_str());
+}
+
+void test_hnsw_range_search() {
+  std::cout << "\n[test_hnsw_range_search]" << std::endl;
+
+  const size_t n = 3000, d = 16;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/50);
+  idx.build(data);
+
+  auto dist = [&](const std::vector<float> &q, size_t i) {
+    float s = 0;
+    for (size_t j = 0; j < d; ++j)
+      s += (q[j] - data[i][j]) * (q[j] - data[i][j]);
+    return std::sqrt(s);
+  };
+  // Radius of the m-th nearest neighbor, so about m hits are expected.
+  auto radius_for = [&](const std::vector<float> &q, size_t m) {
+    return dist(q, brute_force_knn(q, data, m)[m - 1]);
+  };
+
+  // 20 and 400 expected hits: the second is far beyond ef_search.
+  for (size_t m : {20, 400}) {
+    float found = 0, expected = 0;
+    bool valid = true;
+    for (const auto &q : queries) {
+      float r = radius_for(q, m);
+      auto hits = idx.range_search(q, r);
+      for (size_t i = 0; i < hits.size(); ++i) {
+        valid &= hits[i].distance <= r * (1 + 1e-5f) &&
+                 std::abs(hits[i].distance - dist(q, hits[i].id)) < 1e-3f;
+        if (i > 0)
+          valid &= hits[i - 1].distance <= hits[i].distance;
+      }
+      found += hits.size();
+      expected += m;
+    }
+    std::cout << "  radius of the " << m << "-th neighbor: recall "
+              << found / expected << std::endl;
+    check(valid, "m=" + std::to_string(m) + ": hits inside radius, sorted");
+    check(found / expected >= 0.95f,
+          "m=" + std::to_string(m) + ": range recall >= 0.95");
+  }
+
+  const auto &q = queries[0];
+  float r = radius_for(q, 100);
+  auto all = idx.range_search(q, r);
+  auto capped = idx.range_search(q, r, 5);
+  bool closest = capped.size() == 5;
+  for (size_t i = 0; closest && i < 5; ++i)
+    closest = capped[i].id == all[i].id;
+  check(closest, "max_results keeps the closest hits");
+
+  auto self = idx.range_search(data[7], 0.0f);
+  check(self.size() == 1 && self[0].id == 7, "radius 0 finds the point");
+  check(idx.range_search(q, -1.0f).empty(), "negative radius finds nothing");
+
+  idx.mark_deleted(all[0].id);
+  auto after = idx.range_search(q, r);
+  check(after.size() == all.size() - 1 && after[0].id == all[1].id,
+        "deleted nodes are not returned");
+}
+
+void test_hnsw_reorder() {
+  std::cout << "\n[test_hnsw_reorder]" << std::endl;
+
+  const size_t n = 2000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(20, d, 999);
+  SearchFilter even([](size_t id) { return id % 2 == 0; });
+
+  // Same graph every time: deterministic build, a few freed slots.
+  auto make = [&] {
+    HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/50);
+    idx.build(data);
+    for (size_t i = 0; i < n; i += 50)
+      idx.mark_deleted(i);
+    idx.repair_deleted();
+    idx.mark_deleted(1);
+    return idx;
+  };
+  auto answers = [&](const HNSWIndex &idx) {
+    std::vector<HNSWIndex::SearchResult> out;
+    for (const auto &q : queries) {
+      for (const auto &r : idx.search(q, k))
+        out.push_back(r);
+      for (const auto &r : idx.search(q, k, even))
+        out.push_back(r);
+    }
+    return out;
+  };
+  auto same = [](const std::vector<HNSWIndex::SearchResult> &a,
+                 const std::vector<HNSWIndex::SearchResult> &b) {
+    bool eq = a.size() == b.size();
+    for (size_t i = 0; eq && i < a.size(); ++i)
+      eq = a[i].id == b[i].id && a[i].distance == b[i].distance;
+    return eq;
+  };
+  auto before = answers(make());
+
+  using R = HNSWIndex::Reorder;
+  const char *names[] = {"BFS", "RCM", "Gorder"};
+  for (R method : {R::BFS, R::RCM, R::Gorder}) {
+    std::string name = names[static_cast<int>(method)];
+    HNSWIndex idx = make();
+    idx.reorder(method);
+    check(same(answers(idx), before),
+          name + ": same results and ids after reorder");
+    check(idx.is_deleted(1) && !idx.is_deleted(2) && idx.deleted_count() == 1,
+          name + ": deletion marks follow their ids");
+    size_t reused = idx.insert(data[50]);
+    check(reused % 50 == 0 && reused < n && !idx.is_deleted(reused) &&
+              idx.search(data[50], 1)[0].id == reused,
+          name + ": insert reuses a freed id");
+  }
+
+  // The id mapping survives save/load, and a second reorder.
+  HNSWIndex idx = make();
+  idx.reorder(R::Gorder);
+  idx.reorder(R::RCM);
+  const std::string path = "/tmp/test_hnsw_reorder.hnsw";
+  idx.save(path);
+  HNSWIndex loaded = HNSWIndex::load(path);
+  check(same(answers(loaded), before) && loaded.is_deleted(1),
+        "reordered index answers the same after save/load");
+  std::remove(path.c_str());
+}
+
+void test_hnsw_compressed() {
+  std::cout << "\n[test_hnsw_compressed]" << std::endl;
+
+  const size_t n = 2000, d = 64, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(20, d, 999);
+  std::vector<float> flat;
+  for (const auto &v : data)
+    flat.insert(flat.end(), v.begin(), v.end());
+
+  // Recall of idx against exact search over `base` (also the distances).
+  auto run = [&](const HNSWIndex &idx,
+                 const std::vector<std::vector<float>> &base,
+                 const std::vector<std::vector<float>> &qs, bool &exact) {
+    float total = 0;
+    for (const auto &q : qs) {
+      auto res = idx.search(q, k);
+      std::vector<size_t> ids;
+      for (const auto &r : res)
+        ids.push_back(r.id);
+      auto truth = brute_force_knn(q, base, k);
+      total += compute_recall(ids, truth, k);
+      float d0 = 0;
+      for (size_t j = 0; j < d; ++j)
+        d0 += (q[j] - base[truth[0]][j]) * (q[j] - base[truth[0]][j]);
+      exact &= res[0].id != truth[0] || std::abs(res[0].distance -
+                                                 std::sqrt(d0)) < 1e-3f;
+    }
+    return total / qs.size();
+  };
+
+  // PQ codes (16 bytes instead of 256), rerank from a mapped file.
+  ProductQuantizer pq(d, /*M=*/16, /*K=*/64);
+  pq.train(data, /*n_iter=*/10);
+  HNSWIndex plain(d, 16, 100, 50);
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/50);
+  idx.set_quantizer(pq);
+  idx.build(data);
+  check(idx.compressed() &&
+            idx.bytes_per_node() + 240 == plain.bytes_per_node(),
+        "PQ node keeps a 16-byte code instead of the vector");
+
+  const std::string path = "/tmp/test_hnsw_compressed.f32";
+  MappedVectors::write(path, flat.data(), n / 2, d);
+  MappedVectors::write(path, flat.data() + n / 2 * d, n - n / 2, d, true);
+  MappedVectors rows(path, d);
+  check(rows.size() == n && rows.row(n - 1)[d - 1] == data[n - 1][d - 1],
+        "mapped vector file holds every row");
+
+  bool exact = true;
+  float approx = run(idx, data, queries, exact);
+  idx.set_rerank([&rows](const size_t *ids, size_t m, float *out) {
+    rows.fetch(ids, m, out);
+  }, /*candidates=*/100);
+  exact = true;
+  float recall = run(idx, data, queries, exact);
+  std::cout << "  PQ recall@10: " << approx << " codes only, " << recall
+            << " reranked" << std::endl;
+  check(recall >= 0.9f && recall > approx, "PQ + rerank recall@10 >= 0.9");
+  check(exact, "reranked distances are exact");
+
+  bool caught = false;
+  try {
+    idx.save("/tmp/test_hnsw_compressed.hnsw");
+  } catch (const std::runtime_error &) {
+    caught = true;
+  }
+  check(caught, "saving a compressed index throws");
+  std::remove(path.c_str());
+
+  // SQ8 codes with cosine distance, rerank from memory.
+  auto unit = data;
+  for (auto &v : unit)
+    normalize_l2(v.data(), d);
+  auto unit_queries = queries;
+  for (auto &q : unit_queries)
+    normalize_l2(q.data(), d);
+  ScalarQuantizer sq(d, 8);
+  sq.train(unit);
+  HNSWIndex cos_idx(d, 16, 100, 50, ScalarType::FP32, Metric::Cosine);
+  cos_idx.set_quantizer(sq);
+  cos_idx.build(data);
+  cos_idx.set_rerank([&data](const size_t *ids, size_t m, float *out) {
+    for (size_t i = 0; i < m; ++i)
+      std::copy(data[ids[i]].begin(), data[ids[i]].end(), out + i * d);
+  }, 50);
+  float cos_recall = 0;
+  bool cos_exact = true;
+  for (const auto &q : unit_queries) {
+    auto res = cos_idx.search(q, k);
+    std::vector<size_t> ids;
+    for (const auto &r : res)
+      ids.push_back(r.id);
+    cos_recall += compute_recall(ids, brute_force_knn(q, unit, k), k);
+    float dot = 0;
+    for (size_t j = 0; j < d; ++j)
+      dot += q[j] * unit[res[0].id][j];
+    cos_exact &= std::abs(res[0].distance - (1.0f - dot)) < 1e-4f;
+  }
+  cos_recall /= unit_queries.size();
+  std::cout << "  SQ8 cosine recall@10 (reranked): " << cos_recall
+            << std::endl;
+  check(cos_recall >= 0.9f, "SQ8 cosine + rerank recall@10 >= 0.9");
+  check(cos_exact, "reranked cosine distances are exact");
+}
+
+void test_hnsw_delete() {
+  std::cout << "\n[test_hnsw_delete]" << std::endl;
+
+  const size_t n = 2000, d = 32, k = 10, gone = 400;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(20, d, 999);
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/100);
+  idx.build(data);
+
+  // Ground truth over the live set: deleted rows are moved far away.
+  auto live = data;
+  for (size_t i = 0; i < gone; ++i) {
+    idx.mark_deleted(i * 5);
+    live[i * 5].assign(d, 1e6f);
+  }
+  auto recall = [&](const HNSWIndex &index, bool &clean) {
+    float total = 0;
+    for (const auto &q : queries) {
+      std::vector<size_t> ids;
+      for (const auto &r : index.search(q, k)) {
+        ids.push_back(r.id);
+        clean &= r.id >= n || r.id % 5 != 0 || r.id >= gone * 5;
+      }
+      total += compute_recall(ids, brute_force_knn(q, live, k), k);
+    }
+    return total / queries.size();
+  };
+
+  bool clean = true;
+  float marked = recall(idx, clean);
+  check(clean && idx.deleted_count() == gone,
+        "marked nodes never appear in results");
+  check(marked >= 0.9f, "recall@10 with 20% marked ≥ 0.9 (got " +
+                            std::to_string(marked) + ")");
+
+  check(idx.repair_deleted() == gone && idx.deleted_count() == 0,
+        "repair frees every deleted slot");
+  float repaired = recall(idx, clean);
+  check(clean && repaired >= 0.9f, "recall@10 after repair ≥ 0.9 (got " +
+                                       std::to_string(repaired) + ")");
+
+  // New vectors land in the freed slots.
+  auto fresh = generate_data(gone, d, 7);
+  bool reused = true;
+  for (size_t i = 0; i < gone; ++i) {
+    size_t id = idx.insert(fresh[i]);
+    reused &= id < gone * 5 && id % 5 == 0;
+    live[id] = fresh[i];
+  }
+  check(reused && idx.size() == n, "inserts reuse freed slots");
+  bool found = true;
+  for (size_t i = 0; i < gone; i += 37)
+    found &= idx.search(fresh[i], 1)[0].distance < 1e-3f;
+  check(found, "reinserted vectors are searchable");
+
+  // Deleting everything (entry point included) leaves a usable index.
+  HNSWIndex tiny(d);
+  tiny.build({data[0], data[1], data[2]});
+  for (size_t i = 0; i < 3; ++i)
+    tiny.mark_deleted(i);
+  check(tiny.search(data[0], 3).empty(), "all-deleted index returns nothing");
+  tiny.repair_deleted();
+  tiny.insert(data[4]);
+  check(tiny.search(data[4], 1).size() == 1, "insert after full repair works");
+}
+
+void test_hnsw_filtered_search() {
+  std::cout << "\n[test_hnsw_filtered_search]" << std::endl;
+
+  const size_t n = 3000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(20, d, 999);
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/100, /*ef_search=*/100);
+  idx.build(data);
+
+  // Recall against the allowed subset; every result must be allowed.
+  auto run = [&](const SearchFilter &filter, bool &valid) {
+    std::vector<std::vector<float>> subset;
+    std::vector<size_t> subset_ids;
+    for (size_t i = 0; i < n; ++i) {
+      if (filter.allows(i)) {
+        subset.push_back(data[i]);
+        subset_ids.push_back(i);
+      }
+    }
+    float total = 0;
+    for (const auto &q : queries) {
+      auto res = idx.search(q, k, filter);
+      valid &= res.size() == k;
+      std::vector<size_t> ids;
+      for (const auto &r : res) {
+        valid &= filter.allows(r.id);
+        ids.push_back(r.id);
+      }
+      std::vector<size_t> truth;
+      for (size_t j : brute_force_knn(q, subset, k))
+        truth.push_back(subset_ids[j]);
+      total += compute_recall(ids, truth, k);
+    }
+    return total / queries.size();
+  };
+
+  // 1% of ids allowed: Auto picks two-hop expansion.
+  std::vector<uint64_t> bits((n + 63) / 64, 0);
+  for (size_t i = 7; i < n; i += 100)
+    bits[i / 64] |= uint64_t{1} << (i % 64);
+  SearchFilter sparse(bits.data(), n);
+  check(sparse.two_hop(n), "sparse bitmap selects two-hop mode");
+  bool valid = true;
+  float sparse_recall = run(sparse, valid);
+  check(valid, "1% filter: k results, all allowed");
+  check(sparse_recall >= 0.8f, "1% filter recall@10 ≥ 0.8 (got " +
+                                   std::to_string(sparse_recall) + ")");
+
+  SearchFilter navigate(bits.data(), n, SearchFilter::Mode::Navigate);
+  valid = true;
+  run(navigate, valid);
+  check(valid, "1% filter without two-hop still fills k results");
+
+  // 0.1% of a larger graph (exactly k ids): two-hop expansion finds
+  // almost no admitted neighbors and must keep navigating.
+  const size_t big_n = 10000, big_d = 16;
+  auto big = generate_data(big_n, big_d, 7);
+  HNSWIndex big_idx(big_d, 16, 100, 50);
+  big_idx.build(big);
+  std::vector<uint64_t> rare((big_n + 63) / 64, 0);
+  for (size_t i = 3; i < big_n; i += 1000)
+    rare[i / 64] |= uint64_t{1} << (i % 64);
+  SearchFilter rarest(rare.data(), big_n);
+  check(rarest.two_hop(big_n), "0.1% bitmap selects two-hop mode");
+  valid = true;
+  for (const auto &q : generate_data(20, big_d, 998)) {
+    auto res = big_idx.search(q, k, rarest);
+    valid &= res.size() == k;
+    for (const auto &r : res)
+      valid &= rarest.allows(r.id);
+  }
+  check(valid, "0.1% filter: k results, all allowed");
+
+  // Half the ids, as a predicate: plain navigation.
+  SearchFilter even([](size_t id) { return id % 2 == 0; });
+  check(!even.two_hop(n), "dense predicate navigates normally");
+  valid = true;
+  float even_recall = run(even, valid);
+  check(valid && even_recall >= 0.9f,
+        "50% predicate recall@10 ≥ 0.9 (got " + std::to_string(even_recall) +
+            ")");
+}
+
+void test_visited_list() {
+  std::cout << "\n[test_visited_list]" << std::endl;
+
+  VisitedListPool pool;
+  VisitedList *first;
+  {
+    auto v = pool.acquire(10);
+    first = v.get();
+    check(v->visit(3) && !v->visit(3), "second visit is reported as seen");
+  }
+  auto v = pool.acquire(20);
+  check(v.get() == first, "released list is reused");
+  check(v->visit(3) && v->visit(19), "reset clears previous visits");
+
+  // Survives the 16-bit epoch wrapping around.
+  bool ok = true;
+  for (int i = 0; i < 70000; ++i) {
+    v->reset(20);
+    ok &= v->visit(i % 20) && !v->visit(i % 20);
+  }
+  check(ok, "visits stay correct across epoch wrap-around");
+}
+
+void test_hnsw_half_precision() {
+  std::cout << "\n[test_hnsw_half_precision]" << std::endl;
+
+  const size_t n = 1000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+
+  for (ScalarType type : {ScalarType::FP16, ScalarType::BF16}) {
+    HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/200, /*ef_search=*/100,
+                  type);
+    idx.build(data);
+
+    float total_recall = 0;
+    for (const auto &q : queries) {
+      std::vector<size_t> approx_ids;
+      for (auto &r : idx.search(q, k))
+        approx_ids.push_back(r.id);
+      auto exact = brute_force_knn(q, data, k);
+      total_recall += compute_recall(approx_ids, exact, k);
+    }
+    float avg_recall = total_recall / 10;
+    check(avg_recall >= 0.7f, std::string(type == ScalarType::FP16 ? "fp16"
+                                                                   : "bf16") +
+                                  " HNSW recall@10 ≥ 0.7 (got " +
+                                  std::to_string(avg_recall) + ")");
+  }
+}
+
+void test_hnsw_cosine() {
+  std::cout << "\n[test_hnsw_cosine]" << std::endl;
+
+  const size_t n = 1000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+
+  // Cosine ranking == L2 ranking of the unit-normalized vectors.
+  auto unit = data;
+  for (auto &v : unit)
+    normalize_l2(v.data(), d);
+
+  HNSWIndex idx(d, /*M=*/16, /*ef_construction=*/200, /*ef_search=*/100,
+                ScalarType::FP32, Metric::Cosine);
+  idx.build(data);
+
+  float total_recall = 0;
+  for (auto q : queries) {
+    std::vector<size_t> approx_ids;
+    for (auto &r : idx.search(q, k))
+      approx_ids.push_back(r.id);
+    normalize_l2(q.data(), d);
+    total_recall += compute_recall(approx_ids, brute_force_knn(q, unit, k), k);
+  }
+  float avg_recall = total_recall / 10;
+  check(avg_recall >= 0.8f, "cosine HNSW recall@10 ≥ 0.8 (got " +
+                                std::to_string(avg_recall) + ")");
+
+  auto scaled = data[3];
+  for (auto &x : scaled)
+    x *= 5.0f;
+  auto top = idx.search(scaled, 1);
+  check(top[0].id == 3 && std::abs(top[0].distance) < 1e-5f,
+        "scaled query is at cosine distance 0 from itself");
+}
+
 // ────────────── LSH Tests ──────────────
 
 void test_lsh_cosine() {
@@ -144,6 +923,15 @@ void test_lsh_cosine() {
     if (id == 0)
       found_self = true;
   check(found_self, "query vector found in its own results");
+
+  // Packed signatures: one word per table, reusable as a binary code.
+  std::vector<uint64_t> sig(15);
+  lsh.encode(data[0].data(), sig.data());
+  bool same = std::equal(sig.begin(), sig.end(), lsh.code(0));
+  bool in_range = true;
+  for (uint64_t w : sig)
+    in_range &= (w >> 6) == 0;
+  check(same && in_range, "packed signature matches indexed code");
 }
 
 void test_lsh_euclidean() {
@@ -204,6 +992,111 @@ void test_pq_search() {
   check(results[0].id == 0, "closest to query is itself");
 }
 
+void test_sq_encode_decode() {
+  std::cout << "\n[test_sq_encode_decode]" << std::endl;
+
+  const size_t n = 200, d = 16;
+  auto data = generate_data(n, d);
+
+  for (size_t bits : {8, 4}) {
+    ScalarQuantizer sq(d, bits);
+    sq.train(data);
+    auto codes = sq.encode(data);
+    check(codes[0].size() == (bits == 8 ? d : d / 2),
+          "SQ" + std::to_string(bits) + " code size");
+
+    float max_err = 0;
+    for (size_t i = 0; i < n; ++i) {
+      auto rec = sq.decode(codes[i]);
+      for (size_t j = 0; j < d; ++j)
+        max_err = std::max(max_err, std::abs(rec[j] - data[i][j]));
+    }
+    // Uniform quantization error is at most half a step per dimension;
+    // N(0,1) data spans < 8 units, so a step is < 8 / (2^bits − 1).
+    float bound = 0.5f * 8.0f / static_cast<float>((1u << bits) - 1);
+    check(max_err <= bound, "SQ" + std::to_string(bits) +
+                                " max error ≤ half a step (got " +
+                                std::to_string(max_err) + ")");
+  }
+}
+
+void test_sq_flat_search() {
+  std::cout << "\n[test_sq_flat_search]" << std::endl;
+
+  const size_t n = 1000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+
+  struct Config {
+    size_t bits, rerank;
+    float min_recall;
+  };
+  for (Config cfg : {Config{8, 0, 0.8f}, Config{4, 0, 0.4f},
+                     Config{4, 4, 0.9f}}) {
+    SQFlatIndex idx(d, cfg.bits, cfg.rerank);
+    idx.train(data);
+    idx.add(data);
+
+    float total_recall = 0;
+    for (const auto &q : queries) {
+      std::vector<size_t> approx_ids;
+      for (auto &r : idx.search(q, k))
+        approx_ids.push_back(r.id);
+      auto exact = brute_force_knn(q, data, k);
+      total_recall += compute_recall(approx_ids, exact, k);
+    }
+    float avg_recall = total_recall / 10;
+    check(avg_recall >= cfg.min_recall,
+          "SQ" + std::to_string(cfg.bits) + " rerank=" +
+              std::to_string(cfg.rerank) + " recall@10 (got " +
+              std::to_string(avg_recall) + ")");
+  }
+
+  SQFlatIndex idx(d, 8);
+  idx.train(data);
+  idx.add(data);
+  check(idx.search(data[7], 1)[0].id == 7, "SQ8 finds the query itself");
+}
+
+// ────────────── Binary Tests ──────────────
+
+void test_binary_flat_search() {
+  std::cout << "\n[test_binary_flat_search]" << std::endl;
+
+  const size_t n = 1000, d = 64, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+
+  BinaryFlatIndex idx(d);
+  idx.add(data);
+  check(idx.code_words() == 1 && idx.size() == n, "64-d packs to one word");
+  auto self = idx.search(data[3], 1);
+  check(self[0].distance == 0.0f, "query code is at Hamming distance 0");
+
+  // 1-bit first stage + exact float rerank.
+  BinaryFlatIndex rerank(d, BinaryFlatIndex::Metric::Hamming, 10);
+  rerank.add(data);
+  float total_recall = 0;
+  for (const auto &q : queries) {
+    std::vector<size_t> approx_ids;
+    for (auto &r : rerank.search(q, k))
+      approx_ids.push_back(r.id);
+    total_recall += compute_recall(approx_ids, brute_force_knn(q, data, k), k);
+  }
+  float avg_recall = total_recall / 10;
+  check(avg_recall >= 0.6f, "binary + rerank recall@10 (got " +
+                                std::to_string(avg_recall) + ")");
+
+  // Jaccard over codes produced by LSH.
+  RandomHyperplaneLSH lsh(d, /*num_tables=*/4, /*num_hashes=*/64);
+  lsh.build(data);
+  BinaryFlatIndex codes(4 * 64, BinaryFlatIndex::Metric::Jaccard);
+  codes.add_codes(lsh.code(0), n);
+  auto hits = codes.search_code(lsh.code(42), 1);
+  check(hits[0].id == 42 && hits[0].distance == 0.0f,
+        "Jaccard search over LSH codes finds itself");
+}
+
 // ────────────── IVF Tests ──────────────
 
 void test_ivf_basic() {
@@ -247,19 +1140,121 @@ void test_ivf_recall() {
         "IVF recall@10 ≥ 0.5 (got " + std::to_string(avg_recall) + ")");
 }
 
+void test_ivf_half_precision() {
+  std::cout << "\n[test_ivf_half_precision]" << std::endl;
+
+  const size_t n = 500, d = 16, k = 10;
+  auto data = generate_data(n, d);
+
+  IVFIndex fp32(d, /*nlist=*/20, /*nprobe=*/5);
+  IVFIndex fp16(d, /*nlist=*/20, /*nprobe=*/5, ScalarType::FP16);
+  fp32.train(data, 10);
+  fp16.train(data, 10);
+  fp32.add(data);
+  fp16.add(data);
+
+  auto exact = fp32.search(data[3], k);
+  auto half = fp16.search(data[3], k);
+  check(half.size() == k && half[0].id == 3, "fp16 IVF finds the query itself");
+  std::vector<size_t> exact_ids, half_ids;
+  for (size_t i = 0; i < k; ++i) {
+    exact_ids.push_back(exact[i].id);
+    half_ids.push_back(half[i].id);
+  }
+  check(compute_recall(half_ids, exact_ids, k) >= 0.9f,
+        "fp16 IVF agrees with fp32 IVF");
+}
+
 // ────────────── Main ──────────────
 
+void test_ivf_cosine() {
+  std::cout << "\n[test_ivf_cosine]" << std::endl;
+
+  const size_t n = 2000, d = 32, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(10, d, 999);
+  auto unit = data;
+  for (auto &v : unit)
+    normalize_l2(v.data(), d);
+
+  IVFIndex idx(d, /*nlist=*/20, /*nprobe=*/10, ScalarType::FP32,
+               Metric::Cosine);
+  idx.train(data);
+  idx.add(data);
+
+  float total_recall = 0;
+  bool in_range = true;
+  for (auto q : queries) {
+    std::vector<size_t> approx_ids;
+    for (auto &r : idx.search(q, k)) {
+      approx_ids.push_back(r.id);
+      in_range &= r.distance >= -1e-5f && r.distance <= 2.0f + 1e-5f;
+    }
+    normalize_l2(q.data(), d);
+    total_recall += compute_recall(approx_ids, brute_force_knn(q, unit, k), k);
+  }
+  float avg_recall = total_recall / 10;
+  check(in_range, "cosine distances lie in [0, 2]");
+  check(avg_recall >= 0.8f, "cosine IVF recall@10 ≥ 0.8 (got " +
+                                std::to_string(avg_recall) + ")");
+}
+
+void test_ivf_bounded_scan() {
+  std::cout << "\n[test_ivf_bounded_scan]" << std::endl;
+
+  // d ≥ 256 takes the early-abandon path once the top-k fills up.
+  const size_t n = 600, d = 256, k = 10;
+  auto data = generate_data(n, d);
+  auto queries = generate_data(5, d, 999);
+
+  IVFIndex idx(d, /*nlist=*/8, /*nprobe=*/8);
+  std::vector<float> flat;
+  for (const auto &v : data)
+    flat.insert(flat.end(), v.begin(), v.end());
+  idx.set_dimension_order(variance_order(flat.data(), n, d));
+  idx.train(data);
+  idx.add(data);
+
+  bool exact = true;
+  for (const auto &q : queries) {
+    std::vector<size_t> ids;
+    for (const auto &r : idx.search(q, k))
+      ids.push_back(r.id);
+    exact &= compute_recall(ids, brute_force_knn(q, data, k), k) == 1.0f;
+  }
+  check(exact, "all lists probed + bounded scan = exact top-10");
+}
+
 int main() {
   std::cout << "=== Vector Database Algorithm Tests ===" << std::endl;
 
   test_hnsw_basic();
   test_hnsw_recall();
+  test_hnsw_neighbor_selection();
+  test_hnsw_build_parallel();
+  test_hnsw_concurrent_search();
+  test_hnsw_search_batch();
+  test_hnsw_save_load();
+  test_hnsw_range_search();
+  test_hnsw_reorder();
+  test_hnsw_compressed();
+  test_hnsw_delete();
+  test_hnsw_filtered_search();
+  test_visited_list();
+  test_hnsw_half_precision();
+  test_hnsw_cosine();
   test_lsh_cosine();
   test_lsh_euclidean();
   test_pq_encode_decode();
   test_pq_search();
+  test_sq_encode_decode();
+  test_sq_flat_search();
+  test_binary_flat_search();
   test_ivf_basic();
   test_ivf_recall();
+  test_ivf_half_precision();
+  test_ivf_cosine();
+  test_ivf_bounded_scan();
 
   std::cout << "\n--- Results: " << tests_passed << " passed, " << tests_failed
             << " failed ---" << std::endl;
@@ -2,17 +2,23 @@
  * Test suite for vector distance computations.
  *
  * Compile & run:
- *   g++ -std=c++17 -O2 -I../src/cpp -o test_distances
- * test/cpp/test_distances.cpp && ./test_distances
+ *   g++ -std=c++17 -O2 -pthread -I../src/cpp -o test_distances
+ * test/cpp/test_distances.cpp src/cpp/distances.cpp && ./test_distances
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <iostream>
+#include <limits>
+#include <random>
 #include <string>
 #include <vector>
 
-// Forward declarations from distances.cpp (compiled inline for testing)
+#include "../../src/cpp/distances.hpp"
+#include "../../src/cpp/topk.hpp"
+
+// Forward declarations from distances.cpp
 float l2_distance_naive(const float *x, const float *y, size_t d);
 
 // Inline the naive implementation for self-contained test
@@ -143,6 +149,482 @@ void test_high_dimensional() {
              "parallel 128-dim vectors");
 }
 
+void test_dispatched_kernels() {
+  std::cout << "\n[test_dispatched_kernels]" << std::endl;
+
+  SimdLevel best = detect_simd_level();
+  check(distance_kernels().level == best,
+        std::string("dispatch picks detected level (") +
+            simd_level_name(best) + ")");
+
+  // Every tier the host supports must agree with the scalar kernels,
+  // including dimensions that leave a SIMD remainder.
+  std::mt19937 rng(7);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const DistanceKernels &ref = distance_kernels(SimdLevel::Scalar);
+  for (int lvl = 0; lvl <= static_cast<int>(best); ++lvl) {
+    const DistanceKernels &k = distance_kernels(static_cast<SimdLevel>(lvl));
+    bool ok = k.level == static_cast<SimdLevel>(lvl);
+    for (size_t d : {1, 3, 8, 15, 17, 33, 128, 769}) {
+      std::vector<float> x(d), y(d);
+      for (size_t i = 0; i < d; ++i) {
+        x[i] = dist(rng);
+        y[i] = dist(rng);
+      }
+      float tol = 1e-4f * static_cast<float>(d);
+      ok &= std::abs(k.l2_sq(x.data(), y.data(), d) -
+                     ref.l2_sq(x.data(), y.data(), d)) < tol;
+      ok &= std::abs(k.inner_product(x.data(), y.data(), d) -
+                     ref.inner_product(x.data(), y.data(), d)) < tol;
+      ok &= std::abs(k.cosine(x.data(), y.data(), d) -
+                     cosine_sim(x.data(), y.data(), d)) < 1e-4f;
+    }
+    check(ok, std::string(simd_level_name(k.level)) +
+                  " kernels match scalar reference");
+  }
+}
+
+void test_batch_kernels() {
+  std::cout << "\n[test_batch_kernels]" << std::endl;
+
+  std::mt19937 rng(11);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const size_t d = 37, n = 23; // neither divides the SIMD width / tile
+  std::vector<float> q(d), base(n * d), norms(n), out(n);
+  for (auto &v : q)
+    v = dist(rng);
+  for (auto &v : base)
+    v = dist(rng);
+  compute_norms_sq(base.data(), n, d, norms.data());
+
+  for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+    const DistanceKernels &k = distance_kernels(static_cast<SimdLevel>(lvl));
+    bool l2_ok = true, ip_ok = true;
+    k.l2_sq_batch(q.data(), base.data(), n, d, out.data());
+    for (size_t i = 0; i < n; ++i)
+      l2_ok &= std::abs(out[i] - l2_distance_naive_test(
+                                     q.data(), base.data() + i * d, d)) < 1e-3f;
+    k.inner_product_batch(q.data(), base.data(), n, d, out.data());
+    for (size_t i = 0; i < n; ++i)
+      ip_ok &= std::abs(out[i] - k.inner_product(q.data(),
+                                                 base.data() + i * d, d)) <
+               1e-3f;
+    check(l2_ok && ip_ok, std::string(simd_level_name(k.level)) +
+                              " batch kernels match 1×1 kernels");
+  }
+
+  bool norm_ok = true;
+  l2_sq_batch(q.data(), base.data(), n, d, out.data(), norms.data());
+  for (size_t i = 0; i < n; ++i)
+    norm_ok &= std::abs(out[i] - l2_distance_naive_test(
+                                     q.data(), base.data() + i * d, d)) < 1e-3f;
+  check(norm_ok, "norm-decomposed L2 matches direct L2");
+
+  // A row identical to the query must not come out negative.
+  l2_sq_batch(base.data(), base.data(), 1, d, out.data(), norms.data());
+  check(out[0] >= 0.0f && out[0] < 1e-3f, "self-distance clamped to >= 0");
+
+  auto knn = brute_force_knn(q.data(), base.data(), n, d, 5, norms.data());
+  size_t best = 0;
+  for (size_t i = 1; i < n; ++i)
+    if (l2_distance_naive_test(q.data(), base.data() + i * d, d) <
+        l2_distance_naive_test(q.data(), base.data() + best * d, d))
+      best = i;
+  check(knn.size() == 5 && knn[0].index == best,
+        "brute_force_knn finds the nearest row");
+}
+
+void test_brute_force_knn_batch() {
+  std::cout << "\n[test_brute_force_knn_batch]" << std::endl;
+
+  std::mt19937 rng(5);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const size_t n = 700, d = 24, k = 10;
+  std::vector<float> base(n * d), norms(n);
+  for (auto &v : base)
+    v = dist(rng);
+  compute_norms_sq(base.data(), n, d, norms.data());
+
+  // 3 queries with 4 threads splits the database; 100 queries splits
+  // the query set. Both must agree with the single-query baseline.
+  for (size_t nq : {3, 100}) {
+    std::vector<float> queries(nq * d);
+    for (auto &v : queries)
+      v = dist(rng);
+    auto batch = brute_force_knn_batch(queries.data(), nq, base.data(), n, d,
+                                       k, norms.data(), /*num_threads=*/4);
+    bool ok = batch.size() == nq;
+    for (size_t q = 0; ok && q < nq; ++q) {
+      auto single =
+          brute_force_knn(queries.data() + q * d, base.data(), n, d, k);
+      ok &= batch[q].size() == k;
+      for (size_t i = 0; ok && i < k; ++i)
+        ok &= std::abs(batch[q][i].distance - single[i].distance) < 1e-3f;
+    }
+    check(ok, std::to_string(nq) + " queries match per-query brute force");
+  }
+
+  auto small = brute_force_knn_batch(base.data(), 1, base.data(), 4, d, 10);
+  check(small[0].size() == 4 && small[0][0].index == 0,
+        "k > n returns all rows, self first");
+}
+
+static SimdLevel k_level(int lvl) { return static_cast<SimdLevel>(lvl); }
+
+void test_half_precision() {
+  std::cout << "\n[test_half_precision]" << std::endl;
+
+  check(float_to_fp16(1.0f) == 0x3C00 && fp16_to_float(0x3C00) == 1.0f,
+        "fp16 encodes 1.0 exactly");
+  check(float_to_fp16(65504.0f) == 0x7BFF && float_to_fp16(1e6f) == 0x7C00,
+        "fp16 max finite and overflow to Inf");
+  check(fp16_to_float(0x0001) == std::ldexp(1.0f, -24) &&
+            float_to_fp16(std::ldexp(1.0f, -24)) == 0x0001,
+        "fp16 smallest subnormal round-trips");
+  // 1 + 2^-11 is exactly halfway between 1 and the next fp16: ties to even.
+  check(float_to_fp16(1.0f + std::ldexp(1.0f, -11)) == 0x3C00,
+        "fp16 rounds ties to even");
+  check(float_to_bf16(1.0f) == 0x3F80 && bf16_to_float(0x3F80) == 1.0f,
+        "bf16 encodes 1.0 exactly");
+
+  std::mt19937 rng(3);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const size_t d = 45;
+  std::vector<float> q(d), x(d), decoded(d);
+  for (size_t i = 0; i < d; ++i) {
+    q[i] = dist(rng);
+    x[i] = dist(rng);
+  }
+  for (ScalarType type : {ScalarType::FP16, ScalarType::BF16}) {
+    std::vector<uint16_t> row(d);
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const StorageKernels &k = storage_kernels(type, k_level(lvl));
+      k.encode(x.data(), row.data(), d);
+      k.decode(row.data(), decoded.data(), d);
+      // Kernels must equal float32 math on the decoded row ...
+      bool ok = std::abs(k.l2_sq(q.data(), row.data(), d) -
+                         l2_distance_naive_test(q.data(), decoded.data(), d)) <
+                1e-3f;
+      ok &= std::abs(k.inner_product(q.data(), row.data(), d) -
+                     distance_kernels().inner_product(q.data(), decoded.data(),
+                                                      d)) < 1e-3f;
+      // ... and stay close to the unrounded float32 distance.
+      float exact = l2_distance_naive_test(q.data(), x.data(), d);
+      ok &= std::abs(k.l2_sq(q.data(), row.data(), d) - exact) < 0.05f * exact;
+      check(ok, std::string(type == ScalarType::FP16 ? "fp16" : "bf16") +
+                    " kernels at " + simd_level_name(k_level(lvl)));
+    }
+  }
+}
+
+void test_integer_kernels() {
+  std::cout << "\n[test_integer_kernels]" << std::endl;
+
+  std::mt19937 rng(9);
+  std::uniform_int_distribution<int> code(0, 255), weight(-63, 63);
+  for (size_t d : {5, 16, 47, 64, 130}) {
+    std::vector<uint8_t> c(d);
+    std::vector<int8_t> w(d), w2(d);
+    for (size_t i = 0; i < d; ++i) {
+      c[i] = static_cast<uint8_t>(code(rng));
+      w[i] = static_cast<int8_t>(weight(rng));
+      w2[i] = static_cast<int8_t>(weight(rng));
+    }
+    int32_t ref8 = 0, ref4 = 0;
+    for (size_t i = 0; i < d; ++i) {
+      ref8 += c[i] * w[i];
+      ref4 += (c[i] & 0x0F) * w[i] + (c[i] >> 4) * w2[i];
+    }
+    bool ok = true;
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const DistanceKernels &k = distance_kernels(k_level(lvl));
+      ok &= k.dot_u8s8(c.data(), w.data(), d) == ref8;
+      ok &= k.dot_u4s8(c.data(), w.data(), w2.data(), d) == ref4;
+    }
+    check(ok, "u8/u4 integer dot products exact at d=" + std::to_string(d));
+  }
+}
+
+void test_binary_kernels() {
+  std::cout << "\n[test_binary_kernels]" << std::endl;
+
+  std::mt19937_64 rng(13);
+  for (size_t nwords : {1, 3, 8, 13, 32}) {
+    std::vector<uint64_t> a(nwords), b(nwords);
+    for (size_t i = 0; i < nwords; ++i) {
+      a[i] = rng();
+      b[i] = rng() & rng(); // sparser, so |a ∧ b| ≠ |a ∨ b| / 2
+    }
+    uint32_t ref_h = 0, inter = 0, uni = 0;
+    for (size_t i = 0; i < nwords; ++i) {
+      for (int bit = 0; bit < 64; ++bit) {
+        bool x = (a[i] >> bit) & 1, y = (b[i] >> bit) & 1;
+        ref_h += x != y;
+        inter += x && y;
+        uni += x || y;
+      }
+    }
+    float ref_j = 1.0f - static_cast<float>(inter) / uni;
+    bool ok = true;
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const DistanceKernels &k = distance_kernels(k_level(lvl));
+      ok &= k.hamming(a.data(), b.data(), nwords) == ref_h;
+      ok &= std::fabs(k.jaccard(a.data(), b.data(), nwords) - ref_j) < 1e-6f;
+    }
+    check(ok, "Hamming/Jaccard exact at " + std::to_string(nwords) +
+                  " words");
+  }
+
+  std::vector<uint64_t> zero(4, 0);
+  check(distance_kernels().jaccard(zero.data(), zero.data(), 4) == 0.0f,
+        "Jaccard of two empty sets is 0");
+}
+
+void test_cosine_mode() {
+  std::cout << "\n[test_cosine_mode]" << std::endl;
+
+  std::mt19937 rng(17);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const size_t n = 300, d = 40, k = 8;
+  std::vector<float> base(n * d), query(d);
+  for (auto &v : base)
+    v = dist(rng);
+  for (auto &v : query)
+    v = dist(rng);
+
+  std::vector<float> raw = base;
+  for (size_t i = 0; i < n; ++i)
+    normalize_l2(base.data() + i * d, d);
+  check_near(distance_kernels().inner_product(base.data(), base.data(), d),
+             1.0f, 1e-5f, "normalize_l2 yields a unit vector");
+
+  // Reference: full three-dot-product cosine on the raw vectors.
+  std::vector<float> ref(n);
+  for (size_t i = 0; i < n; ++i)
+    ref[i] = 1.0f - cosine_sim(query.data(), raw.data() + i * d, d);
+  std::vector<float> sorted = ref;
+  std::sort(sorted.begin(), sorted.end());
+
+  auto res = brute_force_knn_cosine(query.data(), base.data(), n, d, k);
+  bool ok = res.size() == k;
+  for (size_t i = 0; ok && i < k; ++i) {
+    ok &= std::abs(res[i].distance - sorted[i]) < 1e-5f;
+    ok &= std::abs(ref[res[i].index] - res[i].distance) < 1e-5f;
+  }
+  check(ok, "cosine k-NN via one inner product matches full cosine");
+
+  std::vector<float> zero(d, 0.0f);
+  check(normalize_l2(zero.data(), d) == 0.0f && zero[0] == 0.0f,
+        "zero vector is left untouched");
+}
+
+void test_topk_selection() {
+  std::cout << "\n[test_topk_selection]" << std::endl;
+
+  std::mt19937 rng(23);
+  std::uniform_real_distribution<float> uni(0.0f, 1.0f);
+  const size_t n = 5000;
+  std::vector<float> dists(n);
+  for (auto &v : dists)
+    v = uni(rng);
+  std::vector<float> sorted = dists;
+  std::sort(sorted.begin(), sorted.end());
+
+  bool filter_ok = true;
+  std::vector<uint32_t> idx(n);
+  for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+    const DistanceKernels &k = distance_kernels(k_level(lvl));
+    for (size_t len : {0, 7, 33, 1000}) {
+      size_t m = k.filter_below(dists.data(), len, 0.25f, idx.data());
+      size_t expect = 0;
+      for (size_t i = 0; i < len; ++i)
+        if (dists[i] < 0.25f)
+          filter_ok &= idx[expect++] == i;
+      filter_ok &= m == expect;
+    }
+  }
+  check(filter_ok, "threshold filter returns survivors in order");
+
+  // Small k uses the heap, large k the filtered buffer.
+  for (size_t k : {1, 10, 64, 65, 500}) {
+    TopKSelector a(k), b(k);
+    a.push_block(dists.data(), n / 2, size_t{0});
+    b.push_block(dists.data() + n / 2, n - n / 2, n / 2);
+    a.merge(b);
+    auto top = a.take_sorted();
+    bool ok = top.size() == k;
+    for (size_t i = 0; ok && i < k; ++i)
+      ok &= top[i].distance == sorted[i] && dists[top[i].id] == sorted[i];
+    check(ok, "streaming top-" + std::to_string(k) + " matches full sort");
+  }
+
+  TopKSelector none(0);
+  none.push(0.0f, 0);
+  check(none.take_sorted().empty(), "k = 0 keeps nothing");
+}
+
+void test_fixed_dim_kernels() {
+  std::cout << "\n[test_fixed_dim_kernels]" << std::endl;
+
+  std::mt19937 rng(29);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const size_t n = 7; // one 4-row tile plus a 3-row tail
+  const float inf = std::numeric_limits<float>::infinity();
+  for (size_t d : {128, 384, 768, 1024, 1536}) {
+    std::vector<float> q(d), base(n * d), out(n);
+    for (auto &v : q)
+      v = dist(rng);
+    for (auto &v : base)
+      v = dist(rng);
+
+    bool ok = true;
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const DistanceKernels &k = distance_kernels_for_dim(d, k_level(lvl));
+      ok &= k.l2_sq != distance_kernels(k_level(lvl)).l2_sq;
+      // Relative tolerance: sums of ~d terms in a different order.
+      auto near = [&](float a, float b) {
+        return std::abs(a - b) <= 1e-4f * (1.0f + std::abs(b));
+      };
+      k.l2_sq_batch(q.data(), base.data(), n, d, out.data());
+      for (size_t i = 0; i < n; ++i) {
+        const float *x = base.data() + i * d;
+        float l2 = l2_distance_naive_test(q.data(), x, d);
+        float ip = distance_kernels(SimdLevel::Scalar)
+                       .inner_product(q.data(), x, d);
+        ok &= near(k.l2_sq(q.data(), x, d), l2) && near(out[i], l2);
+        ok &= near(k.inner_product(q.data(), x, d), ip);
+      }
+      k.inner_product_batch(q.data(), base.data(), n, d, out.data());
+      for (size_t i = 0; i < n; ++i)
+        ok &= near(out[i], k.inner_product(q.data(), base.data() + i * d, d));
+
+      // Bounded: exact under an infinite bound, never below a tight one.
+      ok &= k.l2_sq_bounded != distance_kernels(k_level(lvl)).l2_sq_bounded;
+      for (size_t i = 0; i < n; ++i) {
+        const float *x = base.data() + i * d;
+        float l2 = l2_distance_naive_test(q.data(), x, d);
+        ok &= near(k.l2_sq_bounded(q.data(), x, d, inf), l2);
+        ok &= k.l2_sq_bounded(q.data(), x, d, l2 * 0.1f) >= l2 * 0.1f;
+      }
+    }
+    const StorageKernels &s = storage_kernels_for_dim(ScalarType::FP32, d);
+    const StorageKernels &g = storage_kernels(ScalarType::FP32);
+    ok &= std::abs(s.l2_sq(q.data(), base.data(), d) -
+                   l2_distance_naive_test(q.data(), base.data(), d)) <
+          1e-4f * (1.0f + l2_distance_naive_test(q.data(), base.data(), d));
+
+    // Gather (the HNSW path): rows in scattered order, same as generic.
+    std::vector<uint32_t> ids = {5, 0, 3, 6, 1};
+    std::vector<float> fixed(ids.size()), generic(ids.size());
+    s.l2_sq_gather(q.data(), base.data(), d * sizeof(float), ids.data(),
+                   ids.size(), d, inf, fixed.data());
+    g.l2_sq_gather(q.data(), base.data(), d * sizeof(float), ids.data(),
+                   ids.size(), d, inf, generic.data());
+    ok &= s.l2_sq_gather != g.l2_sq_gather;
+    for (size_t i = 0; i < ids.size(); ++i)
+      ok &= std::abs(fixed[i] - generic[i]) <=
+            1e-4f * (1.0f + std::abs(generic[i]));
+    check(ok, "d=" + std::to_string(d) + " specialized kernels match generic");
+  }
+
+  check(&distance_kernels_for_dim(100) == &distance_kernels(),
+        "other dimensions fall back to the generic table");
+}
+
+void test_bounded_kernels() {
+  std::cout << "\n[test_bounded_kernels]" << std::endl;
+
+  std::mt19937 rng(31);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const float inf = std::numeric_limits<float>::infinity();
+  for (size_t d : {7, 100, 128, 777}) {
+    std::vector<float> x(d), y(d);
+    for (auto &v : x)
+      v = dist(rng);
+    for (auto &v : y)
+      v = dist(rng);
+    float exact = l2_distance_naive_test(x.data(), y.data(), d);
+
+    bool ok = true;
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const DistanceKernels &k = distance_kernels_for_dim(d, k_level(lvl));
+      auto near = [&](float a) {
+        return std::abs(a - exact) <= 1e-4f * (1.0f + exact);
+      };
+      ok &= near(k.l2_sq_bounded(x.data(), y.data(), d, inf));
+      ok &= near(k.l2_sq_bounded(x.data(), y.data(), d, exact * 1.5f));
+      // Past the bound: any value ≥ bound is allowed, never below it.
+      ok &= k.l2_sq_bounded(x.data(), y.data(), d, exact * 0.1f) >=
+            exact * 0.1f;
+      const StorageKernels &s = storage_kernels(ScalarType::FP32, k_level(lvl));
+      ok &= near(s.l2_sq_bounded(x.data(), y.data(), d, inf));
+    }
+    check(ok, "d=" + std::to_string(d) +
+                  " bounded L2 exact below bound, ≥ bound above");
+  }
+
+  // Reordering dimensions keeps distances and sorts by variance.
+  const size_t n = 50, d = 16;
+  std::vector<float> rows(n * d);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t j = 0; j < d; ++j)
+      rows[i * d + j] = dist(rng) * static_cast<float>(j + 1);
+  auto order = variance_order(rows.data(), n, d);
+  std::vector<float> a(d), b(d);
+  permute_dims(rows.data(), order.data(), d, a.data());
+  permute_dims(rows.data() + d, order.data(), d, b.data());
+  float before = l2_distance_naive_test(rows.data(), rows.data() + d, d);
+  check(order[0] == d - 1 && order[d - 1] == 0,
+        "variance_order puts the widest dimension first");
+  check(std::abs(l2_distance_naive_test(a.data(), b.data(), d) - before) <
+            1e-4f * (1.0f + before),
+        "permuted vectors keep their L2 distance");
+}
+
+void test_gather_kernels() {
+  std::cout << "\n[test_gather_kernels]" << std::endl;
+
+  std::mt19937 rng(37);
+  std::normal_distribution<float> dist(0.0f, 1.0f);
+  const float inf = std::numeric_limits<float>::infinity();
+  const size_t n = 40, d = 100;
+  // Rows with padding after the vector, as in an interleaved layout.
+  const std::vector<uint32_t> ids = {17, 3, 39, 0, 22, 22, 8, 31, 5};
+  std::vector<float> q(d), row(d), out(ids.size());
+  for (auto &v : q)
+    v = dist(rng);
+
+  for (ScalarType type :
+       {ScalarType::FP32, ScalarType::FP16, ScalarType::BF16}) {
+    bool ok = true;
+    for (int lvl = 0; lvl <= static_cast<int>(detect_simd_level()); ++lvl) {
+      const StorageKernels &s = storage_kernels(type, k_level(lvl));
+      size_t stride = d * scalar_type_size(type) + 48;
+      std::vector<uint8_t> base(n * stride);
+      std::mt19937 fill(41);
+      for (size_t i = 0; i < n; ++i) {
+        for (auto &v : row)
+          v = dist(fill);
+        s.encode(row.data(), &base[i * stride], d);
+      }
+      s.l2_sq_gather(q.data(), base.data(), stride, ids.data(), ids.size(), d,
+                     inf, out.data());
+      for (size_t i = 0; i < ids.size(); ++i)
+        ok &= out[i] ==
+              s.l2_sq_bounded(q.data(), &base[ids[i] * stride], d, inf);
+      s.inner_product_gather(q.data(), base.data(), stride, ids.data(),
+                             ids.size(), d, out.data());
+      for (size_t i = 0; i < ids.size(); ++i)
+        ok &= out[i] == s.inner_product(q.data(), &base[ids[i] * stride], d);
+    }
+    check(ok, std::string("gather matches per-row kernels (") +
+                  (type == ScalarType::FP32   ? "fp32"
+                   : type == ScalarType::FP16 ? "fp16"
+                                              : "bf16") +
+                  ")");
+  }
+}
+
 int main() {
   std::cout << "=== Distance Metric Tests ===" << std::endl;
 
@@ -151,6 +633,17 @@ int main() {
   test_symmetry();
   test_triangle_inequality();
   test_high_dimensional();
+  test_dispatched_kernels();
+  test_batch_kernels();
+  test_brute_force_knn_batch();
+  test_half_precision();
+  test_integer_kernels();
+  test_binary_kernels();
+  test_cosine_mode();
+  test_topk_selection();
+  test_fixed_dim_kernels();
+  test_bounded_kernels();
+  test_gather_kernels();
 
   std::cout << "\n--- Results: " << tests_passed << " passed, " << tests_failed
             << " failed ---" << std::endl;